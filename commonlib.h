@@ -229,7 +229,8 @@ static inline __attribute__((always_inline)) char *printable_time(
 static inline __attribute__((always_inline)) void dirlist_add_dir(
 	const char *dirpath,
 	int depth,
-	struct stat *st)
+	struct stat *st,
+	dirlist_t *parent) // - NULL for start directories
 {
 	dirlist_t *new_dir = malloc(sizeof(dirlist_t));
 	assert(new_dir);
@@ -243,6 +244,7 @@ static inline __attribute__((always_inline)) void dirlist_add_dir(
 	new_dir->filecnt	= 0;
 #     if defined(SRCH)
 	new_dir->du		= 0;
+	dirlist_link_parent(new_dir, parent);
 #     elif defined(RMTREE)
 	new_dir->all_inlined    = TRUE;
 #     elif defined(CHOWNTREE)
@@ -541,7 +543,7 @@ static void traverse_trees(
 			*rightmost = '\0';
 			rightmost--;
 		}
-		dirlist_add_dir(dirpaths[i], 1, &st);
+		dirlist_add_dir(dirpaths[i], 1, &st, NULL);
 	}
 
 #     if defined(RMTREE) || defined(CHMODTREE) || defined(CHOWNTREE)
@@ -597,7 +599,7 @@ static void traverse_trees(
 			if (getenv("DEBUG3"))
                         	fprintf(stderr, "traverse_trees() - running FINAL dirlist_add_dir()\n");
 #		      endif
-                        dirlist_add_dir(dirpaths[i], 1, &st);
+                        dirlist_add_dir(dirpaths[i], 1, &st, NULL);
                 }
 
                 while (queuesize > 0 || sleeping_thread_cnt < thread_cnt) {
@@ -722,6 +724,9 @@ static void *pthread_routine(
 
 	do {
 		if ((curdir = dirlist_pull_dir())) {
+#		      if defined(SRCH)
+			curdir->tdata = &thread_data[(unsigned long)id];
+#		      endif
 			walk_dir(curdir);
 #		      if defined(SRCH)
 			if (summarize_diskusage && curdir->du) {
@@ -751,6 +756,13 @@ static void *pthread_routine(
 						t = time(NULL);
 						timediff = t - last_t;
 						fprintf(stderr, "About %d files processed ", accum_filecnt);
+#					      if defined(SRCH)
+						if (copy_root) {
+							pthread_mutex_lock(&copy_lock);
+							fprintf(stderr, "and %llu MiB copied ", copy_bytes >> 20);
+							pthread_mutex_unlock(&copy_lock);
+						}
+#					      endif
 						if (timediff > 0)
 							fprintf(stderr, "(%i files/s)...\n", (int)((accum_filecnt - last_accum_filecnt)/timediff));
 						else
@@ -761,7 +773,12 @@ static void *pthread_routine(
 					pthread_mutex_unlock(&last_accum_filecnt_lock);
 				}
 			}
-			free(curdir);
+#		      if defined(SRCH)
+			if (track_completion)
+				dirlist_done(curdir, curdir->tdata);
+			else
+#		      endif
+				free(curdir);
 		}
 	} while (! master_finished);
 
@@ -852,8 +869,12 @@ static void thread_cleanup()
 	if (regex_opt) {
 		regfree(regexcomp);
 		free(regexcomp);
-	} else if (fast_match_opt)
+	} else if (fast_match_opt) {
 		free(fast_match_arg);
+		for (i = 0; i < fast_match_count; i++)
+			free(fast_match_list[i]);
+		free(fast_match_list);
+	}
 #     endif
 
 #if ! defined(__APPLE__)
@@ -901,83 +922,1975 @@ static inline __attribute__((always_inline)) gid_t groupname_to_gid_or_exit(
 
 /////////////////////////////////////////////////////////////////////////////
 
-static inline __attribute__((always_inline)) void do_run(
-	const char *cmd,
+#if ! defined(__MINGW32__)
+// Parse a chmod mode like chmod(1) does.  Returns FALSE if it is not valid, so that chmod itself can complain.
+static boolean mode_compile(
+	const char *s)
+{
+	mode_t old_umask;
+
+	if (*s >= '0' && *s <= '7') {
+		char *end;
+		long m = strtol(s, &end, 8);
+		if (*end || m > 07777)
+			return FALSE;
+		cmd_tmpl.octal = TRUE;
+		cmd_tmpl.octalmode = m;
+		return TRUE;
+	}
+
+	old_umask = umask(0);
+	(void) umask(old_umask);
+	cmd_tmpl.umask = old_umask;
+	while (TRUE) {
+		mode_t who = 0;
+
+		for (; *s && strchr("ugoa", *s); s++)
+			who |= *s == 'u' ? 04700 : *s == 'g' ? 02070 : *s == 'o' ? 01007 : 07777;
+		if (! *s || ! strchr("+-=", *s))
+			return FALSE;
+		while (*s && strchr("+-=", *s)) {
+			mode_clause_t *c;
+			cmd_tmpl.modes = realloc(cmd_tmpl.modes, (cmd_tmpl.modecount + 1) * sizeof(mode_clause_t));
+			assert(cmd_tmpl.modes);
+			c = &cmd_tmpl.modes[cmd_tmpl.modecount++];
+			memset(c, 0, sizeof(mode_clause_t));
+			c->who = who;
+			c->op = *s++;
+			if (*s && strchr("ugo", *s)) {
+				c->copy = *s == 'u' ? 0700 : *s == 'g' ? 0070 : 0007;
+				s++;
+				continue;
+			}
+			for (; *s && strchr("rwxXst", *s); s++)
+				switch (*s) {
+					case 'r': c->perm |= 0444; break;
+					case 'w': c->perm |= 0222; break;
+					case 'x': c->perm |= 0111; break;
+					case 'X': c->X = TRUE; break;
+					case 's': c->perm |= 06000; break;
+					case 't': c->perm |= 01000; break;
+				}
+		}
+		if (! *s)
+			return TRUE;
+		if (*s++ != ',')
+			return FALSE;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) mode_t mode_apply(
+	mode_t mode,
+	boolean isdir)
+{
+	unsigned i;
+
+	if (cmd_tmpl.octal)
+		return (mode & ~07777) | cmd_tmpl.octalmode;
+
+	for (i = 0; i < cmd_tmpl.modecount; i++) {
+		mode_clause_t *c = &cmd_tmpl.modes[i];
+		mode_t who = c->who ? c->who : 07777 & ~cmd_tmpl.umask;
+		mode_t perm = c->perm;
+
+		if (c->X && (isdir || (mode & 0111)))
+			perm |= 0111;
+		if (c->copy) {
+			mode_t bits = mode & c->copy;
+			bits = c->copy == 0700 ? bits >> 6 : c->copy == 0070 ? bits >> 3 : bits;
+			perm |= bits * 0111;
+		}
+		perm &= who;
+		if (c->op == '+')
+			mode |= perm;
+		else if (c->op == '-')
+			mode &= ~perm;
+		else
+			mode = (mode & ~(c->who ? c->who : 07777)) | perm;
+	}
+	return mode;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Check if the -r command, split into words, is one of the built-in actions run in-process by builtin_run().
+// The file path must be left out, or be given as a `{}' word (or `{} +') where the command expects it.
+static void builtin_compile(
+	char **argv,
+	unsigned argc)
+{
+	const char *target = NULL;
+
+	if (argc >= 2 && strcmp(argv[argc-1], "+") == 0 && strcmp(argv[argc-2], "{}") == 0)
+		argc -= 2;
+	else if (argc >= 2 && strcmp(argv[argc-1], "{}") == 0)
+		argc--;
+	if (argc == 3 && strcmp(argv[0], "mv") == 0 && strcmp(argv[1], "{}") == 0)
+		target = argv[2];
+	else
+		for (unsigned i = 0; i < argc; i++)
+			if (strstr(argv[i], "{}"))
+				return;
+
+	if ((argc == 1 && (strcmp(argv[0], "rm") == 0 || strcmp(argv[0], "unlink") == 0))
+	    || (argc == 2 && strcmp(argv[0], "rm") == 0 && strcmp(argv[1], "-f") == 0)) {
+		cmd_tmpl.builtin = BUILTIN_RM;
+		cmd_tmpl.force = argc == 2;
+	} else if (argc == 1 && strcmp(argv[0], "rmdir") == 0)
+		cmd_tmpl.builtin = BUILTIN_RMDIR;
+#     if ! defined(__MINGW32__)
+	else if (argc == 2 && strcmp(argv[0], "chmod") == 0) {
+		if (mode_compile(argv[1]))
+			cmd_tmpl.builtin = BUILTIN_CHMOD;
+	} else if ((argc == 2 || (argc == 3 && strcmp(argv[1], "-h") == 0))
+		   && (strcmp(argv[0], "chown") == 0 || strcmp(argv[0], "chgrp") == 0)) {
+		char *owner = strdup(argv[argc-1]);
+		char *group = NULL, *end;
+		boolean ok = TRUE;
+
+		assert(owner);
+		cmd_tmpl.nofollow = argc == 3;
+		if (strcmp(argv[0], "chgrp") == 0) {
+			group = owner;
+			owner = NULL;
+		} else if ((group = strchr(owner, ':'))) {
+			*group++ = '\0';
+			if (! *group)
+				ok = FALSE; // - "user:" means the login group of user to chown(1); leave that to chown
+		}
+		cmd_tmpl.uid = cmd_tmpl.gid = -1;
+		if (ok && owner && *owner) {
+			struct passwd *pw = getpwnam(owner);
+			if (pw)
+				cmd_tmpl.uid = pw->pw_uid;
+			else if ((cmd_tmpl.uid = strtol(owner, &end, 10)) < 0 || *end)
+				ok = FALSE;
+		}
+		if (ok && group && *group) {
+			struct group *gr = getgrnam(group);
+			if (gr)
+				cmd_tmpl.gid = gr->gr_gid;
+			else if ((cmd_tmpl.gid = strtol(group, &end, 10)) < 0 || *end)
+				ok = FALSE;
+		}
+		if (ok && (cmd_tmpl.uid >= 0 || cmd_tmpl.gid >= 0))
+			cmd_tmpl.builtin = BUILTIN_CHOWN;
+		free(owner ? owner : group);
+	} else if (argc == 1 && strcmp(argv[0], "touch") == 0)
+		cmd_tmpl.builtin = BUILTIN_TOUCH;
+	else if (strcmp(argv[0], "truncate") == 0
+		 && ((argc == 3 && strcmp(argv[1], "-s") == 0)
+		     || (argc == 2 && (strncmp(argv[1], "-s", 2) == 0 || strncmp(argv[1], "--size=", 7) == 0)))) {
+		const char *size = argc == 3 ? argv[2] : argv[1][1] == 's' ? argv[1] + 2 : argv[1] + 7;
+		char *end;
+		long long n = strtoll(size, &end, 10);
+
+		if (n >= 0 && end != size && (! *end || (strchr("KMGT", *end) && ! end[1]))) {
+			for (const char *u = "KMGT"; *end && *u; u++) {
+				n *= 1024;
+				if (*u == *end)
+					break;
+			}
+			cmd_tmpl.size = n;
+			cmd_tmpl.builtin = BUILTIN_TRUNCATE;
+		}
+	} else if (strcmp(argv[0], "mv") == 0 && (target || (argc == 3 && strcmp(argv[1], "-t") == 0))) {
+		if (! target)
+			target = argv[2];
+		if ((cmd_tmpl.targetfd = open(target, O_RDONLY | O_DIRECTORY)) < 0) {
+			fprintf(stderr, "%s: ", progname);
+			perror(target);
+			exit(1);
+		}
+		cmd_tmpl.builtin = BUILTIN_MV;
+	}
+#     endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if ! defined(__MINGW32__)
+// Check if name, which the action could not find, is a symbolic link to a missing file: the command handles those in
+// its own way, e.g. touch(1) creates the target, so they are left to it.
+static boolean builtin_dangling(
+	int dirfd,
+	const char *name)
+{
+	struct stat st;
+	int err = errno;
+	boolean dangling = fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+
+	errno = err;
+	return dangling;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Run a built-in action on name, relative to dirfd (AT_FDCWD if name is the full path).
+// st holds the lstat() data of the entry if available, else NULL.
+// Like the commands they stand in for, all but rm, rmdir, mv and chown -h act on the target of a symbolic link.
+// Returns FALSE if the entry is left to the command itself, see builtin_dangling().
+static boolean builtin_run(
+	thread_data_t *tdata,
+	int dirfd,
+	const char *name,
+	const char *path,
+	const struct stat *st)
+{
+	static const char *action[] = { "", "rm", "rmdir", "chmod", "chown", "touch", "truncate", "mv" };
+	int rc = 0;
+
+#     if ! defined(__MINGW32__)
+	struct stat stbuf;
+	const char *base;
+	int fd;
+
+	switch (cmd_tmpl.builtin) {
+		case BUILTIN_RM:
+			rc = unlinkat(dirfd, name, 0);
+			if (rc < 0 && errno == ENOENT && cmd_tmpl.force)
+				rc = 0;
+			break;
+		case BUILTIN_RMDIR:
+			rc = unlinkat(dirfd, name, AT_REMOVEDIR);
+			break;
+		case BUILTIN_CHMOD:
+			if (! st || S_ISLNK(st->st_mode)) { // - the mode of the target is changed
+				if ((rc = fstatat(dirfd, name, &stbuf, 0)) < 0)
+					break;
+				st = &stbuf;
+			}
+			mode_t mode = mode_apply(st->st_mode, S_ISDIR(st->st_mode)) & 07777;
+			if (mode != (st->st_mode & 07777))
+				rc = fchmodat(dirfd, name, mode, 0);
+			break;
+		case BUILTIN_CHOWN:
+			rc = fchownat(dirfd, name, (uid_t) cmd_tmpl.uid, (gid_t) cmd_tmpl.gid,
+				      cmd_tmpl.nofollow ? AT_SYMLINK_NOFOLLOW : 0);
+			break;
+		case BUILTIN_TOUCH:
+			rc = utimensat(dirfd, name, NULL, 0);
+			break;
+		case BUILTIN_TRUNCATE:
+			if ((rc = fd = openat(dirfd, name, O_WRONLY | O_NONBLOCK)) >= 0) {
+				rc = ftruncate(fd, cmd_tmpl.size);
+				close(fd);
+			}
+			break;
+		case BUILTIN_MV:
+			base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+			rc = renameat(dirfd, name, cmd_tmpl.targetfd, base);
+			break;
+	}
+	if (rc < 0 && errno == ENOENT && cmd_tmpl.builtin >= BUILTIN_CHMOD && cmd_tmpl.builtin <= BUILTIN_TRUNCATE
+	    && ! cmd_tmpl.nofollow && builtin_dangling(dirfd, name))
+		return FALSE;
+#     else
+	(void) dirfd;
+	(void) name;
+	(void) st;
+	rc = cmd_tmpl.builtin == BUILTIN_RMDIR ? rmdir(path) : unlink(path);
+	if (rc < 0 && errno == ENOENT && cmd_tmpl.force)
+		rc = 0;
+#     endif
+
+	if (rc < 0) {
+		pthread_mutex_lock(&perror_lock);
+		fprintf(stderr, "%s: %s ", progname, action[cmd_tmpl.builtin]);
+		perror(path);
+		pthread_mutex_unlock(&perror_lock);
+		tdata->builtin_failed++;
+	} else
+		tdata->builtin_done++;
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if ! defined(__MINGW32__)
+// Words that only mean something to the shell when first in a command.
+static const char *cmd_shell_words[] = {
+	"!", "{", "}", "[[", "case", "do", "done", "elif", "else", "esac", "fi", "for", "function", "if", "in", "select",
+	"then", "until", "while", ".", ":", "alias", "break", "cd", "continue", "eval", "exec", "exit", "export",
+	"readonly", "return", "set", "shift", "source", "times", "trap", "ulimit", "umask", "unset", NULL
+};
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Parse the -r command once: split it into words if no shell is needed, and find out if it ends with `{} +'.
+// Quotes are removed the same way as the shell does, so the common -r "chmod 644 '{}'" still runs without a shell.
+static void cmd_compile(
+	const char *text)
+{
+	size_t textlen = strlen(text);
+	char *word = malloc(textlen + 1);
+	char **argv = malloc((textlen / 2 + 2) * sizeof(char *));
+	const char *p = text;
+	unsigned argc = 0;
+	boolean shell = FALSE;
+	boolean has_pair = FALSE;
+
+	assert(word && argv);
+	memset(&cmd_tmpl, 0, sizeof(cmd_tmpl));
+	while (*p) {
+		size_t len = 0;
+
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (! *p)
+			break;
+		while (*p && *p != ' ' && *p != '\t') {
+			if (*p == '\'') {
+				const char *q = strchr(p+1, '\'');
+				if (! q) {
+					shell = TRUE;
+					break;
+				}
+				memcpy(word + len, p+1, q - p - 1);
+				len += q - p - 1;
+				p = q + 1;
+			} else if (*p == '"') {
+				const char *q = p + 1;
+				while (*q && *q != '"') {
+					if (*q == '$' || *q == '`' || *q == '\\')
+						shell = TRUE;
+					word[len++] = *q++;
+				}
+				if (! *q) {
+					shell = TRUE;
+					break;
+				}
+				p = q + 1;
+			} else if (*p == '\\') {
+				if (! p[1] || p[1] == '\n') {
+					shell = TRUE;
+					break;
+				}
+				word[len++] = p[1];
+				p += 2;
+			} else {
+				if (strchr("|&;<>()$`*?[#~\n", *p) || (*p == '=' && argc == 0))
+					shell = TRUE;
+				word[len++] = *p++;
+			}
+		}
+		if (shell && ! *p)
+			break;
+		word[len] = '\0';
+		argv[argc] = strdup(word);
+		assert(argv[argc]);
+		argc++;
+		if (shell)
+			break;
+	}
+	free(word);
+
+	if (! shell && argc)
+		builtin_compile(argv, argc);
+
+#     if ! defined(__MINGW32__)
+	if (! shell && argc) {
+		const char **w;
+		for (w = cmd_shell_words; *w; w++)
+			if (strcmp(argv[0], *w) == 0)
+				shell = TRUE;
+	}
+	if (! shell && ! argc)
+		shell = TRUE;
+#     else
+	shell = TRUE; // - no posix_spawn() on Windows, so system() is used
+#     endif
+
+	if (! shell && argc >= 2 && strcmp(argv[argc-1], "+") == 0 && strcmp(argv[argc-2], "{}") == 0) {
+		cmd_tmpl.batch = TRUE;
+		argc -= 2;
+	} else if (shell) {
+		// - the words are not complete, so look at the end of the text for `{} +', `'{}' +' or `"{}" +'
+		const char *end = text + textlen;
+		while (end > text && (end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		if (end - text >= 4 && end[-1] == '+' && (end[-2] == ' ' || end[-2] == '\t')) {
+			const char *e = end - 2;
+			while (e > text && (e[-1] == ' ' || e[-1] == '\t'))
+				e--;
+			if (e - text >= 2 && strncmp(e - 2, "{}", 2) == 0)
+				e -= 2;
+			else if (e - text >= 4 && (strncmp(e - 4, "'{}'", 4) == 0 || strncmp(e - 4, "\"{}\"", 4) == 0))
+				e -= 4;
+			else
+				e = NULL;
+			if (e && (e == text || e[-1] == ' ' || e[-1] == '\t')) {
+				cmd_tmpl.batch = TRUE;
+				textlen = e - text;
+			}
+		}
+	}
+
+	if (cmd_tmpl.batch && post_order)
+		cmd_tmpl.batch = FALSE; // - batches of different threads run in any order, so run one command per entry
+
+	if (cmd_tmpl.batch) {
+#	      if defined(__MINGW32__)
+		fprintf(stderr, "Option -r with `{} +' is not supported on Windows - bailing out.\n");
+		exit(1);
+#	      else
+		char **env;
+		long argmax = sysconf(_SC_ARG_MAX);
+		size_t used = 2048; // - headroom, as recommended by POSIX for xargs
+
+		if (argmax <= 0)
+			argmax = 128 * 1024;
+		for (env = environ; *env; env++)
+			used += strlen(*env) + 1 + sizeof(char *);
+		used += shell ? textlen + 32 : 0;
+		for (unsigned i = 0; i < argc; i++)
+			used += strlen(argv[i]) + 1 + sizeof(char *);
+		cmd_tmpl.argmax = (size_t) argmax > used + 4096 ? (size_t) argmax - used : 4096;
+#	      endif
+	}
+
+	cmd_tmpl.shell = shell;
+	if (shell) {
+		cmd_tmpl.script = malloc(textlen + 8);
+		assert(cmd_tmpl.script);
+		memcpy(cmd_tmpl.script, text, textlen);
+		cmd_tmpl.script[textlen] = '\0';
+		has_pair = strstr(cmd_tmpl.script, "{}") != NULL;
+		if (cmd_tmpl.batch)
+			strcat(cmd_tmpl.script, " \"$@\""); // - the paths are passed as positional parameters
+		while (argc)
+			free(argv[--argc]);
+		free(argv);
+	} else {
+		cmd_tmpl.argv = argv;
+		cmd_tmpl.argc = argc;
+		for (unsigned i = 0; i < argc; i++)
+			if (strstr(argv[i], "{}"))
+				has_pair = TRUE;
+	}
+
+	if (cmd_tmpl.batch && has_pair) {
+		fprintf(stderr, "Option -r: only one `{}' pair is allowed with `{} +' - bailing out.\n");
+		exit(1);
+	}
+	if (cmd_tmpl.builtin)
+		cmd_tmpl.batch = FALSE; // - nothing to gain from batching; the odd entry left to the command is appended
+	cmd_tmpl.append = ! has_pair && ! cmd_tmpl.batch;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Replace every `{}' pair in s with path, or append path enclosed by single quotes if quote is set and there is no pair.
+static char *cmd_expand(
+	const char *s,
+	const char *path,
+	boolean quote)
+{
+	size_t pathlen = strlen(path);
+	size_t size = strlen(s) + 1;
+	const char *p;
+	char *expanded, *e;
+
+	for (p = s; (p = strstr(p, "{}")); p += 2)
+		size += pathlen;
+	if (quote)
+		for (p = path; *p; p++)
+			size += *p == '\'' ? 6 : 1; // - ' becomes '\''
+	expanded = e = malloc(size + 3);
+	assert(expanded);
+
+	while ((p = strstr(s, "{}"))) {
+		memcpy(e, s, p - s);
+		e += p - s;
+		memcpy(e, path, pathlen);
+		e += pathlen;
+		s = p + 2;
+	}
+	strcpy(e, s);
+	e += strlen(s);
+	if (quote) {
+		*e++ = ' ';
+		*e++ = '\'';
+		for (p = path; *p; p++)
+			if (*p == '\'') {
+				memcpy(e, "'\\''", 4);
+				e += 4;
+			} else
+				*e++ = *p;
+		*e++ = '\'';
+		*e = '\0';
+	}
+	return expanded;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Add the time elapsed since start.  The caller holds cmd_lock.
+static void latency_add(
+	latency_t *lat,
+	const struct timeval *start)
+{
+	struct timeval now;
+	unsigned long long usec, v;
+	unsigned bucket;
+
+	(void) gettimeofday(&now, NULL);
+	usec = now.tv_sec > start->tv_sec || (now.tv_sec == start->tv_sec && now.tv_usec > start->tv_usec) ?
+		(now.tv_sec - start->tv_sec) * 1000000ULL + now.tv_usec - start->tv_usec : 0;
+	for (bucket = 0, v = usec; v && bucket < LATENCY_BUCKETS-1; bucket++)
+		v >>= 1;
+	lat->bucket[bucket]++;
+	lat->count++;
+	lat->total += usec;
+	if (usec > lat->max)
+		lat->max = usec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns an upper limit in microseconds for the given percentile, i.e. the end of the bucket it falls in.
+static unsigned long long latency_percentile(
+	const latency_t *lat,
+	unsigned percent)
+{
+	unsigned long seen = 0;
+	unsigned bucket;
+
+	for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+		seen += lat->bucket[bucket];
+		if (seen * 100 >= (unsigned long long) lat->count * percent)
+			break;
+	}
+	if (bucket == 0)
+		return 0;
+	return bucket < LATENCY_BUCKETS-1 && (1ULL << bucket) - 1 < lat->max ? (1ULL << bucket) - 1 : lat->max;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Print one line of option -S, with the times in milliseconds.
+static void latency_print(
+	const char *what,
+	const latency_t *lat)
+{
+	if (! lat->count)
+		return;
+	fprintf(stderr, "- %s: mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n", what,
+		lat->total / 1000.0 / lat->count, latency_percentile(lat, 50) / 1000.0, latency_percentile(lat, 90) / 1000.0,
+		latency_percentile(lat, 99) / 1000.0, lat->max / 1000.0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Run one command and wait for it.  With option --jobs, wait first until fewer than cmd_jobs are running.
+static void cmd_spawn(
+	char **argv)
+{
+	int status = 0, err = 0;
+	boolean failed;
+	struct timeval start;
+
+	if (debug) {
+		pthread_mutex_lock(&perror_lock);
+		fprintf(stderr, "Running");
+		for (char **a = argv; *a; a++)
+			fprintf(stderr, " '%s'", *a);
+		fprintf(stderr, "\n");
+		pthread_mutex_unlock(&perror_lock);
+	}
+
+	pthread_mutex_lock(&cmd_lock);
+	while (cmd_jobs && cmd_running >= cmd_jobs)
+		pthread_cond_wait(&cmd_cond, &cmd_lock);
+	cmd_running++;
+	cmd_spawned++;
+	pthread_mutex_unlock(&cmd_lock);
+	(void) gettimeofday(&start, NULL);
+
+#     if defined(__MINGW32__)
+	status = system(argv[2]);
+	if (status < 0)
+		err = errno;
+#     else
+	pid_t pid;
+
+	err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+	if (! err)
+		while (waitpid(pid, &status, 0) < 0)
+			if (errno != EINTR) {
+				err = errno;
+				break;
+			}
+#     endif
+	if (err) {
+		pthread_mutex_lock(&perror_lock);
+		fprintf(stderr, "%s: %s: %s\n", progname, argv[0], strerror(err));
+		pthread_mutex_unlock(&perror_lock);
+	}
+#     if defined(__MINGW32__)
+	failed = err || status;
+#     else
+	failed = err || ! WIFEXITED(status) || WEXITSTATUS(status);
+#     endif
+
+	pthread_mutex_lock(&cmd_lock);
+	latency_add(&cmd_run_latency, &start);
+	cmd_running--;
+	if (failed)
+		cmd_failed++;
+	if (cmd_jobs)
+		pthread_cond_signal(&cmd_cond);
+	pthread_mutex_unlock(&cmd_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Run the command for count NUL separated paths.
+static void cmd_run_batch(
+	char *paths,
+	unsigned count)
+{
+	unsigned argc = 0, i;
+	char **argv;
+	char *p;
+
+	argv = malloc((cmd_tmpl.argc + count + 5) * sizeof(char *));
+	assert(argv);
+	if (cmd_tmpl.shell) {
+		argv[argc++] = "/bin/sh";
+		argv[argc++] = "-c";
+		argv[argc++] = cmd_tmpl.script;
+		argv[argc++] = "sh"; // - $0
+	} else
+		for (i = 0; i < cmd_tmpl.argc; i++)
+			argv[argc++] = cmd_tmpl.argv[i];
+	for (i = 0, p = paths; i < count; i++, p += strlen(p) + 1)
+		argv[argc++] = p;
+	argv[argc] = NULL;
+
+	cmd_spawn(argv);
+	free(argv);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Run the command for one path.
+static void cmd_run_path(
+	const char *path)
+{
+	if (cmd_tmpl.shell) {
+		char *argv[4] = { "/bin/sh", "-c", NULL, NULL };
+		argv[2] = cmd_expand(cmd_tmpl.script, path, cmd_tmpl.append);
+		cmd_spawn(argv);
+		free(argv[2]);
+	} else {
+		char **argv = malloc((cmd_tmpl.argc + 2) * sizeof(char *));
+		unsigned i;
+
+		assert(argv);
+		for (i = 0; i < cmd_tmpl.argc; i++)
+			argv[i] = strstr(cmd_tmpl.argv[i], "{}") ? cmd_expand(cmd_tmpl.argv[i], path, FALSE) : cmd_tmpl.argv[i];
+		argv[i++] = cmd_tmpl.append ? (char *) path : NULL;
+		argv[i] = NULL;
+		cmd_spawn(argv);
+		for (i = 0; i < cmd_tmpl.argc; i++)
+			if (argv[i] != cmd_tmpl.argv[i])
+				free(argv[i]);
+		free(argv);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Paths, which must be malloc'ed, or NULL for a chunk of --copy.
+static cmd_job_t *cmd_job_new(
+	char *paths,
+	unsigned count)
+{
+	cmd_job_t *job = calloc(1, sizeof(cmd_job_t));
+
+	assert(job);
+	job->paths = paths;
+	job->count = count;
+	return job;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Hand job over to the executor threads.  Waits while the queue is full.
+static void cmd_enqueue(
+	cmd_job_t *job)
+{
+	struct timeval start;
+
+	pthread_mutex_lock(&cmd_lock);
+	if (cmd_queued >= cmd_queue_max) {
+		latency_t throttled;
+		memset(&throttled, 0, sizeof(throttled));
+		(void) gettimeofday(&start, NULL);
+		while (cmd_queued >= cmd_queue_max)
+			pthread_cond_wait(&cmd_room_cond, &cmd_lock);
+		latency_add(&throttled, &start);
+		cmd_throttled += throttled.total;
+	}
+	(void) gettimeofday(&job->queued, NULL);
+	if (cmd_queue_tail)
+		cmd_queue_tail->next = job;
+	else
+		cmd_queue_head = job;
+	cmd_queue_tail = job;
+	cmd_queued++;
+	pthread_cond_signal(&cmd_queue_cond);
+	pthread_mutex_unlock(&cmd_lock);
+}
+
+#if ! defined(__MINGW32__)
+/////////////////////////////////////////////////////////////////////////////
+
+// Report a failure of option --copy.
+static void copy_error(
+	const char *path,
+	const char *msg)
+{
+	pthread_mutex_lock(&perror_lock);
+	fprintf(stderr, "%s: copy %s: %s\n", progname, path, msg);
+	pthread_mutex_unlock(&perror_lock);
+	pthread_mutex_lock(&copy_lock);
+	copy_failed++;
+	pthread_mutex_unlock(&copy_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Where path goes below the --copy target: `.' and empty components are left out, and `..' takes away the one before
+// it, if any, so that the result always stays below the target, e.g. /a/../../x goes to <target>/x.
+static char *copy_dst(
 	const char *path)
 {
-	char expanded_cmd[LINE_MAX];
+	char *dst = malloc(copy_rootlen + 1 + strlen(path) + 1), *p;
+	const char *end;
+
+	assert(dst);
+	strcpy(dst, copy_root);
+	p = dst + copy_rootlen;
+	for (; *path; path = end) {
+		while (*path == '/')
+			path++;
+		for (end = path; *end && *end != '/'; end++)
+			;
+		if (end - path == 2 && path[0] == '.' && path[1] == '.') {
+			while (p > dst + copy_rootlen && *--p != '/')
+				;
+			*p = '\0';
+		} else if (end > path && ! (end - path == 1 && *path == '.')) {
+			*p++ = '/';
+			memcpy(p, path, end - path);
+			p += end - path;
+			*p = '\0';
+		}
+	}
+	return dst;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Create the missing directories above dst, like mkdir -p.  Returns 0 or an errno value.
+static int copy_mkdirs(
+	char *dst)
+{
+	char *p;
+	int err = 0;
+
+	for (p = dst + copy_rootlen + 1; ! err && (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		if (mkdir(dst, 0777) < 0 && errno != EEXIST)
+			err = errno;
+		*p = '/';
+	}
+	return err;
+}
 
-	// First, handle simple cases without the system() call
-	if (strcmp(cmd, "rm") == 0) {
-		if (unlink(path) < 0) {
-                	pthread_mutex_lock(&perror_lock);
-                	fprintf(stderr, "%s: ", progname);
-                	perror(path);
-                	pthread_mutex_unlock(&perror_lock);
+/////////////////////////////////////////////////////////////////////////////
+
+// Copy len bytes at offset, with copy_file_range() if possible, which lets the file system clone or copy them
+// without passing the data through user space.  Returns 0 or an errno value.
+static int copy_range(
+	int in,
+	int out,
+	off_t offset,
+	off_t len)
+{
+	off_t inoff = offset, outoff = offset;
+	ssize_t n, w;
+	char *buf;
+	int err = 0;
+
+#     if defined(__linux__)
+	while (len > 0) {
+		n = copy_file_range(in, &inoff, out, &outoff, len > (1 << 30) ? (1 << 30) : (size_t) len, 0);
+		if (n > 0)
+			len -= n;
+		else if (n == 0) // - the file has shrunk
+			return 0;
+		else if (errno != EINTR) {
+			if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP)
+				return errno;
+			break; // - not supported here, use read() and write()
+		}
+	}
+	if (len <= 0)
+		return 0;
+#     endif
+	buf = malloc(COPY_BUF_SIZE);
+	assert(buf);
+	while (len > 0 && ! err) {
+		n = pread(in, buf, len > COPY_BUF_SIZE ? COPY_BUF_SIZE : (size_t) len, inoff);
+		if (n < 0) {
+			if (errno != EINTR)
+				err = errno;
+			continue;
 		}
+		if (n == 0)
+			break;
+		inoff += n;
+		len -= n;
+		for (ssize_t done = 0; done < n && ! err; done += w) {
+			w = pwrite(out, buf + done, n - done, outoff);
+			if (w < 0) {
+				w = 0;
+				if (errno != EINTR)
+					err = errno;
+			} else
+				outoff += w;
+		}
+	}
+	free(buf);
+	return err;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Copy one chunk of f, or all of it if it is not split.  The last chunk done sets mode and times, and frees f.
+static void copy_chunk(
+	copy_file_t *f,
+	off_t offset)
+{
+	off_t len = f->size - offset < f->chunk ? f->size - offset : f->chunk;
+	int err = copy_range(f->in, f->out, offset, len);
+	boolean last;
+
+	pthread_mutex_lock(&copy_lock);
+	if (err && ! f->err)
+		f->err = err;
+	if (! err)
+		copy_bytes += len;
+	last = --f->pending == 0;
+	pthread_mutex_unlock(&copy_lock);
+	if (! last)
+		return;
+
+	if (! f->err && fchmod(f->out, f->mode & 07777) < 0)
+		f->err = errno;
+	if (! f->err && futimens(f->out, f->times) < 0)
+		f->err = errno;
+	if (close(f->out) < 0 && ! f->err)
+		f->err = errno;
+	close(f->in);
+	if (f->err)
+		copy_error(f->src, strerror(f->err));
+	else {
+		pthread_mutex_lock(&copy_lock);
+		copy_done++;
+		pthread_mutex_unlock(&copy_lock);
+	}
+	free(f->src);
+	free(f->dst);
+	free(f);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Copy path below the --copy target.  Directories only get their mode and times in copy_finish(), as copying into
+// them changes their mtime, and they may not be writable.
+static void copy_entry(
+	const char *path,
+	const struct stat *st)
+{
+	char *dst = copy_dst(path);
+	struct timespec times[2];
+	copy_file_t *f;
+	char target[PATH_MAX];
+	ssize_t n;
+	int rc, in, out;
+
+#     if defined(__linux__)
+	times[0] = st->st_atim;
+	times[1] = st->st_mtim;
+#     else
+	times[0].tv_sec = st->st_atime;
+	times[1].tv_sec = st->st_mtime;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+#     endif
+
+	switch (st->st_mode & S_IFMT) {
+		case S_IFDIR:
+			rc = mkdir(dst, 0700);
+			if (rc < 0 && errno == ENOENT && ! copy_mkdirs(dst))
+				rc = mkdir(dst, 0700);
+			if (rc < 0 && errno != EEXIST) {
+				copy_error(path, strerror(errno));
+				break;
+			}
+			pthread_mutex_lock(&copy_lock);
+			if (copy_dircount == copy_dirsize) {
+				copy_dirsize = copy_dirsize ? 2 * copy_dirsize : 1024;
+				copy_dirs = realloc(copy_dirs, copy_dirsize * sizeof(copy_dir_t));
+				assert(copy_dirs);
+			}
+			copy_dirs[copy_dircount].dst = dst;
+			copy_dirs[copy_dircount].mode = st->st_mode;
+			copy_dirs[copy_dircount].times[0] = times[0];
+			copy_dirs[copy_dircount].times[1] = times[1];
+			copy_dircount++;
+			copy_done++;
+			pthread_mutex_unlock(&copy_lock);
+			return;
+		case S_IFLNK:
+			if ((n = readlink(path, target, sizeof(target) - 1)) < 0) {
+				copy_error(path, strerror(errno));
+				break;
+			}
+			target[n] = '\0';
+			rc = symlink(target, dst);
+			if (rc < 0 && errno == ENOENT && ! copy_mkdirs(dst))
+				rc = symlink(target, dst);
+			if (rc < 0 && errno == EEXIST && unlink(dst) == 0)
+				rc = symlink(target, dst);
+			if (rc < 0 || utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW) < 0) {
+				copy_error(path, strerror(errno));
+				break;
+			}
+			pthread_mutex_lock(&copy_lock);
+			copy_done++;
+			pthread_mutex_unlock(&copy_lock);
+			break;
+		case S_IFREG:
+			if ((in = open(path, O_RDONLY)) < 0) {
+				copy_error(path, strerror(errno));
+				break;
+			}
+			out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+			if (out < 0 && errno == ENOENT && ! copy_mkdirs(dst))
+				out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+			if (out < 0) {
+				copy_error(path, strerror(errno));
+				close(in);
+				break;
+			}
+			f = calloc(1, sizeof(copy_file_t));
+			assert(f);
+			f->in = in;
+			f->out = out;
+			f->src = strdup(path);
+			f->dst = dst;
+			assert(f->src);
+			f->size = st->st_size;
+			f->mode = st->st_mode;
+			f->times[0] = times[0];
+			f->times[1] = times[1];
+			f->pending = 1;
+			f->chunk = f->size;
+			if (f->size > 2 * (off_t) COPY_CHUNK_SIZE && cmd_executor && ftruncate(out, f->size) == 0) {
+				// - the chunks may be written in any order, and all but the first are left to the executors
+				off_t offset;
+				f->pending = (f->size + COPY_CHUNK_SIZE - 1) / COPY_CHUNK_SIZE;
+				f->chunk = COPY_CHUNK_SIZE;
+				for (offset = COPY_CHUNK_SIZE; offset < f->size; offset += COPY_CHUNK_SIZE) {
+					cmd_job_t *job = cmd_job_new(NULL, 0);
+					job->copy = f;
+					job->offset = offset;
+					pthread_mutex_lock(&copy_lock);
+					copy_chunks++;
+					pthread_mutex_unlock(&copy_lock);
+					cmd_enqueue(job);
+				}
+			}
+			copy_chunk(f, 0);
+			return;
+		default:
+			copy_error(path, "not copied, only files, directories and symbolic links are supported");
+			break;
+	}
+	free(dst);
+}
 
+/////////////////////////////////////////////////////////////////////////////
+
+// Give the copied directories their mode and times, and free them.  A directory is always matched before its subdirs,
+// so going backwards handles subdirs first, while their parents are still searchable.
+static void copy_finish()
+{
+	while (copy_dircount--) {
+		copy_dir_t *d = &copy_dirs[copy_dircount];
+		if (chmod(d->dst, d->mode & 07777) < 0 || utimensat(AT_FDCWD, d->dst, d->times, 0) < 0)
+			copy_error(d->dst, strerror(errno));
+		free(d->dst);
+	}
+	free(copy_dirs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// XXH64 by Yann Collet, a fast non-cryptographic 64-bit hash, as used by option --dupes.  The input is read in
+// native byte order, so the values equal those of the reference implementation on little-endian machines only.
+#define XXH_PRIME1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3	0x165667B19E3779F9ULL
+#define XXH_PRIME4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5	0x27D4EB2F165667C5ULL
+#define XXH_ROTL(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+typedef struct xxh64 {
+	unsigned long long v[4];
+	unsigned long long total;
+	unsigned char	 mem[32];	  // - input not yet consumed, less than a stripe
+	unsigned	 memlen;
+} xxh64_t;
+
+static inline unsigned long long xxh64_round(
+	unsigned long long acc,
+	unsigned long long input)
+{
+	acc += input * XXH_PRIME2;
+	acc = XXH_ROTL(acc, 31);
+	return acc * XXH_PRIME1;
+}
+
+static inline unsigned long long xxh64_read64(
+	const unsigned char *p)
+{
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void xxh64_init(
+	xxh64_t *h)
+{
+	memset(h, 0, sizeof(xxh64_t));
+	h->v[0] = XXH_PRIME1 + XXH_PRIME2;
+	h->v[1] = XXH_PRIME2;
+	h->v[2] = 0;
+	h->v[3] = 0 - XXH_PRIME1;
+}
+
+static void xxh64_update(
+	xxh64_t *h,
+	const unsigned char *p,
+	size_t len)
+{
+	const unsigned char *end = p + len;
+
+	h->total += len;
+	if (h->memlen + len < 32) {
+		memcpy(h->mem + h->memlen, p, len);
+		h->memlen += len;
 		return;
-	} else if (strcmp(cmd, "rmdir") == 0) {
-		if (rmdir(path) < 0) {
+	}
+	if (h->memlen) {
+		memcpy(h->mem + h->memlen, p, 32 - h->memlen);
+		p += 32 - h->memlen;
+		h->v[0] = xxh64_round(h->v[0], xxh64_read64(h->mem));
+		h->v[1] = xxh64_round(h->v[1], xxh64_read64(h->mem + 8));
+		h->v[2] = xxh64_round(h->v[2], xxh64_read64(h->mem + 16));
+		h->v[3] = xxh64_round(h->v[3], xxh64_read64(h->mem + 24));
+		h->memlen = 0;
+	}
+	for (; p + 32 <= end; p += 32) {
+		h->v[0] = xxh64_round(h->v[0], xxh64_read64(p));
+		h->v[1] = xxh64_round(h->v[1], xxh64_read64(p + 8));
+		h->v[2] = xxh64_round(h->v[2], xxh64_read64(p + 16));
+		h->v[3] = xxh64_round(h->v[3], xxh64_read64(p + 24));
+	}
+	memcpy(h->mem, p, end - p);
+	h->memlen = end - p;
+}
+
+static unsigned long long xxh64_digest(
+	const xxh64_t *h)
+{
+	const unsigned char *p = h->mem, *end = h->mem + h->memlen;
+	unsigned long long hash;
+	unsigned i;
+
+	if (h->total >= 32) {
+		hash = XXH_ROTL(h->v[0], 1) + XXH_ROTL(h->v[1], 7) + XXH_ROTL(h->v[2], 12) + XXH_ROTL(h->v[3], 18);
+		for (i = 0; i < 4; i++) {
+			hash ^= xxh64_round(0, h->v[i]);
+			hash = hash * XXH_PRIME1 + XXH_PRIME4;
+		}
+	} else
+		hash = XXH_PRIME5;
+	hash += h->total;
+	for (; p + 8 <= end; p += 8) {
+		hash ^= xxh64_round(0, xxh64_read64(p));
+		hash = XXH_ROTL(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if (p + 4 <= end) {
+		unsigned v;
+		memcpy(&v, p, sizeof(v));
+		hash ^= (unsigned long long) v * XXH_PRIME1;
+		hash = XXH_ROTL(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		hash ^= *p * XXH_PRIME5;
+		hash = XXH_ROTL(hash, 11) * XXH_PRIME1;
+	}
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Remember a regular file for option --dupes.  Each thread collects into its own list.
+static void dupe_add(
+	dupe_list_t *list,
+	const char *path,
+	const struct stat *st)
+{
+	dupe_file_t *f;
+
+	if (list->count == list->size) {
+		list->size = list->size ? 2 * list->size : 1024;
+		list->files = realloc(list->files, list->size * sizeof(dupe_file_t));
+		assert(list->files);
+	}
+	f = &list->files[list->count++];
+	memset(f, 0, sizeof(dupe_file_t));
+	f->size = st->st_size;
+	f->ino = st->st_ino;
+	f->dev = st->st_dev;
+	f->path = strdup(path);
+	assert(f->path);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Hash count files for option --dupes: a sample of DUPE_SAMPLE_SIZE bytes at the head and at the tail in the first
+// round, all of the content in the second.  Files not larger than the sample are hashed in full right away.
+static void dupe_hash(
+	dupe_file_t **files,
+	unsigned count)
+{
+	char *buf = malloc(DUPE_BUF_SIZE);
+	unsigned long sampled = 0, hashed = 0, failed = 0;
+	unsigned long long bytes = 0;
+	unsigned i;
+
+	assert(buf);
+	for (i = 0; i < count; i++) {
+		dupe_file_t *f = files[i];
+		boolean full = f->round || f->size <= 2 * DUPE_SAMPLE_SIZE;
+		ssize_t n = 0;
+		xxh64_t h;
+		int fd;
+
+		if ((fd = open(f->path, O_RDONLY)) < 0) {
+			n = -1;
+		} else if (full) {
+#		      if defined(POSIX_FADV_SEQUENTIAL)
+			(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#		      endif
+			xxh64_init(&h);
+			while ((n = read(fd, buf, DUPE_BUF_SIZE)) > 0) {
+				xxh64_update(&h, (unsigned char *) buf, n);
+				bytes += n;
+			}
+		} else {
+			xxh64_init(&h);
+			if ((n = pread(fd, buf, DUPE_SAMPLE_SIZE, 0)) > 0) {
+				xxh64_update(&h, (unsigned char *) buf, n);
+				bytes += n;
+				if ((n = pread(fd, buf, DUPE_SAMPLE_SIZE, f->size - DUPE_SAMPLE_SIZE)) > 0) {
+					xxh64_update(&h, (unsigned char *) buf, n);
+					bytes += n;
+				}
+			}
+		}
+		if (n < 0) {
 			pthread_mutex_lock(&perror_lock);
-			fprintf(stderr, "%s: ", progname);
-			perror(path);
+			fprintf(stderr, "%s: %s: %s\n", progname, f->path, strerror(errno));
 			pthread_mutex_unlock(&perror_lock);
+			f->failed = TRUE;
+			failed++;
+		} else {
+			f->hash = xxh64_digest(&h);
+			f->round = full ? 2 : 1;
+			if (full)
+				hashed++;
+			else
+				sampled++;
 		}
+		if (fd >= 0)
+			close(fd);
+	}
+	free(buf);
+	pthread_mutex_lock(&dupe_lock);
+	dupe_sampled += sampled;
+	dupe_hashed += hashed;
+	dupe_failed += failed;
+	dupe_read += bytes;
+	pthread_mutex_unlock(&dupe_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
 
+// SHA-256 (FIPS 180-4), for options --manifest and --verify.
+typedef struct sha256 {
+	uint32_t	 h[8];
+	unsigned long long total;
+	unsigned char	 block[64];
+	unsigned	 blocklen;
+} sha256_t;
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(
+	uint32_t h[8],
+	const unsigned char *p)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+	unsigned i;
+
+	for (i = 0; i < 16; i++, p += 4)
+		w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+	for (; i < 64; i++)
+		w[i] = w[i-16] + (SHA256_ROTR(w[i-15], 7) ^ SHA256_ROTR(w[i-15], 18) ^ (w[i-15] >> 3))
+		       + w[i-7] + (SHA256_ROTR(w[i-2], 17) ^ SHA256_ROTR(w[i-2], 19) ^ (w[i-2] >> 10));
+	a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; f = h[5]; g = h[6]; k = h[7];
+	for (i = 0; i < 64; i++) {
+		t1 = k + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		k = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256_init(
+	sha256_t *s)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(s->h, iv, sizeof(iv));
+	s->total = 0;
+	s->blocklen = 0;
+}
+
+static void sha256_update(
+	sha256_t *s,
+	const unsigned char *p,
+	size_t len)
+{
+	s->total += len;
+	if (s->blocklen) {
+		size_t n = 64 - s->blocklen < len ? 64 - s->blocklen : len;
+		memcpy(s->block + s->blocklen, p, n);
+		s->blocklen += n;
+		p += n;
+		len -= n;
+		if (s->blocklen < 64)
+			return;
+		sha256_compress(s->h, s->block);
+		s->blocklen = 0;
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		sha256_compress(s->h, p);
+	memcpy(s->block, p, len);
+	s->blocklen = len;
+}
+
+static void sha256_final(
+	sha256_t *s,
+	unsigned char digest[32])
+{
+	unsigned long long bits = s->total * 8;
+	unsigned i;
+
+	s->block[s->blocklen++] = 0x80;
+	if (s->blocklen > 56) {
+		memset(s->block + s->blocklen, 0, 64 - s->blocklen);
+		sha256_compress(s->h, s->block);
+		s->blocklen = 0;
+	}
+	memset(s->block + s->blocklen, 0, 56 - s->blocklen);
+	for (i = 0; i < 8; i++)
+		s->block[56+i] = bits >> (56 - 8 * i);
+	sha256_compress(s->h, s->block);
+	for (i = 0; i < 32; i++)
+		digest[i] = s->h[i/4] >> (24 - 8 * (i % 4));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Write path to stdout with `\' and newline escaped as `\\' and `\n', so each manifest record is one line.
+static void manifest_put_path(
+	const char *path)
+{
+	for (; *path; path++)
+		if (*path == '\\')
+			fputs("\\\\", stdout);
+		else if (*path == '\n')
+			fputs("\\n", stdout);
+		else
+			putchar(*path);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Write the manifest record of a file, or with option --verify, compare digest with the hash in the manifest.
+// Called with manifest_lock held.
+static void manifest_result(
+	const char *path,
+	unsigned long long size,
+	long long mtime,
+	long mtime_nsec,
+	const unsigned char *digest,
+	const unsigned char *expected)
+{
+	unsigned i;
+
+	if (expected) {
+		if (memcmp(digest, expected, 32) == 0)
+			return;
+		manifest_failed++;
+		fputs("FAILED ", stdout);
+	} else {
+		for (i = 0; i < 32; i++)
+			printf("%02x", digest[i]);
+		printf(" %llu %lld.%09ld ", size, mtime, mtime_nsec);
+	}
+	manifest_put_path(path);
+	putchar('\n');
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Hash chunk index of f.  The thread hashing the last chunk of a file reports it and frees it.
+static void manifest_chunk(
+	manifest_file_t *f,
+	unsigned index)
+{
+	unsigned long long offset = (unsigned long long) index * MANIFEST_CHUNK_SIZE, end, done = 0;
+	unsigned char digest[32];
+	boolean failed = FALSE;
+	char *buf = malloc(MANIFEST_BUF_SIZE);
+	sha256_t sha;
+	int fd;
+
+	assert(buf);
+	end = f->chunks > 1 && offset + MANIFEST_CHUNK_SIZE < f->size ? offset + MANIFEST_CHUNK_SIZE : f->size;
+	sha256_init(&sha);
+	if ((fd = open(f->path, O_RDONLY)) < 0)
+		failed = TRUE;
+	else {
+#	      if defined(POSIX_FADV_SEQUENTIAL)
+		(void) posix_fadvise(fd, offset, end - offset, POSIX_FADV_SEQUENTIAL);
+#	      endif
+		while (offset < end) {
+			ssize_t n = pread(fd, buf, end - offset < MANIFEST_BUF_SIZE ? end - offset : MANIFEST_BUF_SIZE, offset);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				failed = TRUE;
+				break;
+			}
+			if (n == 0) // - the file shrank, which its hash will show
+				break;
+			sha256_update(&sha, (unsigned char *) buf, n);
+			offset += n;
+			done += n;
+		}
+	}
+	if (failed) {
+		pthread_mutex_lock(&perror_lock);
+		fprintf(stderr, "%s: %s: %s\n", progname, f->path, strerror(errno));
+		pthread_mutex_unlock(&perror_lock);
+	}
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	if (f->chunks > 1)
+		sha256_final(&sha, f->digests[index]);
+	else
+		sha256_final(&sha, digest);
+
+	pthread_mutex_lock(&manifest_lock);
+	manifest_bytes += done;
+	f->failed |= failed;
+	if (--f->pending) {
+		pthread_mutex_unlock(&manifest_lock);
 		return;
 	}
+	if (f->chunks > 1) {
+		sha256_init(&sha);
+		sha256_update(&sha, (unsigned char *) f->digests, 32 * f->chunks);
+		sha256_final(&sha, digest);
+	}
+	if (f->failed)
+		manifest_failed++;
+	else {
+		manifest_hashed++;
+		manifest_result(f->path, f->size, f->mtime, f->mtime_nsec, digest, verify_path ? f->expected : NULL);
+	}
+	pthread_mutex_unlock(&manifest_lock);
+	free(f->digests);
+	free(f->path);
+	free(f);
+}
 
-	int pathlen = strlen(path);
-	pthread_mutex_lock(&cmd_lock); // - lock cmd for private use since it will be manipulated if it contains {} pair(s)
-	int cmdlen = strlen(cmd);
-	if (cmdlen + pathlen > LINE_MAX-2) {
-		fprintf(stderr, "Joining command line and path may exceed %i (LINE_MAX) characters - bailing out.\n", (int) LINE_MAX);
-		exit(1);
+/////////////////////////////////////////////////////////////////////////////
+
+// Hand the chunks of a regular file over to the executor threads.  expected is the hash to compare with for
+// option --verify, or NULL.
+static void manifest_hash(
+	const char *path,
+	unsigned long long size,
+	long long mtime,
+	long mtime_nsec,
+	const unsigned char *expected)
+{
+	manifest_file_t *f = calloc(1, sizeof(manifest_file_t));
+	unsigned i;
+
+	assert(f);
+	f->path = strdup(path);
+	assert(f->path);
+	f->size = size;
+	f->mtime = mtime;
+	f->mtime_nsec = mtime_nsec;
+	f->chunks = size > MANIFEST_CHUNK_SIZE ? (size + MANIFEST_CHUNK_SIZE - 1) / MANIFEST_CHUNK_SIZE : 1;
+	f->pending = f->chunks;
+	if (f->chunks > 1) {
+		f->digests = malloc(f->chunks * sizeof(*f->digests));
+		assert(f->digests);
+		pthread_mutex_lock(&manifest_lock);
+		manifest_chunks += f->chunks;
+		pthread_mutex_unlock(&manifest_lock);
+	}
+	if (expected)
+		memcpy(f->expected, expected, 32);
+	for (i = 0; i < f->chunks; i++) {
+		cmd_job_t *job = cmd_job_new(NULL, 0);
+		job->manifest = f;
+		job->offset = i;
+		cmd_enqueue(job);
 	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static unsigned manifest_path_hash(
+	const char *path)
+{
+	unsigned hash = 2166136261u; // - FNV-1a
+
+	for (; *path; path++)
+		hash = (hash ^ (unsigned char) *path) * 16777619u;
+	return hash;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// A regular file matched with option --manifest.  If an old manifest was given and it has the file with the same
+// size and mtime, its hash is taken from there instead of reading the file.
+static void manifest_entry(
+	const char *path,
+	const struct stat *st)
+{
+	long long mtime = st->st_mtime;
+#     if defined(__linux__)
+	long mtime_nsec = st->st_mtim.tv_nsec;
+#     else
+	long mtime_nsec = 0;
+#     endif
 
-	char *left1 = strchr(cmd, '{');
-	char *right1 = left1 + 1;
-	if (left1 && *right1 == '}') { // - if left1 == NULL, *right1 will NOT be evaluated
-		*left1 = '\0';
-		*right1 = '\0';
-		strcpy(expanded_cmd, cmd);
-                strcat(expanded_cmd, path);
-
-		char *left2 = strchr(right1+1, '{');
-		char *right2 = left2 + 1;
-		if (left2 && *right2 == '}') { // - if left2 == NULL, *right2 will NOT be evaluated
-			if (cmdlen + 2*pathlen > LINE_MAX-2) {
-				fprintf(stderr, "Joining command line and 2 x path may exceed %i (LINE_MAX) characters - bailing out.\n", (int) LINE_MAX);
-				exit(1);
+	if (manifest_table) {
+		manifest_rec_t *rec = manifest_table[manifest_path_hash(path) & (manifest_tablesize - 1)];
+		for (; rec; rec = rec->next)
+			if (strcmp(rec->path, path) == 0) {
+				if (rec->size == (unsigned long long) st->st_size && rec->mtime == mtime && rec->mtime_nsec == mtime_nsec) {
+					pthread_mutex_lock(&manifest_lock);
+					manifest_reused++;
+					manifest_result(path, rec->size, mtime, mtime_nsec, rec->hash, NULL);
+					pthread_mutex_unlock(&manifest_lock);
+					return;
+				}
+				break;
 			}
-			*left2 = '\0';
-			*right2 = '\0';
-			strcat(expanded_cmd, right1+1);
-			strcat(expanded_cmd, path);
-			strcat(expanded_cmd, right2+1);
-			*left2 = '{';
-			*right2 = '}';
-		} else {
-                	strcat(expanded_cmd, right1+1);
+	}
+	manifest_hash(path, st->st_size, mtime, mtime_nsec, NULL);
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void *cmd_executor_routine(
+	void *arg)
+{
+	cmd_job_t *job;
+
+	(void) arg;
+	for (;;) {
+		pthread_mutex_lock(&cmd_lock);
+		while (! cmd_queue_head && ! cmd_queue_closed)
+			pthread_cond_wait(&cmd_queue_cond, &cmd_lock);
+		job = cmd_queue_head;
+		if (! job) {
+			pthread_mutex_unlock(&cmd_lock);
+			return NULL;
 		}
-			
-		*left1 = '{';
-		*right1 = '}';
-	} else {
-		strcpy(expanded_cmd, cmd);
-		strcat(expanded_cmd, " '");
-		strcat(expanded_cmd, path);
-		strcat(expanded_cmd, "'");
+		cmd_queue_head = job->next;
+		if (! cmd_queue_head)
+			cmd_queue_tail = NULL;
+		cmd_queued--;
+		latency_add(&cmd_wait_latency, &job->queued);
+		pthread_cond_signal(&cmd_room_cond);
+		pthread_mutex_unlock(&cmd_lock);
+
+#	      if ! defined(__MINGW32__)
+		if (job->copy)
+			copy_chunk(job->copy, job->offset);
+		else if (job->dupes)
+			dupe_hash(job->dupes, job->count);
+		else if (job->manifest)
+			manifest_chunk(job->manifest, job->offset);
+		else
+#	      endif
+		if (cmd_tmpl.batch)
+			cmd_run_batch(job->paths, job->count);
+		else
+			cmd_run_path(job->paths);
+		free(job->paths);
+		free(job);
 	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Start cmd_jobs executor threads, by default one per traversal thread.
+static void cmd_executor_start(
+	unsigned threads)
+{
+	unsigned i;
+
+	if (! cmd_jobs)
+		cmd_jobs = threads;
+	if (! cmd_queue_max)
+		cmd_queue_max = copy_root ? 4 * cmd_jobs : // - every large file being copied keeps two descriptors open
+				cmd_tmpl.batch ? 2 * cmd_jobs : 1024; // - a batch may hold up to ARG_MAX bytes of paths
+	cmd_queue_closed = FALSE; // - option --dupes starts the executors once per round
+	cmd_executors = calloc(cmd_jobs, sizeof(pthread_t));
+	assert(cmd_executors);
+	for (i = 0; i < cmd_jobs; i++)
+		if (pthread_create(&cmd_executors[i], NULL, cmd_executor_routine, NULL)) {
+			fprintf(stderr, "%s: ", progname);
+			perror("pthread_create()");
+			exit(1);
+		}
+	cmd_executor = TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Let the executor threads empty the queue, and wait for them.
+static void cmd_executor_finish()
+{
+	unsigned i;
+
+	pthread_mutex_lock(&cmd_lock);
+	cmd_queue_closed = TRUE;
+	pthread_cond_broadcast(&cmd_queue_cond);
 	pthread_mutex_unlock(&cmd_lock);
+	for (i = 0; i < cmd_jobs; i++)
+		pthread_join(cmd_executors[i], NULL);
+	free(cmd_executors);
+	cmd_executor = FALSE;
+}
 
-	if (debug)
-		fprintf(stderr, "Running '%s'\n", expanded_cmd);
-	if (system(expanded_cmd) < 0) {
-		pthread_mutex_lock(&perror_lock);
+/////////////////////////////////////////////////////////////////////////////
+
+// Run the command for the paths collected in batch, or queue it for an executor thread.
+static void cmd_flush(
+	cmd_batch_t *batch)
+{
+	if (! batch->count)
+		return;
+	if (cmd_executor) {
+		cmd_enqueue(cmd_job_new(batch->buf, batch->count));
+		batch->buf = malloc(cmd_tmpl.argmax);
+		assert(batch->buf);
+	} else
+		cmd_run_batch(batch->buf, batch->count);
+	batch->len = batch->cost = batch->count = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Run the -r command for path; dirfd and name are used by the built-in actions, see builtin_run().
+static inline __attribute__((always_inline)) void do_run(
+	thread_data_t *tdata,
+	int dirfd,
+	const char *name,
+	const char *path,
+	const struct stat *st)
+{
+	cmd_batch_t *batch = tdata->batch;
+
+	// First, handle simple cases without starting a process
+	if (cmd_tmpl.builtin && builtin_run(tdata, dirfd, name, path, st))
+		return;
+
+	if (cmd_tmpl.batch) {
+		size_t pathlen = strlen(path) + 1;
+		if (batch->count && batch->cost + pathlen + sizeof(char *) > cmd_tmpl.argmax)
+			cmd_flush(batch);
+		if (batch->len + pathlen > cmd_tmpl.argmax) { // - only if a single path is longer than argmax
+			batch->buf = realloc(batch->buf, batch->len + pathlen);
+			assert(batch->buf);
+		}
+		memcpy(batch->buf + batch->len, path, pathlen);
+		batch->len += pathlen;
+		batch->cost += pathlen + sizeof(char *);
+		batch->count++;
+		return;
+	}
+
+	if (cmd_executor) {
+		char *p = strdup(path);
+		assert(p);
+		cmd_enqueue(cmd_job_new(p, 1));
+	} else
+		cmd_run_path(path);
+}
+
+#if ! defined(__MINGW32__)
+/////////////////////////////////////////////////////////////////////////////
+
+// Let the executor threads hash the files in list, in jobs of about DUPE_JOB_BYTES to read.
+static void dupe_round(
+	dupe_file_t **list,
+	size_t count,
+	unsigned threads)
+{
+	unsigned long long bytes = 0;
+	size_t first = 0, i;
+
+	cmd_executor_start(threads);
+	for (i = 0; i < count; i++) {
+		bytes += list[i]->round || list[i]->size <= 2 * DUPE_SAMPLE_SIZE ? list[i]->size : 2 * DUPE_SAMPLE_SIZE;
+		if (bytes >= DUPE_JOB_BYTES || i + 1 - first >= DUPE_JOB_FILES || i + 1 == count) {
+			cmd_job_t *job = cmd_job_new(NULL, i + 1 - first);
+			job->dupes = list + first;
+			cmd_enqueue(job);
+			first = i + 1;
+			bytes = 0;
+		}
+	}
+	cmd_executor_finish();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int dupe_cmp_inode(
+	const void *a,
+	const void *b)
+{
+	const dupe_file_t *x = a, *y = b;
+
+	if (x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+static int dupe_cmp_hash(
+	const void *a,
+	const void *b)
+{
+	const dupe_file_t *x = *(dupe_file_t * const *) a;
+	const dupe_file_t *y = *(dupe_file_t * const *) b;
+
+	if (x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+// Groups with the most bytes to reclaim first.
+static int dupe_cmp_reclaim(
+	const void *a,
+	const void *b)
+{
+	const dupe_file_t *x = *(dupe_file_t * const *) a;
+	const dupe_file_t *y = *(dupe_file_t * const *) b;
+	unsigned long long xr = x->size * (x->groupsize - 1), yr = y->size * (y->groupsize - 1);
+
+	if (xr != yr)
+		return xr > yr ? -1 : 1;
+	return dupe_cmp_hash(a, b);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Sort list on size and hash, and keep the files which still share both with another one.  Returns the new count.
+static size_t dupe_regroup(
+	dupe_file_t **list,
+	size_t count)
+{
+	size_t kept = 0, i, j, k;
+
+	for (i = 0; i < count; i++)
+		if (! list[i]->failed)
+			list[kept++] = list[i];
+	qsort(list, kept, sizeof(dupe_file_t *), dupe_cmp_hash);
+	count = kept;
+	for (i = kept = 0; i < count; i = j) {
+		for (j = i + 1; j < count && list[j]->size == list[i]->size && list[j]->hash == list[i]->hash; j++)
+			;
+		if (j - i < 2)
+			continue;
+		for (k = i; k < j; k++) {
+			list[k]->groupsize = j - i;
+			list[kept++] = list[k];
+		}
+	}
+	return kept;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Find and print the duplicates among the files collected by the threads for option --dupes.  Files are grouped on
+// size first, and only those sharing their size with another inode are read at all.
+static void dupe_report(
+	unsigned threads)
+{
+	dupe_list_t *all = thread_data[threads].dupes;
+	dupe_file_t **list, **todo;
+	unsigned long long reclaim = 0;
+	unsigned long group = 0, redundant = 0;
+	size_t count = 0, n, i, j;
+
+	for (i = 0; i < threads; i++) {
+		dupe_list_t *add = thread_data[i].dupes;
+		if (all->count + add->count > all->size) {
+			all->size = all->count + add->count;
+			all->files = realloc(all->files, all->size * sizeof(dupe_file_t));
+			assert(all->files);
+		}
+		memcpy(all->files + all->count, add->files, add->count * sizeof(dupe_file_t));
+		all->count += add->count;
+		free(add->files);
+		free(add);
+	}
+	qsort(all->files, all->count, sizeof(dupe_file_t), dupe_cmp_inode);
+	list = malloc((all->count + 1) * sizeof(dupe_file_t *));
+	todo = malloc((all->count + 1) * sizeof(dupe_file_t *));
+	assert(list && todo);
+
+	// - one file per inode, of the sizes shared by at least two inodes
+	for (i = 0; i < all->count; i = j) {
+		n = 1;
+		for (j = i + 1; j < all->count && all->files[j].size == all->files[i].size; j++)
+			if (all->files[j].dev == all->files[j-1].dev && all->files[j].ino == all->files[j-1].ino) {
+				all->files[j].linked = TRUE;
+				dupe_links++;
+			} else
+				n++;
+		if (n < 2)
+			continue;
+		for (; i < j; i++)
+			if (! all->files[i].linked)
+				list[count++] = &all->files[i];
+	}
+
+	dupe_round(list, count, threads);
+	count = dupe_regroup(list, count);
+	for (i = n = 0; i < count; i++)
+		if (list[i]->round == 1)
+			todo[n++] = list[i];
+	if (n) {
+		dupe_round(todo, n, threads);
+		count = dupe_regroup(list, count);
+	}
+
+	qsort(list, count, sizeof(dupe_file_t *), dupe_cmp_reclaim);
+	for (i = 0; i < count; i++) {
+		if (! i || list[i]->size != list[i-1]->size || list[i]->hash != list[i-1]->hash) {
+			group++;
+			reclaim += list[i]->size * (list[i]->groupsize - 1);
+			redundant += list[i]->groupsize - 1;
+		}
+		if (! cntdupes || group <= cntdupes)
+			printf("%-19llu %-12lu %s\n", list[i]->size, group, list[i]->path);
+	}
+	printf("%-19llu %-12lu (reclaimable)\n", reclaim, redundant);
+
+	for (i = 0; i < all->count; i++)
+		free(all->files[i].path);
+	free(all->files);
+	free(all);
+	free(list);
+	free(todo);
+}
+#endif
+
+#if ! defined(__MINGW32__)
+/////////////////////////////////////////////////////////////////////////////
+
+// Parse one manifest line into rec, unescaping the path in place.  Returns FALSE if it is not a record.
+static boolean manifest_parse(
+	char *line,
+	manifest_rec_t *rec)
+{
+	char *p, *q;
+	int off = 0;
+	unsigned i;
+
+	for (i = 0; i < 32; i++) {
+		unsigned byte;
+		if (! isxdigit((unsigned char) line[2*i]) || ! isxdigit((unsigned char) line[2*i+1])
+		    || sscanf(line + 2*i, "%2x", &byte) != 1)
+			return FALSE;
+		rec->hash[i] = byte;
+	}
+	if (sscanf(line + 64, " %llu %lld.%ld%n", &rec->size, &rec->mtime, &rec->mtime_nsec, &off) != 3 || line[64+off] != ' ')
+		return FALSE;
+	rec->path = line + 64 + off + 1; // - the path may start with a blank
+	rec->path[strcspn(rec->path, "\n")] = '\0';
+	for (p = q = rec->path; *p; p++, q++)
+		if (p[0] == '\\' && (p[1] == '\\' || p[1] == 'n'))
+			*q = *++p == 'n' ? '\n' : '\\';
+		else
+			*q = *p;
+	*q = '\0';
+	return *rec->path != '\0';
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Read a manifest written by option --manifest.  With option --verify, the files are checked right away; otherwise
+// the records go into manifest_table, for --manifest=<old manifest>.
+static void manifest_read(
+	const char *file)
+{
+	FILE *fp = fopen(file, "r");
+	manifest_rec_t rec, *list = NULL, *next;
+	char *line = NULL, header[64];
+	size_t size = 0;
+	unsigned long count = 0, lineno = 0;
+	struct stat st;
+	int rc;
+
+	if (! fp) {
 		fprintf(stderr, "%s: ", progname);
-		perror(cmd);
-		pthread_mutex_unlock(&perror_lock);
+		perror(file);
+		exit(1);
+	}
+	snprintf(header, sizeof(header), MANIFEST_HEADER, MANIFEST_CHUNK_SIZE);
+	while (getline(&line, &size, fp) > 0) {
+		lineno++;
+		if (lineno == 1 && strcmp(line, header) != 0) {
+			fprintf(stderr, "%s: %s is not a manifest written by this version of option --manifest.\n", progname, file);
+			exit(1);
+		}
+		if (*line == '#')
+			continue;
+		if (! manifest_parse(line, &rec)) {
+			fprintf(stderr, "%s: %s, line %lu: not a manifest record.\n", progname, file, lineno);
+			exit(1);
+		}
+		if (! verify_path) {
+			manifest_rec_t *copy = malloc(sizeof(manifest_rec_t));
+			assert(copy);
+			*copy = rec;
+			copy->path = strdup(rec.path);
+			assert(copy->path);
+			copy->next = list;
+			list = copy;
+			count++;
+			continue;
+		}
+
+		manifest_records++; // - only read by the main thread
+		if ((rc = lstat(rec.path, &st)) < 0 || ! S_ISREG(st.st_mode) || (unsigned long long) st.st_size != rec.size) {
+			const char *what = rc < 0 && errno == ENOENT ? "MISSING " : "FAILED ";
+			pthread_mutex_lock(&manifest_lock);
+			manifest_failed++;
+			fputs(what, stdout);
+			manifest_put_path(rec.path);
+			putchar('\n');
+			pthread_mutex_unlock(&manifest_lock);
+			continue;
+		}
+		if (verify_quick && st.st_mtime == rec.mtime
+#		      if defined(__linux__)
+		    && st.st_mtim.tv_nsec == rec.mtime_nsec
+#		      endif
+		    ) {
+			pthread_mutex_lock(&manifest_lock);
+			manifest_reused++;
+			pthread_mutex_unlock(&manifest_lock);
+			continue;
+		}
+		manifest_hash(rec.path, rec.size, rec.mtime, rec.mtime_nsec, rec.hash);
+	}
+	if (ferror(fp)) {
+		fprintf(stderr, "%s: ", progname);
+		perror(file);
+		exit(1);
+	}
+	free(line);
+	fclose(fp);
+	if (verify_path)
+		return;
+
+	for (manifest_tablesize = 1024; manifest_tablesize < 2 * count; manifest_tablesize *= 2)
+		;
+	manifest_table = calloc(manifest_tablesize, sizeof(manifest_rec_t *));
+	assert(manifest_table);
+	for (; list; list = next) {
+		manifest_rec_t **bucket = &manifest_table[manifest_path_hash(list->path) & (manifest_tablesize - 1)];
+		next = list->next;
+		list->next = *bucket;
+		*bucket = list;
 	}
 }
+#endif
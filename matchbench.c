@@ -0,0 +1,525 @@
+/*
+   matchbench - compare the -N matchers of strmatch.h with the byte-at-a-time tolower() matcher they replaced
+
+   Copyright (C) 2020 - 2024 by Jorn I. Viken <jornv@1337.no>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Usage: matchbench [-r <rounds>] [-f <file>|-] [<needle> ...]
+// Times every matcher over sets of names, for each needle, and then for any of the needles at once, as with several
+// -N, also with the Aho-Corasick automaton.  Checks that all of them find the same matches.
+// Then times a few --glob patterns against fnmatch(3) and regexec(3) with the equivalent -n regular expression,
+// and a few -n/-i expressions with and without the literal prefilter, and finally regexec(3) run by 1 to 64 threads,
+// all sharing one compiled expression as srch once did, or each with its own copy.
+// With -f, the names are read from <file>, or standard input for -, one per line, e.g. `srch / | matchbench -f -`;
+// otherwise three synthetic sets are used: short file names like in a source or system tree, longer mixed-case
+// document names, and full paths as matched by -a.
+// Exits with status 1 if a matcher disagrees with the old one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <locale.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "strmatch.h"
+
+#define NAME_COUNT	100000
+
+typedef struct nameset {
+	const char	*title;
+	char		**names;
+	size_t		*lens;
+	size_t		 count;
+} nameset_t;
+
+typedef struct matcher {
+	const char	*title;
+	strmatch_fn_t	 find;
+} matcher_t;
+
+static const char *needles_default[] = { "a", "log", ".conf", "readme", "final", "x-ray-unseen", NULL };
+
+static const char *globs[][2] = { // - a --glob pattern, and the -n regular expression doing the same
+	{ "*.log",		"^.*\\.log$" },
+	{ "core.[0-9]*",	"^core\\.[0-9].*$" },
+	{ "???.tmp",		"^...\\.tmp$" },
+	{ "*_test.*",		"^.*_test\\..*$" },
+	{ "Makefile",		"^Makefile$" },
+	{ "lib*.so.[0-9]",	"^lib.*\\.so\\.[0-9]$" },
+	{ "*[Rr]eport*20??*",	"^.*[Rr]eport.*20...*$" },
+	{ NULL,			NULL }
+};
+
+static const unsigned thread_counts[] = { 1, 8, 32, 64, 0 };
+
+typedef struct regex_job {
+	const nameset_t	*set;
+	regex_t		*re;		  // - shared by all jobs, or owned by this one
+	unsigned	 rounds;
+	unsigned	 first;		  // - this job matches every step-th name from first on
+	unsigned	 step;
+	size_t		 found;
+} regex_job_t;
+
+static const char *regexes[] = { "^core$", "\\.(c|h)$", "\\.c$|\\.h$", "readme|license", "^lib.*\\.so", "[0-9]+\\.log$", "a.c", "^source", NULL };
+
+/////////////////////////////////////////////////////////////////////////////
+
+// The matcher of srch -N before strmatch.h, kept as the reference.
+static char *strstr_tolower(
+	const char *haystack,
+	size_t haylen,
+	const char *needle,
+	size_t needlelen)
+{
+	const char *hayptr, *needleptr;
+
+	(void) haylen;
+	(void) needlelen;
+	for (needleptr = needle; *haystack; haystack++, needleptr = needle) {
+		hayptr = haystack;
+		while (1) {
+			if (! *needleptr)
+				return (char *) haystack;
+			if (tolower((int)*hayptr++) != *needleptr++)
+				break;
+		}
+	}
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void nameset_add(
+	nameset_t *set,
+	const char *name)
+{
+	if (! (set->count & (set->count + 1))) { // - grow at 0, 1, 3, 7, ...
+		set->names = realloc(set->names, (set->count + 1) * 2 * sizeof(char *));
+		set->lens = realloc(set->lens, (set->count + 1) * 2 * sizeof(size_t));
+		if (! set->names || ! set->lens) {
+			perror("matchbench");
+			exit(1);
+		}
+	}
+	set->lens[set->count] = strlen(name);
+	set->names[set->count++] = strdup(name);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void nameset_synthetic(
+	nameset_t *sets)
+{
+	static const char *stems[] = { "main", "util", "Makefile", "libc", "README", "config", "index", "test_parser",
+				       "CMakeLists", "__init__", "kernel", "Image", "photo", "node_modules", "lib64",
+				       "\xc5\xbfource" }; // - with U+017F, a long s, which -i takes for s in UTF-8
+	static const char *exts[] = { ".c", ".h", ".o", ".so.6", ".py", ".txt", ".md", ".json", ".conf", ".log", "",
+				      ".jpg", ".JPG", ".tar.gz" };
+	static const char *words[] = { "Quarterly", "Report", "meeting", "notes", "FINAL", "draft", "Invoice",
+				       "summer", "Holiday", "budget", "copy", "v2", "Review", "presentation" };
+	static const char *dirs[] = { "/usr", "/home/jornv", "/var/log", "/opt/app", "/srv/share/Projects", "/etc",
+				      "/usr/lib/x86_64-linux-gnu", "/home/jornv/Documents/Archive 2019" };
+	char buf[512];
+	size_t i;
+	unsigned seed = 1;
+
+	sets[0].title = "short file names";
+	sets[1].title = "document names";
+	sets[2].title = "full paths (-a)";
+	for (i = 0; i < NAME_COUNT; i++) {
+		int n, w;
+
+		snprintf(buf, sizeof(buf), "%s%u%s", stems[rand_r(&seed) % 16], rand_r(&seed) % 100, exts[rand_r(&seed) % 14]);
+		nameset_add(&sets[0], buf);
+
+		n = 0;
+		for (w = 2 + rand_r(&seed) % 5; w > 0; w--)
+			n += snprintf(buf + n, sizeof(buf) - n, "%s%s", n ? " " : "", words[rand_r(&seed) % 14]);
+		snprintf(buf + n, sizeof(buf) - n, " (%u).docx", rand_r(&seed) % 10);
+		nameset_add(&sets[1], buf);
+
+		n = snprintf(buf, sizeof(buf), "%s", dirs[rand_r(&seed) % 8]);
+		for (w = rand_r(&seed) % 4; w > 0; w--)
+			n += snprintf(buf + n, sizeof(buf) - n, "/%s", stems[rand_r(&seed) % 16]);
+		snprintf(buf + n, sizeof(buf) - n, "/%s%s", stems[rand_r(&seed) % 16], exts[rand_r(&seed) % 14]);
+		nameset_add(&sets[2], buf);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static double elapsed_ns(
+	const struct timespec *t0,
+	const struct timespec *t1,
+	unsigned rounds,
+	size_t count)
+{
+	return ((t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec)) / ((double) rounds * (count ? count : 1));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Time matching any of the needles, as with several -N: one matcher called for each needle in turn, as srch would
+// need to without the automaton, and strmatch_ac_find().  Returns 1 if they disagree.
+static int bench_any(
+	const nameset_t *set,
+	const matcher_t *matchers,
+	unsigned nmatchers,
+	const char **needles,
+	unsigned rounds)
+{
+	struct timespec t0, t1;
+	strmatch_ac_t *ac;
+	size_t expect = 0, found, k, *lens;
+	unsigned count, m, n, r;
+	int status = 0;
+
+	for (count = 0; needles[count]; count++)
+		;
+	lens = malloc(count * sizeof(size_t));
+	ac = strmatch_ac_compile((char **) needles, count);
+	if (! lens || ! ac) {
+		perror("matchbench");
+		exit(1);
+	}
+	for (n = 0; n < count; n++)
+		lens[n] = strlen(needles[n]);
+
+	printf("%-14s", "any of them");
+	for (m = 0; m < nmatchers; m++) {
+		found = 0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (r = 0; r < rounds; r++)
+			for (k = 0; k < set->count; k++)
+				for (n = 0; n < count; n++)
+					if (matchers[m].find(set->names[k], set->lens[k], needles[n], lens[n])) {
+						found++;
+						break;
+					}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		printf(" %11.2f ns", elapsed_ns(&t0, &t1, rounds, set->count));
+		if (! m)
+			expect = found;
+	}
+	printf(" %9zu\n", expect / rounds);
+
+	found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (r = 0; r < rounds; r++)
+		for (k = 0; k < set->count; k++)
+			found += strmatch_ac_find(ac, set->names[k]) >= 0;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("%-14s %11.2f ns (%u states)", "Aho-Corasick", elapsed_ns(&t0, &t1, rounds, set->count), ac->states);
+	if (found != expect) {
+		printf(" <- %zu matches, expected %zu", found / rounds, expect / rounds);
+		status = 1;
+	}
+	printf("\n");
+
+	strmatch_ac_free(ac);
+	free(lens);
+	return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Time the --glob matcher against fnmatch(3) and regexec(3).  Returns 1 if they disagree.
+static int bench_glob(
+	const nameset_t *set,
+	unsigned rounds)
+{
+	static const char *kinds[] = { "exact", "prefix", "suffix", "infix", "DFA", "NFA" };
+	struct timespec t0, t1;
+	size_t found[3], k;
+	unsigned i, m, r;
+	int status = 0;
+
+	printf("%-18s %14s %14s %14s %9s\n", "--glob", "regexec", "fnmatch", "strmatch_glob", "matches");
+	for (i = 0; globs[i][0]; i++) {
+		strmatch_glob_t *g = strmatch_glob_compile(globs[i][0], NULL);
+		regex_t re;
+
+		if (! g || regcomp(&re, globs[i][1], REG_EXTENDED|REG_NOSUB)) {
+			fprintf(stderr, "matchbench: can not compile %s\n", globs[i][0]);
+			exit(1);
+		}
+		printf("%-18s", globs[i][0]);
+		for (m = 0; m < 3; m++) {
+			found[m] = 0;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (r = 0; r < rounds; r++)
+				for (k = 0; k < set->count; k++)
+					found[m] += m == 0 ? regexec(&re, set->names[k], 0, NULL, 0) == 0
+						  : m == 1 ? fnmatch(globs[i][0], set->names[k], 0) == 0
+						  : strmatch_glob_match(g, set->names[k]) != 0;
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			printf(" %11.2f ns", elapsed_ns(&t0, &t1, rounds, set->count));
+		}
+		printf(" %9zu %s", found[2] / rounds, kinds[g->kind]);
+		if (found[0] != found[2] || found[1] != found[2]) {
+			printf(" <- regexec found %zu, fnmatch %zu", found[0] / rounds, found[1] / rounds);
+			status = 1;
+		}
+		printf("\n");
+		regfree(&re);
+		strmatch_glob_free(g);
+	}
+	return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int bench_re(
+	const nameset_t *set,
+	unsigned rounds)
+{
+	struct timespec t0, t1;
+	size_t found[2], k;
+	unsigned i, icase, m, r;
+	int status = 0;
+
+	printf("%-18s %14s %14s %9s\n", "-n/-i", "regexec", "prefiltered", "matches");
+	for (icase = 0; icase < 2; icase++)
+		for (i = 0; regexes[i]; i++) {
+			strmatch_re_t *pre = strmatch_re_compile(regexes[i], icase);
+			regex_t re;
+
+			if (regcomp(&re, regexes[i], REG_EXTENDED|REG_NOSUB|(icase ? REG_ICASE : 0))) {
+				fprintf(stderr, "matchbench: can not compile %s\n", regexes[i]);
+				exit(1);
+			}
+			printf("%s %-15s", icase ? "-i" : "-n", regexes[i]);
+			for (m = 0; m < 2; m++) {
+				found[m] = 0;
+				clock_gettime(CLOCK_MONOTONIC, &t0);
+				for (r = 0; r < rounds; r++)
+					for (k = 0; k < set->count; k++) {
+						int c = m && pre ? strmatch_re_check(pre, set->names[k]) : STRMATCH_RE_MAYBE;
+						found[m] += c == STRMATCH_RE_MAYBE ? regexec(&re, set->names[k], 0, NULL, 0) == 0 : c;
+					}
+				clock_gettime(CLOCK_MONOTONIC, &t1);
+				printf(" %11.2f ns", elapsed_ns(&t0, &t1, rounds, set->count));
+			}
+			printf(" %9zu %s", found[0] / rounds, ! pre ? "none" : pre->exact ? "literals" : "required literal");
+			if (found[0] != found[1]) {
+				printf(" <- prefiltered found %zu", found[1] / rounds);
+				status = 1;
+			}
+			printf("\n");
+			regfree(&re);
+			strmatch_re_free(pre);
+		}
+	return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void *regex_routine(
+	void *arg)
+{
+	regex_job_t *job = arg;
+	unsigned r;
+	size_t k;
+
+	for (r = 0; r < job->rounds; r++)
+		for (k = job->first; k < job->set->count; k += job->step)
+			job->found += regexec(job->re, job->set->names[k], 0, NULL, 0) == 0;
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int bench_threads(
+	const nameset_t *set,
+	unsigned rounds)
+{
+	static const char *pattern = "[0-9]+\\.log$";
+	regex_job_t jobs[64];
+	pthread_t tids[64];
+	struct timespec t0, t1;
+	size_t found[2];
+	unsigned i, t, own;
+	regex_t shared;
+	int status = 0;
+
+	if (regcomp(&shared, pattern, REG_EXTENDED|REG_NOSUB)) {
+		fprintf(stderr, "matchbench: can not compile %s\n", pattern);
+		exit(1);
+	}
+	printf("%-18s %14s %14s %9s\n", "-n threads", "shared", "per thread", "matches");
+	for (i = 0; thread_counts[i]; i++) {
+		printf("%-18u", thread_counts[i]);
+		for (own = 0; own < 2; own++) {
+			found[own] = 0;
+			for (t = 0; t < thread_counts[i]; t++) {
+				jobs[t].set = set;
+				jobs[t].rounds = rounds;
+				jobs[t].first = t;
+				jobs[t].step = thread_counts[i];
+				jobs[t].found = 0;
+				jobs[t].re = &shared;
+				if (own) {
+					jobs[t].re = malloc(sizeof(regex_t));
+					if (! jobs[t].re || regcomp(jobs[t].re, pattern, REG_EXTENDED|REG_NOSUB)) {
+						fprintf(stderr, "matchbench: can not compile %s\n", pattern);
+						exit(1);
+					}
+				}
+			}
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (t = 0; t < thread_counts[i]; t++)
+				if (pthread_create(&tids[t], NULL, regex_routine, &jobs[t])) {
+					perror("matchbench: pthread_create()");
+					exit(1);
+				}
+			for (t = 0; t < thread_counts[i]; t++) {
+				pthread_join(tids[t], NULL);
+				found[own] += jobs[t].found;
+				if (own) {
+					regfree(jobs[t].re);
+					free(jobs[t].re);
+				}
+			}
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			printf(" %11.2f ns", elapsed_ns(&t0, &t1, rounds, set->count));
+		}
+		printf(" %9zu", found[0] / rounds);
+		if (found[0] != found[1]) {
+			printf(" <- per thread found %zu", found[1] / rounds);
+			status = 1;
+		}
+		printf("\n");
+	}
+	regfree(&shared);
+	return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(
+	int argc,
+	char **argv)
+{
+	matcher_t matchers[5];
+	nameset_t sets[3];
+	const char **needles = needles_default, *impl;
+	unsigned rounds = 5, nmatchers = 0, nsets, m, r;
+	const char *file = NULL;
+	int ch, status = 0;
+	size_t i, j;
+
+	setlocale(LC_ALL, "");
+	if (MB_CUR_MAX == 1) // - so that -i is also checked on non-ASCII names
+		(void) setlocale(LC_CTYPE, "C.UTF-8");
+	while ((ch = getopt(argc, argv, "r:f:")) != -1) {
+		if (ch == 'f')
+			file = optarg;
+		else if (ch == 'r' && atoi(optarg) > 0)
+			rounds = atoi(optarg);
+		else {
+			fprintf(stderr, "Usage: matchbench [-r <rounds>] [-f <file>|-] [<needle> ...]\n");
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		needles = (const char **) argv + optind;
+		for (i = 0; needles[i]; i++)
+			for (j = 0; needles[i][j]; j++)
+				argv[optind+i][j] = tolower((unsigned char) needles[i][j]);
+	}
+
+	memset(sets, 0, sizeof(sets));
+	if (file) {
+		FILE *fp = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+		char *line = NULL;
+		size_t size = 0;
+		ssize_t len;
+
+		if (! fp) {
+			perror(file);
+			return 1;
+		}
+		sets[0].title = fp == stdin ? "names from standard input" : file;
+		while ((len = getline(&line, &size, fp)) > 0) {
+			if (line[len-1] == '\n')
+				line[len-1] = '\0';
+			nameset_add(&sets[0], line);
+		}
+		free(line);
+		nsets = 1;
+	} else {
+		nameset_synthetic(sets);
+		nsets = 3;
+	}
+
+	matchers[nmatchers++] = (matcher_t) { "tolower", strstr_tolower };
+	matchers[nmatchers++] = (matcher_t) { "scalar", strmatch_scalar };
+#     if defined(STRMATCH_X86)
+	matchers[nmatchers++] = (matcher_t) { "sse2", strmatch_sse2 };
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		matchers[nmatchers++] = (matcher_t) { "avx2", strmatch_avx2 };
+#     endif
+	(void) strmatch_select(&impl);
+
+	printf("%u rounds, srch -N would use %s\n", rounds, impl);
+	for (j = 0; j < nsets; j++) {
+		size_t bytes = 0;
+		for (i = 0; i < sets[j].count; i++)
+			bytes += sets[j].lens[i];
+		printf("\n%s: %zu names, %.1f bytes on average\n", sets[j].title, sets[j].count,
+		       sets[j].count ? (double) bytes / sets[j].count : 0.0);
+		printf("%-14s", "needle");
+		for (m = 0; m < nmatchers; m++)
+			printf(" %14s", matchers[m].title);
+		printf(" %9s\n", "matches");
+		for (i = 0; needles[i]; i++) {
+			size_t needlelen = strlen(needles[i]), expect = 0;
+			printf("%-14s", needles[i]);
+			for (m = 0; m < nmatchers; m++) {
+				struct timespec t0, t1;
+				size_t found = 0, k;
+
+				clock_gettime(CLOCK_MONOTONIC, &t0);
+				for (r = 0; r < rounds; r++)
+					for (k = 0; k < sets[j].count; k++)
+						found += matchers[m].find(sets[j].names[k], sets[j].lens[k], needles[i], needlelen) != NULL;
+				clock_gettime(CLOCK_MONOTONIC, &t1);
+				printf(" %11.2f ns", elapsed_ns(&t0, &t1, rounds, sets[j].count));
+				if (! m)
+					expect = found;
+				else if (found != expect) {
+					printf(" <- %zu matches, expected %zu", found / rounds, expect / rounds);
+					status = 1;
+				}
+			}
+			printf(" %9zu\n", expect / rounds);
+		}
+		status |= bench_any(&sets[j], matchers, nmatchers, needles, rounds);
+		printf("\n");
+		status |= bench_glob(&sets[j], rounds);
+		printf("\n");
+		status |= bench_re(&sets[j], rounds);
+		printf("\n");
+		status |= bench_threads(&sets[j], rounds);
+	}
+	return status;
+}
@@ -51,12 +51,22 @@
 #include <unistd.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
 #if ! defined(__MINGW32__)
 #    include <pwd.h>
 #    include <grp.h>
+#    include <fcntl.h>
+#    include <spawn.h>
+#    include <sys/wait.h>
+#    if defined(__linux__)
+#        include <sys/sysmacros.h>
+#    endif
+     extern char **environ;
 #endif
+#include "srchrec.h"
+#include "strmatch.h"
 
 #if defined(__hpux)
 #   include <sys/pstat.h>
@@ -132,11 +142,23 @@ static unsigned queued_dirs = 0;	// - the total number of dirs handled by a sepa
 #endif
 
 static regex_t *regexcomp = NULL;		  // - set to expression to search for if option -n or -i is given
+static char *regex_arg = NULL;			  // - its source, which each thread compiles again
+static int regex_flags = 0;
 static boolean regex_opt = FALSE;	  	  // - set if option -n or -i is given
+static strmatch_re_t *regexpre = NULL;		  // - literals that regexcomp requires, set if there are any
 static boolean match_all_path_elems = FALSE; 	  // - set if option -a is given (default is to match against last name in a path)
 static boolean fast_match_opt = FALSE;		  // - set if option -N is given. Also set as default if no -n, -i, -N is given
 static boolean negate_match = FALSE; 		  // - set if "!" is the first char after -n/-i/-N
 static char *fast_match_arg = NULL;		  // - (simple) expression to search for, i.e. case insensitive *string* 
+static size_t fast_match_len = 0;		  // - strlen(fast_match_arg)
+static strmatch_fn_t strstr_ignorecase = strmatch_scalar; // - set by strmatch_select() to the fastest matcher for -N
+static const char *strstr_impl = "scalar";	  // - name of that matcher, for option -S
+static char **fast_match_list = NULL;		  // - all -N patterns as given, including those of option --name-list
+static unsigned fast_match_count = 0;
+static strmatch_ac_t *fast_match_ac = NULL;	  // - set if more than one -N pattern is given
+static boolean show_match = FALSE;		  // - set if option --show-match is specified
+static strmatch_glob_t **globlist = NULL;	  // - set if option --glob is specified
+static unsigned globlist_count = 0;
 static boolean end_with_null = FALSE;		  // - for option -0, used in handle_dirent() only
 static boolean simulate_posix_compliance = FALSE; // - POSIX requires the directory link count to be at least 2
 
@@ -171,8 +193,9 @@ static unsigned last_accum_filecnt = 0;	  // - used by -v
 static pthread_mutex_t last_accum_filecnt_lock = PTHREAD_MUTEX_INITIALIZER; // for protecting "accum_filecnt"
 
 static char *cmd = NULL;		  // - assigned if option -r is specified
-static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER; // - only one thread should manipulate cmd at a time
 static boolean run_cmd = FALSE;		  // - set if option -r is specified
+static unsigned cmd_jobs = 0;		  // - set if option --jobs is specified; max number of commands running at a time
+static unsigned cmd_queue_max = 0;	  // - set if option --queue is specified; max number of commands waiting for an executor
 
 static time_t last_t = 0;		  // - previous timestamp in seconds since EPOCH, used in pthread_routine()
 static ino_t inode = 0;			  // - set if option -J is specified
@@ -187,6 +210,36 @@ static boolean lstat_needed = FALSE;	  // - set if any option requiring an lstat
 static boolean output_lstat_errors = TRUE;// - set to FALSE if option -C is given - default is to print out errors to stderr
 static boolean just_count = FALSE;        // - set if -w, -z, -D, -R is specified
 static boolean summarize_diskusage = FALSE; // - set if option -H is specified
+static boolean histogram = FALSE;	  // - set if option --histogram is specified
+static boolean histogram_csv = FALSE;	  // - set if option --histogram=csv is specified
+static time_t hist_now;			  // - reference time for the age histograms
+static boolean owners = FALSE;		  // - set if option --owners is specified
+static unsigned cntowners = 0;		  // - set if option --owners=<count> is specified; list the <count> biggest only
+static boolean suffixes = FALSE;	  // - set if option --suffixes is specified
+static unsigned cntsuffixes = 0;	  // - set if option --suffixes=<count> is specified; list the <count> biggest only
+static boolean suffixes_by_bytes = FALSE; // - set if option --suffixes=...,bytes is specified
+static boolean suffix_bytes = FALSE;	  // - set if the file sizes are available anyway, i.e. lstat_needed is set
+static boolean dupes = FALSE;		  // - set if option --dupes is specified
+static unsigned cntdupes = 0;		  // - set if option --dupes=<count> is specified; list the <count> biggest groups only
+static boolean estimate = FALSE;	  // - set if option --estimate is specified
+static unsigned estimate_probes = 1000;	  // - set if option --estimate=<probes> is specified
+static unsigned estimate_seconds = 0;	  // - set if option --estimate=<seconds>s is specified
+#define SORT_NONE	0
+#define SORT_SIZE	1
+#define SORT_MTIME	2
+#define SORT_ATIME	3
+#define SORT_PATH	4
+static int sort_key = SORT_NONE;	  // - set if option --sort is specified
+static boolean sort_descending = FALSE;	  // - set if option --sort=-<key> is specified
+static size_t sort_memlimit = 256;	  // - MiB for all in-memory runs together, set by option --sort=<key>,<MiB>
+static boolean rollup = FALSE;		  // - set if option --rollup is specified
+static unsigned rollupdepth = 0;	  // - set if option --rollup is specified; list directories down to this depth
+static unsigned cntrollup = 0;		  // - set if option --rollup=<depth>,<count> is specified; list the <count> biggest only
+static boolean track_completion = FALSE;  // - set if directories must be kept until all of their subdirs are done
+static boolean post_order = FALSE;	  // - set if option --post-order is specified
+static boolean *post_start_matched = NULL; // - start dirs matched, acted on after the traversal if --post-order
+static time_t *post_start_mtime = NULL;
+static pthread_mutex_t completion_lock = PTHREAD_MUTEX_INITIALIZER; // - for protecting dirlist_t pending/sub and rolluplist
 #define TWO_TB  (2LL * 1024LL * 1024LL * 1024LL * 1024LL)
 static time_t olderthan;		  // - set if -o or -O is specified
 static time_t youngerthan;		  // - set if -y or -Y is specified
@@ -204,9 +257,39 @@ static char **excludelist = NULL;	  // - set if -e/-E is specified
 static unsigned excludelist_count = 0;	  // - set if -e/-E is specified
 static regex_t **excluderecomp = NULL;	  // - set if -e/-E is specified
 
+#define EXCLUDE_HASH_SIZE	1021u	// - should be prime
+
+typedef struct exclude_elem exclude_elem_t;
+
+struct exclude_elem {
+	unsigned	 hash;
+	const char	*name;
+	exclude_elem_t	*next;
+};
+
+typedef struct exclude_node exclude_node_t;
+
+// The directories given to -E as paths, one node per path component.  A directory that is on one of those paths
+// points to its node, so checking its subdirs only takes a look at the few children of that node.
+struct exclude_node {
+	char		*name;		  // - path component, "/" for the root of absolute paths
+	exclude_node_t	*child;		  // - first node one component further down
+	exclude_node_t	*next;		  // - next sibling
+	boolean		 excluded;	  // - set if the path down to here was given with -E
+};
+
+static exclude_elem_t **exclude_names = NULL;	  // - hash table of EXCLUDE_HASH_SIZE buckets, set if -E/-Z gives any names
+static unsigned exclude_names_count = 0;
+static exclude_node_t *exclude_trie = NULL;	  // - set if -E gives any paths, i.e. with a '/' in them
+static unsigned exclude_paths_count = 0;
+static unsigned exclude_nodes_count = 0;
+static char *exclude_re_arg = NULL;		  // - all -e patterns joined by |, set unless one has a back reference
+static strmatch_re_t *exclude_pre = NULL;	  // - literals that exclude_re_arg requires, set if there are any
+
 #if defined(__MINGW32__)
 	typedef int uid_t;		  // - just a placeholder, and never used on Windows
 	typedef int gid_t;		  // - just a placeholder, and never used on Windows
+#	define AT_FDCWD	(-100)	  // - ditto, for do_run()
 #endif
 static uid_t *uidlist = NULL;	  	  // - set if -u/-U is specified - never used on Windows since there is no uid
 static unsigned int uidlist_count = 0;	  // - set if -e/-E is specified
@@ -219,9 +302,496 @@ static boolean filesizeabove = FALSE;
 static boolean filesizebelow = FALSE;
 
 static pthread_mutex_t perror_lock = PTHREAD_MUTEX_INITIALIZER;	// - perror() calls should be allowed to complete in one go
-static pthread_mutex_t modtimelist_lock = PTHREAD_MUTEX_INITIALIZER; // - printf's need to be protected
+
+// Buffered output: unless stdout is a terminal, each thread fills its own buffer with whole lines, and full buffers
+// are either written with pwrite() at reserved offsets (stdout is a regular file), or queued to a single writer thread.
+// A bounded number of buffers makes the threads wait for a slow consumer.
+#define OUTBUF_SIZE	(64 * 1024)
+
+typedef struct outbuf outbuf_t;
+
+struct outbuf {
+	char		*data;
+	size_t		 len;
+	size_t		 size;
+	outbuf_t	*next;		  // - in out_full or out_free
+};
+
+static boolean		 buffered_output = FALSE;  // - set in main() unless stdout is a terminal
+static boolean		 out_pwrite = FALSE;	   // - set if stdout is a regular file not opened with O_APPEND
+static off_t		 out_offset = 0;	   // - next offset to reserve if out_pwrite, protected by out_lock
+static outbuf_t		*out_full = NULL;	   // - FIFO of buffers for the writer thread
+static outbuf_t		*out_full_tail = NULL;
+static outbuf_t		*out_free = NULL;	   // - buffers available to the threads
+static boolean		 out_done = FALSE;	   // - tells the writer thread to finish up
+static pthread_t	 out_writer;
+static pthread_mutex_t	 out_lock = PTHREAD_MUTEX_INITIALIZER; // - for protecting the variables above
+static pthread_cond_t	 out_full_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	 out_free_cond = PTHREAD_COND_INITIALIZER;
+
+// Ordered output (option --ordered): every walked directory gets an outnode, holding the entries to be listed and
+// the subdirs to be walked, which is sorted on name when the directory has been read.  A single emitter thread
+// prints the nodes in pre-order as soon as they are ready, so subtrees finishing early are kept until their turn.
+typedef struct outnode outnode_t;
+typedef struct outent outent_t;
+typedef struct tar_entry tar_entry_t;
+
+struct outent {
+	char		*path;
+	const char	*name;		  // - points into path, used for sorting
+	time_t		 mtime;		  // - for option -j
+	boolean		 listed;	  // - the path itself is to be printed
+	char		*line;		  // - printed instead of the path if set, for option --printf
+	size_t		 linelen;
+	tar_entry_t	*tar;		  // - written instead of the path if set, for option --tar
+	outnode_t	*child;		  // - set if this is a subdir to be walked
+};
+
+struct outnode {
+	outent_t	*ents;		  // - only touched by the thread walking the directory until ready is set
+	size_t		 count;
+	size_t		 size;
+	boolean		 ready;		  // - protected by ordered_lock
+	boolean		 zlisted;	  // - the directory is empty, to be printed for option -z
+	time_t		 zmtime;	  // - ditto, for option -j
+};
+
+typedef struct ordered_start ordered_start_t;
+
+struct ordered_start {
+	char		*path;		  // - points to the start dir argument
+	time_t		 mtime;
+	boolean		 listed;	  // - to be printed, as decided by main()
+	char		*line;		  // - for option --printf
+	size_t		 linelen;
+	tar_entry_t	*tar;		  // - for option --tar
+	boolean		 used;		  // - already added to ordered_root
+};
+
+static boolean		 ordered = FALSE;	   // - set if option --ordered is specified
+static outnode_t	 ordered_root;		   // - the start dirs, in command line order; protected by ordered_lock
+static ordered_start_t	*ordered_starts = NULL;
+static unsigned		 ordered_startcount = 0;
+static pthread_t	 ordered_emitter;
+static pthread_mutex_t	 ordered_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 ordered_cond = PTHREAD_COND_INITIALIZER;
+
+#define HIST_SIZE_BUCKETS	50	// - 0 bytes, 1 byte, [2, 4), [4, 8) ... up to 2^48 (256T) and above
+#define HIST_AGE_BUCKETS	13	// - see hist_age_limits[]
+#define HIST_TYPES		 4	// - regular files, directories, symlinks and others
+
+typedef struct histogram histogram_t;
+
+struct histogram {
+	unsigned long long size[HIST_SIZE_BUCKETS][HIST_TYPES];
+	unsigned long long sizebytes[HIST_SIZE_BUCKETS];	// - allocated bytes
+	unsigned long long mtime[HIST_AGE_BUCKETS][HIST_TYPES];
+	unsigned long long mtimebytes[HIST_AGE_BUCKETS];
+	unsigned long long atime[HIST_AGE_BUCKETS][HIST_TYPES];
+	unsigned long long atimebytes[HIST_AGE_BUCKETS];
+};
+
+typedef struct tally tally_t;
+
+struct tally {
+	unsigned long long files;	  // - number of matched files/directories
+	unsigned long long bytes;	  // - allocated bytes of the same
+	time_t		 newest;	  // - newest mtime seen, 0 if none
+	time_t		 oldest;	  // - oldest mtime seen, 0 if none
+};
+
+#define OWNER_HASH_SIZE	1021u	// - should be prime
+
+typedef struct owner_elem owner_elem_t;
+
+struct owner_elem {
+	unsigned long	 id;		  // - uid or gid
+	tally_t		 tally;
+	owner_elem_t	*next;
+};
+
+#define SUFFIX_HASH_SIZE	1021u	// - should be prime
+#define SUFFIX_MAXLEN		16	// - longer suffixes are not likely to be file extensions, so count them as none
+
+typedef struct suffix_elem suffix_elem_t;
+
+struct suffix_elem {
+	unsigned long long count;
+	unsigned long long bytes;	  // - allocated bytes, only summed up if suffix_bytes is set
+	unsigned	 hash;
+	suffix_elem_t	*next;
+	char		 suffix[SUFFIX_MAXLEN+1]; // - empty if no suffix
+};
 
 typedef struct dirlist dirlist_t;
+typedef struct estimate estimate_t;
+
+typedef struct sort_rec sort_rec_t;
+
+struct sort_rec {
+	long long	 key;		  // - size, mtime or atime; mtime for -j if sorting on path
+	char		*path;
+};
+
+typedef struct sort_run sort_run_t;
+
+// Sorted output (option --sort): each thread collects its matches in memory, and when its share of the
+// memory limit is exceeded, the records are sorted and spilled to a temporary file as a sorted run.
+// All runs are merged at the end.
+struct sort_run {
+	sort_rec_t	*recs;		  // - in-memory records, not yet sorted
+	size_t		 count;
+	size_t		 size;
+	size_t		 bytes;		  // - approximate memory used by recs
+	FILE	       **files;		  // - spilled runs
+	size_t		 filecount;
+};
+
+#define TIMECACHE_SIZE	64	// - must be a power of 2
+
+typedef struct timecache timecache_t;
+
+// Per-thread cache for format_time(): localtime_r() results for 15 minute periods, since all time zone offsets
+// and DST changes are multiples of 15 minutes, and formatted strings for single seconds.
+struct timecache {
+	time_t		 qbase[TIMECACHE_SIZE];	  // - start of a 15 minute period, or 1 if unused
+	struct tm	 qtm[TIMECACHE_SIZE];
+	time_t		 sec[TIMECACHE_SIZE];
+	char		 secstr[TIMECACHE_SIZE][20]; // - "yyyy-mm-dd hh:mm:ss", empty if unused
+};
+
+#define NAMECACHE_SIZE	251u	// - should be prime
+
+typedef struct name_elem name_elem_t;
+
+struct name_elem {
+	unsigned long	 id;
+	name_elem_t	*next;
+	char		 name[1];	  // - allocated as long as needed
+};
+
+typedef struct printf_field printf_field_t;
+
+struct printf_field {
+	char		 conv;		  // - conversion character, or 0 for a literal
+	boolean		 left;		  // - left adjust within width
+	int		 width;
+	char		*lit;		  // - literal text, escapes already resolved
+	size_t		 litlen;
+};
+
+static printf_field_t *printf_fields = NULL; // - set if option --printf is specified
+static unsigned printf_fieldcount = 0;
+static boolean binary_output = FALSE;	  // - set if option --binary is specified, see srchrec.h
+
+#define GREP_BUF_SIZE		(1024 * 1024)	   // - files are read in blocks of this size, cut after the last newline
+#define GREP_BINARY_PROBE	(32 * 1024)	   // - files with a NUL byte among the first this many bytes are binary
+
+static char *grep_pattern = NULL;	  // - set if option --grep or --grep-re is specified
+static size_t grep_patternlen = 0;
+static boolean grep_regex = FALSE;	  // - set if option --grep-re is specified; grep_re is compiled from grep_pattern
+static regex_t grep_re;
+static int grep_reflags = 0;
+static boolean grep_lines = FALSE;	  // - set if option --grep-lines is specified
+static unsigned long long grep_max = 0;	  // - set if option --grep-max is specified; larger files are skipped
+
+#define TAR_BLOCK		512
+#define TAR_RECORD		(20 * TAR_BLOCK)   // - the archive is padded to whole records, like tar -b 20
+#define TAR_PREFETCH_MAX	(1024 * 1024)	   // - regular files up to this size are read by the threads
+#define TAR_BUFFER_SIZE		(64 * 1024 * 1024) // - max bytes queued for the writer
+
+// A member of the --tar archive waiting for the writer: the header blocks and the data padded to whole blocks,
+// or just the header blocks if path is set, and the writer reads the data itself.
+struct tar_entry {
+	tar_entry_t	*next;
+	size_t		 len;		  // - bytes in buf
+	size_t		 held;		  // - bytes counted in tar_queued
+	char		*path;
+	off_t		 size;		  // - bytes to read from path
+	char		 buf[1];	  // - allocated as long as needed
+};
+
+static boolean tar_output = FALSE;	  // - set if option --tar is specified
+static pthread_t tar_writer;
+static tar_entry_t *tar_head = NULL;	  // - the queue, protected by tar_lock, as the rest below
+static tar_entry_t *tar_tail = NULL;
+static size_t tar_queued = 0;		  // - bytes in the queue, or read ahead and not yet written if --ordered
+static boolean tar_closed = FALSE;	  // - set when traversal is done
+static unsigned long tar_members = 0;	  // - for option -S
+static unsigned long tar_prefetched = 0;
+static unsigned long tar_streamed = 0;
+static unsigned long long tar_bytes = 0;  // - bytes written, only touched by the writer
+static unsigned long long tar_throttled = 0; // - microseconds spent by traversal waiting for room in the queue
+static pthread_mutex_t tar_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tar_cond = PTHREAD_COND_INITIALIZER;	 // - signalled when a member is queued, or the queue closed
+static pthread_cond_t tar_room_cond = PTHREAD_COND_INITIALIZER; // - signalled when a member is written
+
+// Option -r: the command is parsed once by cmd_compile(), and never modified afterwards, so no locking is needed.
+// Unless the command needs a shell, it is started directly with posix_spawnp(), or run in-process if it is one of
+// the built-in actions below.
+#define BUILTIN_NONE		0
+#define BUILTIN_RM		1	  // - rm, rm -f, unlink
+#define BUILTIN_RMDIR		2
+#define BUILTIN_CHMOD		3	  // - chmod <octal>|<symbolic>
+#define BUILTIN_CHOWN		4	  // - chown [-h] <user>[:<group>], chown [-h] :<group>, chgrp [-h] <group>
+#define BUILTIN_TOUCH		5	  // - touch
+#define BUILTIN_TRUNCATE	6	  // - truncate -s <size>
+#define BUILTIN_MV		7	  // - mv -t <dir>, mv {} <dir>
+
+typedef struct mode_clause mode_clause_t;
+
+// One operation of a chmod mode, e.g. "go-w" or "u=rwX" - "u+r,g-w" are two clauses.
+struct mode_clause {
+	mode_t		 who;		  // - bits affected, from [ugoa]; 0 if none given, i.e. all but the umask
+	char		 op;		  // - '+', '-' or '='
+	mode_t		 perm;		  // - bits from [rwxst], for all of ugo
+	boolean		 X;		  // - X: execute if a directory or already executable for someone
+	mode_t		 copy;		  // - 0700, 0070 or 0007 if the permissions are copied from u, g or o
+};
+
+typedef struct cmd_template cmd_template_t;
+
+struct cmd_template {
+	boolean		 shell;		  // - run by /bin/sh -c, since it contains quoting or syntax only the shell handles
+	boolean		 batch;		  // - ends with `{} +': as many paths as fit are passed to one command
+	boolean		 append;	  // - no `{}' pair; the path is added at the end
+	char	       **argv;		  // - the words of the command with quotes removed, if ! shell
+	unsigned	 argc;		  // - number of words, excluding `{} +' if batch
+	char		*script;	  // - the command for /bin/sh -c if shell, excluding `{} +' if batch
+	size_t		 argmax;	  // - room for paths per batch, derived from ARG_MAX
+	int		 builtin;	  // - BUILTIN_* if the command is run in-process
+	boolean		 force;		  // - rm -f: a missing file is not an error
+	mode_clause_t	*modes;		  // - chmod
+	unsigned	 modecount;
+	boolean		 octal;		  // - chmod with an octal mode, in octalmode
+	mode_t		 octalmode;
+	mode_t		 umask;
+	long		 uid;		  // - chown, -1 if unchanged
+	long		 gid;		  // - chown/chgrp, -1 if unchanged
+	boolean		 nofollow;	  // - chown/chgrp -h: change a symbolic link itself, not its target
+	off_t		 size;		  // - truncate
+	int		 targetfd;	  // - mv: the open target directory
+};
+
+static cmd_template_t cmd_tmpl;		  // - set by cmd_compile() if option -r is specified
+static unsigned long cmd_spawned = 0;	  // - number of commands started, for option -S
+static unsigned long cmd_failed = 0;	  // - number of commands that could not be started, or exited with non-zero status
+static unsigned cmd_running = 0;	  // - number of commands running, if option --jobs is given
+static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER; // - for protecting the counters above
+static pthread_cond_t cmd_cond = PTHREAD_COND_INITIALIZER;   // - signalled when a command finishes, if option --jobs is given
+
+#define LATENCY_BUCKETS		32	// - 0 us, 1 us, [2, 4) us ... up to 2^30 us (18 minutes) and above
+
+typedef struct latency latency_t;
+
+// Durations in microseconds, counted in power-of-two buckets, for the -r statistics of option -S.
+struct latency {
+	unsigned long	 bucket[LATENCY_BUCKETS];
+	unsigned long	 count;
+	unsigned long long total;
+	unsigned long long max;
+};
+
+#define COPY_CHUNK_SIZE		(64 * 1024 * 1024) // - files of more than two chunks are split across the executor threads
+#define COPY_BUF_SIZE		(1024 * 1024)	   // - for read()/write(), if copy_file_range() can not be used
+
+typedef struct copy_file copy_file_t;
+
+// A regular file being copied by option --copy.  Closed by the thread finishing its last chunk.
+struct copy_file {
+	int		 in;
+	int		 out;
+	char		*src;
+	char		*dst;
+	off_t		 size;
+	off_t		 chunk;		  // - size of each chunk, or size if not split
+	mode_t		 mode;
+	struct timespec	 times[2];	  // - atime and mtime, for futimens()
+	unsigned	 pending;	  // - chunks not yet copied, protected by copy_lock
+	int		 err;		  // - first error met, protected by copy_lock
+};
+
+typedef struct copy_dir copy_dir_t;
+
+// A matched directory, which gets its mode and times when everything has been copied into it.
+struct copy_dir {
+	char		*dst;
+	mode_t		 mode;
+	struct timespec	 times[2];
+};
+
+static char *copy_root = NULL;		  // - set if option --copy is specified
+static size_t copy_rootlen = 0;
+static copy_dir_t *copy_dirs = NULL;	  // - protected by copy_lock, as the rest below
+static unsigned copy_dircount = 0;
+static unsigned copy_dirsize = 0;
+static unsigned long copy_done = 0;	  // - entries copied, for options -v and -S
+static unsigned long copy_failed = 0;
+static unsigned long copy_chunks = 0;	  // - chunks handed over to the executor threads
+static unsigned long long copy_bytes = 0;
+static pthread_mutex_t copy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define DUPE_SAMPLE_SIZE	4096		   // - bytes hashed at the head and at the tail of a file in the first round
+#define DUPE_BUF_SIZE		(1024 * 1024)
+#define DUPE_JOB_BYTES		(16 * 1024 * 1024) // - about how much an executor thread reads per job,
+#define DUPE_JOB_FILES		256		   //   or at most this many files
+
+typedef struct dupe_file dupe_file_t;
+
+// A regular file considered by option --dupes.  Files sharing their size with another inode get a hash of a sample
+// of their content, and those sharing size and sample hash a hash of all of their content.
+struct dupe_file {
+	unsigned long long size;
+	unsigned long long hash;	  // - of the sample after round 1, of the content after round 2
+	unsigned long long ino;
+	unsigned long	 dev;
+	unsigned long	 groupsize;	  // - files in its group of duplicates
+	unsigned char	 round;		  // - 0 if not hashed yet
+	boolean		 linked;	  // - set if a hard link to an inode already seen, or the same file found twice
+	boolean		 failed;	  // - set if it could not be read
+	char		*path;
+};
+
+typedef struct dupe_list dupe_list_t;
+
+// The regular files matched by one thread, merged after the traversal.
+struct dupe_list {
+	dupe_file_t	*files;
+	size_t		 count;
+	size_t		 size;
+};
+
+static unsigned long dupe_links = 0;	  // - files skipped as hard links to an inode already seen, for option -S
+static unsigned long dupe_sampled = 0;	  // - files whose sample was hashed, protected by dupe_lock as the rest below
+static unsigned long dupe_hashed = 0;	  // - files whose whole content was hashed
+static unsigned long dupe_failed = 0;
+static unsigned long long dupe_read = 0;  // - bytes read for hashing
+static pthread_mutex_t dupe_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define MANIFEST_CHUNK_SIZE	(64 * 1024 * 1024) // - larger files are hashed in chunks, in parallel by the executor threads
+#define MANIFEST_BUF_SIZE	(1024 * 1024)
+#define MANIFEST_HEADER		"#srch-manifest sha256 chunk=%u\n"
+
+typedef struct manifest_file manifest_file_t;
+
+// A regular file hashed by option --manifest or --verify.  A file of more than one chunk gets the SHA-256 of the
+// SHA-256 of each chunk, and the executor thread finishing its last chunk completes it.
+struct manifest_file {
+	char		*path;
+	unsigned long long size;
+	long long	 mtime;		  // - seconds since the epoch
+	long		 mtime_nsec;
+	unsigned	 chunks;
+	unsigned	 pending;	  // - chunks not yet hashed, protected by manifest_lock
+	boolean		 failed;	  // - ditto
+	unsigned char	(*digests)[32];	  // - one per chunk, if more than one
+	unsigned char	 expected[32];	  // - the hash in the manifest, for option --verify
+};
+
+typedef struct manifest_rec manifest_rec_t;
+
+// A record read from a manifest, by option --verify or --manifest=<old manifest>.
+struct manifest_rec {
+	char		*path;
+	unsigned long long size;
+	long long	 mtime;
+	long		 mtime_nsec;
+	unsigned char	 hash[32];
+	manifest_rec_t	*next;		  // - in the same bucket of manifest_table
+};
+
+static boolean manifest = FALSE;	  // - set if option --manifest is specified
+static char *manifest_old = NULL;	  // - set if option --manifest=<old manifest> is specified
+static char *verify_path = NULL;	  // - set if option --verify=<manifest> is specified
+static boolean verify_quick = FALSE;	  // - set if option --verify=<manifest>,quick is specified
+static manifest_rec_t **manifest_table = NULL; // - the records of the old manifest, hashed on path
+static unsigned manifest_tablesize = 0;	  // - a power of two
+static unsigned long manifest_hashed = 0; // - files hashed, protected by manifest_lock as the rest below
+static unsigned long manifest_reused = 0; // - files with the same size and mtime as in the old manifest, or in the
+					  //   manifest verified with ,quick
+static unsigned long manifest_failed = 0; // - files that could not be read, or did not verify
+static unsigned long manifest_records = 0; // - records read by option --verify
+static unsigned long manifest_chunks = 0; // - chunks of files larger than MANIFEST_CHUNK_SIZE
+static unsigned long long manifest_bytes = 0;
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct cmd_job cmd_job_t;
+
+// A command waiting for an executor thread: one path, or the NUL separated paths of a `{} +' batch.
+// With option --copy, a chunk of a large file instead, with option --dupes, count files to hash, and with options
+// --manifest and --verify, a chunk of a file to hash.
+struct cmd_job {
+	cmd_job_t	*next;
+	char		*paths;
+	unsigned	 count;
+	copy_file_t	*copy;		  // - set if this is the chunk of copy starting at offset
+	off_t		 offset;
+	dupe_file_t    **dupes;		  // - set if this is files to hash
+	manifest_file_t	*manifest;	  // - set if this is the chunk of manifest starting at offset
+	struct timeval	 queued;	  // - when it was put in the queue
+};
+
+// Commands are started by a pool of cmd_jobs executor threads, so traversal goes on while they run, and waits only
+// when cmd_queue_max commands are queued.  Option --copy uses the same threads for the chunks of large files.  Everything below is protected by cmd_lock.
+static boolean cmd_executor = FALSE;	  // - set if the executor threads are running
+static pthread_t *cmd_executors = NULL;
+static cmd_job_t *cmd_queue_head = NULL;
+static cmd_job_t *cmd_queue_tail = NULL;
+static unsigned cmd_queued = 0;		  // - number of jobs in the queue
+static boolean cmd_queue_closed = FALSE;  // - set when traversal is done; the executors exit when the queue is empty
+static pthread_cond_t cmd_queue_cond = PTHREAD_COND_INITIALIZER; // - signalled when a job is queued or the queue is closed
+static pthread_cond_t cmd_room_cond = PTHREAD_COND_INITIALIZER;  // - signalled when a job is taken from the queue
+static unsigned long long cmd_throttled = 0; // - microseconds spent by traversal waiting for room in the queue
+static latency_t cmd_wait_latency;	  // - time from queued until taken by an executor
+static latency_t cmd_run_latency;	  // - time from started until finished
+
+typedef struct cmd_batch cmd_batch_t;
+
+// Paths collected for one `{} +' command, NUL separated.
+struct cmd_batch {
+	char		*buf;
+	size_t		 len;		  // - bytes used in buf
+	size_t		 cost;		  // - bytes used in buf plus one argv pointer per path, compared to argmax
+	unsigned	 count;		  // - number of paths
+};
+
+typedef struct thread_data thread_data_t;
+
+// Data private to each thread, so that counters can be updated without locking, and summed up at the end.
+// The main thread uses the last entry.
+struct thread_data {
+	histogram_t	*hist;		  // - set if option --histogram is specified
+	owner_elem_t   **uids;		  // - hash table of OWNER_HASH_SIZE buckets, set if option --owners is specified
+	owner_elem_t   **gids;		  // - ditto
+	suffix_elem_t  **suffixes;	  // - hash table of SUFFIX_HASH_SIZE buckets, set if option --suffixes is specified
+	dupe_list_t	*dupes;		  // - set if option --dupes is specified
+	estimate_t	*est;		  // - set if option --estimate is specified
+	sort_run_t	*sort;		  // - set if option --sort is specified
+	outbuf_t	*out;		  // - set if buffered_output is TRUE
+	timecache_t	*tc;		  // - set if option -j or --printf is specified
+	name_elem_t    **unames;	  // - uid to user name cache of NAMECACHE_SIZE buckets, set if option --printf is specified
+	name_elem_t    **gnames;	  // - ditto for groups
+	char		*line;		  // - line being formatted for option --printf
+	size_t		 linesize;
+	cmd_batch_t	*batch;		  // - set if option -r is given a command ending with `{} +'
+	unsigned long	 builtin_done;	  // - entries changed by a built-in -r action
+	unsigned long	 builtin_failed;  // - entries a built-in -r action failed on
+	char		*grepbuf;	  // - set if option --grep or --grep-re is specified
+	size_t		 grepbufsize;
+	unsigned long	 grep_files;	  // - files read by --grep, for option -S
+	unsigned long	 grep_binary;	  // - files skipped as binary
+	unsigned long	 grep_large;	  // - files skipped as larger than grep_max
+	unsigned long long grep_bytes;	  // - bytes read
+	unsigned long	 re_rejected;	  // - names rejected by the prefilter of -n/-i, for option -S
+	unsigned long	 re_decided;	  // - names matched by it without calling regexec()
+	unsigned long	 re_regexec;	  // - names passed on to regexec()
+	regex_t		*re;		  // - own copy of regexcomp, compiled on first use by thread_regex()
+	regex_t	       **excludere;	  // - ditto of excluderecomp[], excludelist_count entries
+	regex_t		*grepre;	  // - ditto of grep_re
+	regex_t		*excludeall;	  // - ditto of exclude_re_arg
+};
+
+static thread_data_t	*thread_data = NULL; // - thread_cnt+1 entries, allocated in main()
 
 struct dirlist {
 	char		*dirpath;	  // - full path to current directory
@@ -238,6 +808,31 @@ struct dirlist {
 	unsigned long	 st_dev;	  // - file system id for current directory
 
 	ino_t		 st_ino;	  // - directory inode number
+
+	thread_data_t	*tdata;		  // - data private to the thread walking this directory
+	int		 dirfd;		  // - open descriptor of dirpath while walk_dir() reads it, for built-in -r actions
+	outnode_t	*outnode;	  // - set if option --ordered is specified
+	outnode_t	*child_outnode;	  // - node for the subdir being added, picked up by dirlist_link_parent()
+	exclude_node_t	*exclude;	  // - node of dirpath in exclude_trie, NULL if dirpath is off it
+	exclude_node_t	*child_exclude;	  // - ditto for the subdir being added, picked up by dirlist_link_parent()
+	dirlist_t	*parent;	  // - parent directory, only set if track_completion is TRUE
+	unsigned	 pending;	  // - 1 for the directory itself + 1 for each subdir not yet completed
+	tally_t		 own;		  // - tally of this directory's entries, only touched by the thread walking it
+	tally_t		 sub;		  // - tally of completed subdirs, protected by completion_lock
+	boolean		 post_match;	  // - matched, but the action waits until the subtree is done, for --post-order
+	boolean		 child_post_match; // - post_match for the subdir being added, picked up by dirlist_link_parent()
+	unsigned	 zempty;	  // - completed subdirs containing no files, protected by completion_lock; for -z
+};
+
+struct estimate {
+	dirlist_t	*subdirs;	  // - subdirs found by walk_dir() in the directory being probed
+	size_t		 subdir_count;
+	size_t		 subdir_size;
+	unsigned long long seed;	  // - xorshift state for picking the next subdir
+	unsigned long long probes;	  // - completed probes
+	unsigned long long dirs;	  // - directories read
+	double		 files, files2;	  // - sum and sum of squares of the per-probe file count estimates
+	double		 du, du2;	  // - ditto for disk usage, in 512B blocks
 };
 
 // This is the global list of directories to be processed, malloc'ed later:
@@ -480,39 +1075,308 @@ static inline __attribute__((always_inline)) boolean heap_push(
 
 /////////////////////////////////////////////////////////////////////////////
 
-// Algorithm based on https://github.com/embeddedartistry/embedded-resources/blob/master/examples/libc/string/strstr.c
+// Returns TRUE if name matches one of the --glob patterns.
+static boolean glob_match(
+	const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < globlist_count; i++)
+		if (strmatch_glob_match(globlist[i], name))
+			return TRUE;
+	return FALSE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
 
-static inline __attribute__((always_inline)) char *strstr_ignorecase(
-        char *haystack,
-        char *needle)
+static inline __attribute__((always_inline)) unsigned exclude_hash(
+	const char *name)
 {
-        char *hayptr, *needleptr;
+	unsigned hash = 2166136261u; // - FNV-1a
 
-        // No need to test if haystack == NULL initially since a file name is never NULL...
-        // We also assume that the pattern to serach for (needle) is never NULL...
-        for (needleptr = needle; *haystack; haystack++, needleptr = needle) {
-                hayptr = haystack;
-                while (TRUE) {
-                        if (! *needleptr)
-                                return haystack;
+	while (*name)
+		hash = (hash ^ (unsigned char) *name++) * 16777619u;
+	return hash;
+}
 
-                        if (tolower((int)*hayptr++) != *needleptr++)
-                                break;
-                }
-        }
-        return NULL;
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) exclude_elem_t *exclude_name_find(
+	const char *name)
+{
+	unsigned hash = exclude_hash(name);
+	exclude_elem_t *elem;
+
+	for (elem = exclude_names[hash % EXCLUDE_HASH_SIZE]; elem; elem = elem->next)
+		if (elem->hash == hash && strcmp(elem->name, name) == 0)
+			break;
+	return elem;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) exclude_node_t *exclude_child(
+	exclude_node_t *node,
+	const char *name,
+	size_t len)
+{
+	for (node = node->child; node; node = node->next)
+		if (strncmp(node->name, name, len) == 0 && ! node->name[len])
+			break;
+	return node;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Calls fn for every component of path: "/" first if the path is absolute, then each name in between the slashes,
+// leaving out empty ones and ".", so that "./src//lib/" is taken as "src/lib".  Stops early if fn returns FALSE.
+static void exclude_path_walk(
+	const char *path,
+	boolean (*fn)(const char *, size_t, void *),
+	void *arg)
+{
+	const char *end;
+
+	if (*path == '/' && ! fn("/", 1, arg))
+		return;
+	for (; *path; path = end) {
+		while (*path == '/')
+			path++;
+		for (end = path; *end && *end != '/'; end++)
+			;
+		if (end > path && ! (end - path == 1 && *path == '.') && ! fn(path, end - path, arg))
+			return;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static boolean exclude_path_add_component(
+	const char *name,
+	size_t len,
+	void *arg)
+{
+	exclude_node_t **node = arg, *child = exclude_child(*node, name, len);
+
+	if (! child) {
+		child = calloc(1, sizeof(exclude_node_t));
+		assert(child);
+		child->name = malloc(len + 1);
+		assert(child->name);
+		memcpy(child->name, name, len);
+		child->name[len] = '\0';
+		child->next = (*node)->child;
+		(*node)->child = child;
+		exclude_nodes_count++;
+	}
+	*node = child;
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static boolean exclude_path_find_component(
+	const char *name,
+	size_t len,
+	void *arg)
+{
+	exclude_node_t **node = arg;
+
+	*node = exclude_child(*node, name, len);
+	return *node != NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns the node of path in exclude_trie, or NULL if no -E path starts with it.
+static exclude_node_t *exclude_path_node(
+	const char *path)
+{
+	exclude_node_t *node = exclude_trie;
+
+	exclude_path_walk(path, exclude_path_find_component, &node);
+	return node;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void exclude_node_free(
+	exclude_node_t *node)
+{
+	exclude_node_t *next;
+
+	for (; node; node = next) {
+		next = node->next;
+		exclude_node_free(node->child);
+		free(node->name);
+		free(node);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Sort out the -E arguments into the hash table of names and the trie of paths, and join the -e patterns into one
+// expression, so that a subdir is checked by one lookup of each kind instead of once per option.
+static void exclude_prepare()
+{
+	unsigned i;
+
+	for (i = 0; i < excludelist_count && ! excluderecomp; i++) {
+		if (strchr(excludelist[i], '/')) {
+			exclude_node_t *node;
+			if (! exclude_trie) {
+				exclude_trie = calloc(1, sizeof(exclude_node_t));
+				assert(exclude_trie);
+			}
+			node = exclude_trie;
+			exclude_path_walk(excludelist[i], exclude_path_add_component, &node);
+			if (node == exclude_trie) {
+				fprintf(stderr, "Option -E %s: the path has no directory in it.\n", excludelist[i]);
+				exit(1);
+			}
+			node->excluded = TRUE;
+			exclude_paths_count++;
+		} else {
+			unsigned hash = exclude_hash(excludelist[i]);
+			exclude_elem_t *elem;
+			if (! exclude_names) {
+				exclude_names = calloc(EXCLUDE_HASH_SIZE, sizeof(exclude_elem_t *));
+				assert(exclude_names);
+			}
+			if (exclude_name_find(excludelist[i]))
+				continue;
+			elem = malloc(sizeof(exclude_elem_t));
+			assert(elem);
+			elem->hash = hash;
+			elem->name = excludelist[i];
+			elem->next = exclude_names[hash % EXCLUDE_HASH_SIZE];
+			exclude_names[hash % EXCLUDE_HASH_SIZE] = elem;
+			exclude_names_count++;
+		}
+	}
+
+	if (excluderecomp && excludelist_count > 1) {
+		size_t len = 0;
+		regex_t re;
+		char *p;
+
+		for (i = 0; i < excludelist_count; i++) {
+			for (p = excludelist[i]; *p; p++)
+				if (*p == '\\' && p[1] >= '1' && p[1] <= '9')
+					return; // - a back reference would refer to another group once joined
+			len += p - excludelist[i] + 1;
+		}
+		exclude_re_arg = malloc(len);
+		assert(exclude_re_arg);
+		for (p = exclude_re_arg, i = 0; i < excludelist_count; i++)
+			p += sprintf(p, "%s%s", i ? "|" : "", excludelist[i]);
+		if (regcomp(&re, exclude_re_arg, REG_EXTENDED|REG_NOSUB)) {
+			free(exclude_re_arg); // - should not happen, but then each is still matched on its own
+			exclude_re_arg = NULL;
+			return;
+		}
+		regfree(&re);
+		exclude_pre = strmatch_re_compile(exclude_re_arg, 0);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void exclude_free()
+{
+	unsigned i;
+	exclude_elem_t *elem, *next;
+
+	if (exclude_names) {
+		for (i = 0; i < EXCLUDE_HASH_SIZE; i++)
+			for (elem = exclude_names[i]; elem; elem = next) {
+				next = elem->next;
+				free(elem);
+			}
+		free(exclude_names);
+	}
+	exclude_node_free(exclude_trie);
+	strmatch_re_free(exclude_pre);
+	free(exclude_re_arg);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// The regexec() of glibc locks the compiled expression, so threads sharing one take turns.  Each thread therefore
+// compiles a copy of its own the first time it needs it, which always succeeds but for lack of memory, as the
+// expression was compiled once already when the options were parsed.
+static regex_t *thread_regex(
+	regex_t **re,
+	const char *pattern,
+	int flags)
+{
+	if (! *re) {
+		*re = malloc(sizeof(regex_t));
+		assert(*re);
+		if (regcomp(*re, pattern, flags)) {
+			fprintf(stderr, "%s: Compiling regular expression %s failed\n", progname, pattern);
+			exit(1);
+		}
+	}
+	return *re;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void thread_regex_free(
+	thread_data_t *tdata)
+{
+	unsigned i;
+
+	if (tdata->re) {
+		regfree(tdata->re);
+		free(tdata->re);
+	}
+	if (tdata->excludere) {
+		for (i = 0; i < excludelist_count; i++)
+			if (tdata->excludere[i]) {
+				regfree(tdata->excludere[i]);
+				free(tdata->excludere[i]);
+			}
+		free(tdata->excludere);
+	}
+	if (tdata->grepre) {
+		regfree(tdata->grepre);
+		free(tdata->grepre);
+	}
+	if (tdata->excludeall) {
+		regfree(tdata->excludeall);
+		free(tdata->excludeall);
+	}
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-static inline boolean filename_match(
+static inline __attribute__((always_inline)) boolean filename_match(
+	thread_data_t *tdata,
 	char *name)
 {
-	if (fast_match_opt) {
-		if (! strstr_ignorecase(name, fast_match_arg))
+	if (globlist_count) {
+		if (! glob_match(name))
+			return negate_match ? TRUE : FALSE;
+	} else if (fast_match_ac) {
+		if (strmatch_ac_find(fast_match_ac, name) < 0)
+			return FALSE;
+	} else if (fast_match_opt) {
+		if (! strstr_ignorecase(name, strlen(name), fast_match_arg, fast_match_len))
 			return negate_match ? TRUE : FALSE;
 	} else if (regex_opt) {
-		if (regexec(regexcomp, name, 0, NULL, 0))
+		// - the cheap literal compares first, regexec() only for the names they can not decide
+		int r = regexpre ? strmatch_re_check(regexpre, name) : STRMATCH_RE_MAYBE;
+		if (r == STRMATCH_RE_NO)
+			tdata->re_rejected++;
+		else if (r == STRMATCH_RE_YES)
+			tdata->re_decided++;
+		else {
+			tdata->re_regexec++;
+			r = regexec(thread_regex(&tdata->re, regex_arg, regex_flags), name, 0, NULL, 0) ? STRMATCH_RE_NO : STRMATCH_RE_YES;
+		}
+		if (r == STRMATCH_RE_NO)
 			return negate_match ? TRUE : FALSE;
 	}
 	return negate_match ? FALSE : TRUE;
@@ -544,80 +1408,2372 @@ static inline __attribute__((always_inline)) boolean gid_match(
 
 /////////////////////////////////////////////////////////////////////////////
 
-#include "commonlib.h"
+// Per-subtree rollup (option --rollup):
+// Every directory counts its own entries in dirlist_t->own while being walked.  When a directory and all
+// of its subdirectories are done, the sum is added to the parent's dirlist_t->sub, no matter which thread
+// handled what.  Directories down to rollupdepth are remembered in rolluplist and printed out at the end.
+
+typedef struct rollup_elem rollup_elem_t;
+struct rollup_elem {
+	char	*name;
+	tally_t	 tally;
+};
+
+static rollup_elem_t	*rolluplist = NULL;	// - protected by completion_lock
+static size_t		 rolluplist_count = 0;
+static size_t		 rolluplist_size = 0;
 
 /////////////////////////////////////////////////////////////////////////////
 
-static inline __attribute__((always_inline)) boolean modtimecheck(
-        time_t mtime)
+static inline __attribute__((always_inline)) unsigned long long allocated_bytes(
+	struct stat *st)
 {
-        return ! older_or_younger
-            || (olderthan && mtime < olderthan && ! youngerthan)
-            || (youngerthan && mtime > youngerthan && ! olderthan)
-            || (older_and_younger && mtime < olderthan && mtime > youngerthan);
+#     if defined(__MINGW32__)
+	return st->st_size;
+#     else
+	return st->st_size < TWO_TB ? st->st_blocks * 512ULL : st->st_size;
+#     endif
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-static inline __attribute__((always_inline)) boolean uidgidcheck(
-	uid_t uid,
-	gid_t gid)
+static inline __attribute__((always_inline)) void tally_add_stat(
+	tally_t *tally,
+	struct stat *st)
 {
-	return ! uid_or_gid
-	    || (uidsearch && uid_match(uid))
-	    || (uidnegsearch && ! uid_match(uid))
-            || (gidsearch && gid_match(gid))
-	    || (gidnegsearch && ! gid_match(gid));
+	tally->files++;
+	tally->bytes += allocated_bytes(st);
+	if (! st->st_mtime)
+		return;
+	if (! tally->newest || st->st_mtime > tally->newest)
+		tally->newest = st->st_mtime;
+	if (! tally->oldest || st->st_mtime < tally->oldest)
+		tally->oldest = st->st_mtime;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-static inline __attribute__((always_inline)) boolean sizecheck(
-	size_t size)
+static inline __attribute__((always_inline)) void tally_merge(
+	tally_t *dst,
+	tally_t *src)
 {
-	if (! filesizesearch)
-		return TRUE;
+	dst->files += src->files;
+	dst->bytes += src->bytes;
+	if (src->newest && (! dst->newest || src->newest > dst->newest))
+		dst->newest = src->newest;
+	if (src->oldest && (! dst->oldest || src->oldest < dst->oldest))
+		dst->oldest = src->oldest;
+}
 
-	if (filesizeabove && filesizebelow)
-		return size >= lowfilesize && size <= filesize;
-	else
-		return (filesizeabove && size >= filesize)
-	            || (filesizebelow && size <= filesize)
-	    	    || size == filesize;
+/////////////////////////////////////////////////////////////////////////////
+
+// Add an entry to node, and return its index.  Paths of entries not to be printed are needed for subdirs only.
+static inline __attribute__((always_inline)) size_t ordered_add(
+	outnode_t *node,
+	const char *path,
+	time_t mtime,
+	boolean listed)
+{
+	outent_t *ent;
+
+	if (node->count == node->size) {
+		node->size = node->size ? 2 * node->size : 16;
+		node->ents = realloc(node->ents, node->size * sizeof(outent_t));
+		assert(node->ents);
+	}
+	ent = &node->ents[node->count];
+	ent->path = strdup(path);
+	assert(ent->path);
+#     if defined(__MINGW32__)
+	ent->name = strrchr(ent->path, '\\') ? strrchr(ent->path, '\\') + 1 : ent->path;
+#     else
+	ent->name = strrchr(ent->path, '/') ? strrchr(ent->path, '/') + 1 : ent->path;
+#     endif
+	ent->mtime = mtime;
+	ent->listed = listed;
+	ent->line = NULL;
+	ent->tar = NULL;
+	ent->child = NULL;
+	return node->count++;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-static inline void handle_dirent(dirlist_t *, struct dirent *); // - used by walk_dir()
+static inline __attribute__((always_inline)) outnode_t *outnode_new()
+{
+	outnode_t *node = calloc(1, sizeof(outnode_t));
+
+	assert(node);
+	return node;
+}
 
 /////////////////////////////////////////////////////////////////////////////
 
-static void walk_dir(
-	dirlist_t *curdir)
+static int outent_cmp(
+	const void *a,
+	const void *b)
 {
-	DIR *dir = NULL;
-#if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__)
-	int fd = 0;    			// - only used on Linux/*BSD if option -X is given
-	char *buf = NULL;   		// - same
-	unsigned bpos = 0, nread = 0;	// - same
-#endif
-	struct dirent *dent = NULL;
+	return strcmp(((const outent_t *) a)->name, ((const outent_t *) b)->name);
+}
 
-	//assert(curdir->dirpath);
+/////////////////////////////////////////////////////////////////////////////
 
-#    if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__)
-	if (extreme_readdir) {
-		if ((fd = open(curdir->dirpath, O_RDONLY | O_DIRECTORY)) < 0) {
-			pthread_mutex_lock(&perror_lock);
+// Called when a directory has been read: sort the entries and pass the node over to the emitter.
+static inline __attribute__((always_inline)) void ordered_ready(
+	outnode_t *node)
+{
+	qsort(node->ents, node->count, sizeof(outent_t), outent_cmp);
+	pthread_mutex_lock(&ordered_lock);
+	node->ready = TRUE;
+	pthread_cond_signal(&ordered_cond);
+	pthread_mutex_unlock(&ordered_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Start dirs are added in command line order, listed if main() decided so.
+static outnode_t *ordered_root_add(
+	const char *dirpath)
+{
+	outnode_t *node = outnode_new();
+	ordered_start_t *start = NULL;
+	unsigned i;
+	size_t n;
+
+	for (i = 0; i < ordered_startcount; i++)
+		if (! ordered_starts[i].used && strcmp(ordered_starts[i].path, dirpath) == 0) {
+			start = &ordered_starts[i];
+			start->used = TRUE;
+			break;
+		}
+	pthread_mutex_lock(&ordered_lock);
+	n = ordered_add(&ordered_root, dirpath, start ? start->mtime : 0, start && start->listed);
+	ordered_root.ents[n].line = start ? start->line : NULL;
+	ordered_root.ents[n].linelen = start ? start->linelen : 0;
+	ordered_root.ents[n].tar = start ? start->tar : NULL;
+	ordered_root.ents[n].child = node;
+	pthread_cond_signal(&ordered_cond);
+	pthread_mutex_unlock(&ordered_lock);
+	return node;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Called for every new directory, whether it is processed inline or enqueued.
+static inline __attribute__((always_inline)) void dirlist_link_parent(
+	dirlist_t *dir,
+	dirlist_t *parent)
+{
+	if (ordered)
+		dir->outnode = parent ? parent->child_outnode : ordered_root_add(dir->dirpath);
+
+	memset(&dir->own, 0, sizeof(dir->own));
+	memset(&dir->sub, 0, sizeof(dir->sub));
+	dir->pending = 1;
+	dir->parent = NULL;
+	dir->post_match = parent ? parent->child_post_match : FALSE;
+	dir->exclude = ! exclude_trie ? NULL : parent ? parent->child_exclude : exclude_path_node(dir->dirpath);
+	dir->zempty = 0;
+
+	if (! track_completion || ! parent)
+		return;
+
+	dir->parent = parent;
+	pthread_mutex_lock(&completion_lock);
+	parent->pending++;
+	pthread_mutex_unlock(&completion_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static boolean post_order_action(thread_data_t *, dirlist_t *);
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Called when a directory has been walked, and once more for every subdir that completes.
+// The directory and its dirpath are freed when nothing is pending any more, after running its post-order action
+// in the calling thread, so a directory is always acted on after everything below it.
+static void dirlist_done(
+	dirlist_t *dir,
+	thread_data_t *tdata)
+{
+	dirlist_t *parent;
+	boolean act;
+
+	while (dir) {
+		pthread_mutex_lock(&completion_lock);
+		if (--dir->pending) {
+			pthread_mutex_unlock(&completion_lock);
+			return;
+		}
+
+		parent = dir->parent;
+		tally_merge(&dir->own, &dir->sub);
+		if (parent)
+			tally_merge(&parent->sub, &dir->own);
+
+		act = dir->post_match;
+		if (post_order && zerosized)
+			// - every entry is counted in filecnt, so it is empty once all entries are subdirs without files
+			act = dir->filecnt == dir->zempty;
+
+		if (rollup && dir->depth-1 <= rollupdepth) {
+			if (rolluplist_count == rolluplist_size) {
+				rolluplist_size = rolluplist_size ? 2 * rolluplist_size : 1024;
+				rolluplist = realloc(rolluplist, rolluplist_size * sizeof(rollup_elem_t));
+				assert(rolluplist);
+			}
+			rolluplist[rolluplist_count].name = dir->dirpath;
+			rolluplist[rolluplist_count++].tally = dir->own;
+			dir->dirpath = NULL;
+		}
+		pthread_mutex_unlock(&completion_lock);
+
+		// - with -z, the parent only counts as empty if this subdir was acted on, and not left out by -y or mindepth
+		if (act && post_order_action(tdata, dir) && zerosized && parent) {
+			pthread_mutex_lock(&completion_lock);
+			parent->zempty++;
+			pthread_mutex_unlock(&completion_lock);
+		}
+		if (dir->dirpath)
+			free(dir->dirpath);
+		free(dir);
+		dir = parent;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Size and age histograms (option --histogram), counted per thread in thread_data_t and summed up at the end.
+
+static const time_t hist_age_limits[HIST_AGE_BUCKETS] = { // - lower limits in seconds, -1 means in the future
+	-1, 0, 3600, 86400, 7*86400, 30*86400, 90*86400, 180*86400,
+	365*86400, 2*365*86400, 3*365*86400, 5*365*86400, 10*365*86400
+};
+static const char *hist_age_labels[HIST_AGE_BUCKETS] = {
+	"future", "< 1 hour", "< 1 day", "< 1 week", "< 30 days", "< 90 days", "< 180 days",
+	"< 1 year", "< 2 years", "< 3 years", "< 5 years", "< 10 years", ">= 10 years"
+};
+static const char *hist_type_labels[HIST_TYPES] = { "regular", "directory", "symlink", "other" };
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) unsigned hist_age_bucket(
+	time_t t)
+{
+	time_t age = hist_now - t;
+	unsigned i;
+
+	for (i = HIST_AGE_BUCKETS-1; i > 0; i--)
+		if (age >= hist_age_limits[i])
+			return i;
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void hist_add(
+	histogram_t *hist,
+	struct stat *st)
+{
+	unsigned long long size = st->st_size, bytes = allocated_bytes(st);
+	unsigned bucket, type;
+
+	switch (st->st_mode & S_IFMT) {
+		case S_IFREG:	type = 0; break;
+		case S_IFDIR:	type = 1; break;
+#	      if ! defined(__MINGW32__)
+		case S_IFLNK:	type = 2; break;
+#	      endif
+		default:	type = 3; break;
+	}
+
+	for (bucket = 0; size && bucket < HIST_SIZE_BUCKETS-1; bucket++)
+		size >>= 1;
+	hist->size[bucket][type]++;
+	hist->sizebytes[bucket] += bytes;
+
+	bucket = hist_age_bucket(st->st_mtime);
+	hist->mtime[bucket][type]++;
+	hist->mtimebytes[bucket] += bytes;
+
+	bucket = hist_age_bucket(st->st_atime);
+	hist->atime[bucket][type]++;
+	hist->atimebytes[bucket] += bytes;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void hist_print_row(
+	const char *name,
+	const char *label,
+	unsigned long long *counts,
+	unsigned long long bytes)
+{
+	unsigned long long total = 0;
+	unsigned i;
+
+	if (histogram_csv)
+		printf("%s,%s", name, label);
+	else
+		printf("%-13s", label);
+	for (i = 0; i < HIST_TYPES; i++) {
+		printf(histogram_csv ? ",%llu" : " %12llu", counts[i]);
+		total += counts[i];
+	}
+	printf(histogram_csv ? ",%llu,%llu\n" : " %12llu %19llu\n", total, bytes);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void hist_print_header(
+	const char *title)
+{
+	unsigned i;
+
+	if (histogram_csv)
+		return;
+	printf("%-13s", title);
+	for (i = 0; i < HIST_TYPES; i++)
+		printf(" %12s", hist_type_labels[i]);
+	printf(" %12s %19s\n", "total", "bytes");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void hist_print(
+	histogram_t *hist)
+{
+	char label[32];
+	unsigned i, first, last;
+	const char *units = "KMGTP";
+
+	if (histogram_csv) {
+		printf("histogram,bucket");
+		for (i = 0; i < HIST_TYPES; i++)
+			printf(",%s", hist_type_labels[i]);
+		printf(",total,bytes\n");
+	}
+
+	for (first = 0; first < HIST_SIZE_BUCKETS-1; first++)
+		if (hist->sizebytes[first] || hist->size[first][0] || hist->size[first][1]
+		    || hist->size[first][2] || hist->size[first][3])
+			break;
+	for (last = HIST_SIZE_BUCKETS-1; last > first; last--)
+		if (hist->sizebytes[last] || hist->size[last][0] || hist->size[last][1]
+		    || hist->size[last][2] || hist->size[last][3])
+			break;
+
+	hist_print_header("Size >=");
+	for (i = first; i <= last; i++) {
+		unsigned long long low = i ? 1ULL << (i-1) : 0;
+		if (histogram_csv || low < 1024)
+			snprintf(label, sizeof(label), "%llu", low);
+		else {
+			unsigned u = 0;
+			low >>= 10;
+			while (low >= 1024 && units[u+1]) {
+				low >>= 10;
+				u++;
+			}
+			snprintf(label, sizeof(label), "%llu%c", low, units[u]);
+		}
+		hist_print_row("size", label, hist->size[i], hist->sizebytes[i]);
+	}
+
+	if (! histogram_csv)
+		printf("\n");
+	hist_print_header("Modified");
+	for (i = 0; i < HIST_AGE_BUCKETS; i++) {
+		if (histogram_csv)
+			snprintf(label, sizeof(label), "%ld", (long) hist_age_limits[i]);
+		hist_print_row("mtime", histogram_csv ? label : hist_age_labels[i], hist->mtime[i], hist->mtimebytes[i]);
+	}
+
+	if (! histogram_csv)
+		printf("\n");
+	hist_print_header("Accessed");
+	for (i = 0; i < HIST_AGE_BUCKETS; i++) {
+		if (histogram_csv)
+			snprintf(label, sizeof(label), "%ld", (long) hist_age_limits[i]);
+		hist_print_row("atime", histogram_csv ? label : hist_age_labels[i], hist->atime[i], hist->atimebytes[i]);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Sort on path, but let '/' go before any other character to get the directories in pre-order.
+static int rollup_cmp_path(
+	const void *a,
+	const void *b)
+{
+	const unsigned char *p = (const unsigned char *) ((rollup_elem_t *) a)->name;
+	const unsigned char *q = (const unsigned char *) ((rollup_elem_t *) b)->name;
+
+	while (*p && *p == *q) {
+		p++;
+		q++;
+	}
+	return (*p == '/' ? 1 : *p) - (*q == '/' ? 1 : *q);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Biggest first
+static int rollup_cmp_bytes(
+	const void *a,
+	const void *b)
+{
+	unsigned long long x = ((rollup_elem_t *) a)->tally.bytes;
+	unsigned long long y = ((rollup_elem_t *) b)->tally.bytes;
+
+	return x < y ? 1 : (x > y ? -1 : rollup_cmp_path(a, b));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include "commonlib.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if ! defined(__MINGW32__)
+// Per-owner accounting (option --owners): each thread counts into its own uid and gid hash tables,
+// which are merged into the main thread's tables at the end.
+
+static inline __attribute__((always_inline)) void owner_add(
+	owner_elem_t **table,
+	unsigned long id,
+	struct stat *st)
+{
+	owner_elem_t **bucket = &table[id % OWNER_HASH_SIZE];
+	owner_elem_t *elem;
+
+	for (elem = *bucket; elem; elem = elem->next)
+		if (elem->id == id)
+			break;
+	if (! elem) {
+		elem = calloc(1, sizeof(owner_elem_t));
+		assert(elem);
+		elem->id = id;
+		elem->next = *bucket;
+		*bucket = elem;
+	}
+	tally_add_stat(&elem->tally, st);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Move or merge all entries of src into dst, and free src.
+static void owner_merge(
+	owner_elem_t **dst,
+	owner_elem_t **src)
+{
+	unsigned i;
+
+	for (i = 0; i < OWNER_HASH_SIZE; i++) {
+		owner_elem_t *elem, *next;
+		for (elem = src[i]; elem; elem = next) {
+			owner_elem_t *d;
+			next = elem->next;
+			for (d = dst[i]; d; d = d->next)
+				if (d->id == elem->id)
+					break;
+			if (d) {
+				tally_merge(&d->tally, &elem->tally);
+				free(elem);
+			} else {
+				elem->next = dst[i];
+				dst[i] = elem;
+			}
+		}
+	}
+	free(src);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int owner_cmp_bytes(
+	const void *a,
+	const void *b)
+{
+	const owner_elem_t *x = *(owner_elem_t * const *) a;
+	const owner_elem_t *y = *(owner_elem_t * const *) b;
+
+	if (x->tally.bytes != y->tally.bytes)
+		return x->tally.bytes < y->tally.bytes ? 1 : -1;
+	return x->id < y->id ? -1 : (x->id > y->id);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Print out the biggest owners first.  Names are looked up just once for each printed uid/gid.
+static void owner_print(
+	owner_elem_t **table,
+	boolean isgroup)
+{
+	owner_elem_t **list = NULL, *elem, *next;
+	size_t count = 0, i;
+
+	for (i = 0; i < OWNER_HASH_SIZE; i++)
+		for (elem = table[i]; elem; elem = elem->next) {
+			list = realloc(list, (count + 1) * sizeof(owner_elem_t *));
+			assert(list);
+			list[count++] = elem;
+		}
+	qsort(list, count, sizeof(owner_elem_t *), owner_cmp_bytes);
+
+	for (i = 0; i < count && (! cntowners || i < cntowners); i++) {
+		tally_t *t = &list[i]->tally;
+		char *newest = t->newest ? printable_time(t->newest) : strdup("-");
+		char name[64];
+		if (isgroup) {
+			struct group *gr = getgrgid((gid_t) list[i]->id);
+			if (gr)
+				snprintf(name, sizeof(name), "%s", gr->gr_name);
+			else
+				snprintf(name, sizeof(name), "%lu", list[i]->id);
+		} else {
+			struct passwd *pw = getpwuid((uid_t) list[i]->id);
+			if (pw)
+				snprintf(name, sizeof(name), "%s", pw->pw_name);
+			else
+				snprintf(name, sizeof(name), "%lu", list[i]->id);
+		}
+		printf("%-19llu %-12llu %-19s %s:%s\n", t->bytes, t->files, newest, isgroup ? "group" : "user", name);
+		free(newest);
+	}
+
+	for (i = 0; i < OWNER_HASH_SIZE; i++)
+		for (elem = table[i]; elem; elem = next) {
+			next = elem->next;
+			free(elem);
+		}
+	free(table);
+	free(list);
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+// File name suffix statistics (option --suffixes): each thread counts into its own hash table,
+// and the tables are merged into the main thread's table at the end.
+
+static inline __attribute__((always_inline)) void suffix_add(
+	suffix_elem_t **table,
+	const char *name,
+	struct stat *st)
+{
+	const char *suffix = strrchr(name, '.');
+	suffix_elem_t **bucket, *elem;
+	unsigned hash = 2166136261u; // - FNV-1a
+	const char *p;
+
+	if (! suffix || suffix == name || strlen(++suffix) > SUFFIX_MAXLEN) // - no suffix in ".profile" either
+		suffix = "";
+	for (p = suffix; *p; p++)
+		hash = (hash ^ (unsigned char) *p) * 16777619u;
+
+	bucket = &table[hash % SUFFIX_HASH_SIZE];
+	for (elem = *bucket; elem; elem = elem->next)
+		if (elem->hash == hash && strcmp(elem->suffix, suffix) == 0)
+			break;
+	if (! elem) {
+		elem = calloc(1, sizeof(suffix_elem_t));
+		assert(elem);
+		elem->hash = hash;
+		strcpy(elem->suffix, suffix);
+		elem->next = *bucket;
+		*bucket = elem;
+	}
+	elem->count++;
+	if (st)
+		elem->bytes += allocated_bytes(st);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Move or merge all entries of src into dst, and free src.
+static void suffix_merge(
+	suffix_elem_t **dst,
+	suffix_elem_t **src)
+{
+	unsigned i;
+
+	for (i = 0; i < SUFFIX_HASH_SIZE; i++) {
+		suffix_elem_t *elem, *next;
+		for (elem = src[i]; elem; elem = next) {
+			suffix_elem_t *d;
+			next = elem->next;
+			for (d = dst[i]; d; d = d->next)
+				if (d->hash == elem->hash && strcmp(d->suffix, elem->suffix) == 0)
+					break;
+			if (d) {
+				d->count += elem->count;
+				d->bytes += elem->bytes;
+				free(elem);
+			} else {
+				elem->next = dst[i];
+				dst[i] = elem;
+			}
+		}
+	}
+	free(src);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int suffix_cmp(
+	const void *a,
+	const void *b)
+{
+	const suffix_elem_t *x = *(suffix_elem_t * const *) a;
+	const suffix_elem_t *y = *(suffix_elem_t * const *) b;
+	unsigned long long xv = suffixes_by_bytes ? x->bytes : x->count;
+	unsigned long long yv = suffixes_by_bytes ? y->bytes : y->count;
+
+	if (xv != yv)
+		return xv < yv ? 1 : -1;
+	return strcmp(x->suffix, y->suffix);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void suffix_print(
+	suffix_elem_t **table)
+{
+	suffix_elem_t **list = NULL, *elem;
+	size_t count = 0, i;
+
+	for (i = 0; i < SUFFIX_HASH_SIZE; i++)
+		for (elem = table[i]; elem; elem = elem->next) {
+			list = realloc(list, (count + 1) * sizeof(suffix_elem_t *));
+			assert(list);
+			list[count++] = elem;
+		}
+	qsort(list, count, sizeof(suffix_elem_t *), suffix_cmp);
+
+	for (i = 0; i < count && (! cntsuffixes || i < cntsuffixes); i++) {
+		if (suffix_bytes)
+			printf("%-19llu ", list[i]->bytes);
+		else
+			printf("%-19s ", "-");
+		if (*list[i]->suffix)
+			printf("%-12llu .%s\n", list[i]->count, list[i]->suffix);
+		else
+			printf("%-12llu (none)\n", list[i]->count);
+	}
+
+	for (i = 0; i < count; i++)
+		free(list[i]);
+	free(table);
+	free(list);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int sort_cmp(
+	const void *a,
+	const void *b)
+{
+	const sort_rec_t *x = a, *y = b;
+	int rc = 0;
+
+	if (sort_key != SORT_PATH && x->key != y->key)
+		rc = x->key < y->key ? -1 : 1;
+	if (! rc)
+		rc = strcmp(x->path, y->path); // - like sort(1) with LC_ALL=C
+	return sort_descending ? -rc : rc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void sort_spill(
+	sort_run_t *run)
+{
+	FILE *fp = tmpfile();
+	size_t i;
+
+	if (! fp) {
+		pthread_mutex_lock(&perror_lock);
+		fprintf(stderr, "%s: ", progname);
+		perror("tmpfile()");
+		pthread_mutex_unlock(&perror_lock);
+		exit(1);
+	}
+	qsort(run->recs, run->count, sizeof(sort_rec_t), sort_cmp);
+	for (i = 0; i < run->count; i++) {
+		unsigned len = strlen(run->recs[i].path);
+		if (fwrite(&run->recs[i].key, sizeof(long long), 1, fp) != 1
+		    || fwrite(&len, sizeof(unsigned), 1, fp) != 1
+		    || fwrite(run->recs[i].path, 1, len, fp) != len) {
+			pthread_mutex_lock(&perror_lock);
+			fprintf(stderr, "%s: ", progname);
+			perror("writing sort run");
+			pthread_mutex_unlock(&perror_lock);
+			exit(1);
+		}
+		free(run->recs[i].path);
+	}
+	rewind(fp);
+	run->files = realloc(run->files, (run->filecount + 1) * sizeof(FILE *));
+	assert(run->files);
+	run->files[run->filecount++] = fp;
+	run->count = 0;
+	run->bytes = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void sort_add(
+	sort_run_t *run,
+	long long key,
+	const char *path)
+{
+	if (run->count == run->size) {
+		run->size = run->size ? 2 * run->size : 1024;
+		run->recs = realloc(run->recs, run->size * sizeof(sort_rec_t));
+		assert(run->recs);
+	}
+	run->recs[run->count].key = key;
+	run->recs[run->count].path = strdup(path);
+	assert(run->recs[run->count].path);
+	run->bytes += sizeof(sort_rec_t) + strlen(path) + 1 + 16; // - 16 for malloc overhead
+	run->count++;
+	if (run->bytes > (sort_memlimit << 20) / (thread_cnt + 1))
+		sort_spill(run);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct sort_cursor sort_cursor_t;
+
+struct sort_cursor {
+	sort_rec_t	 rec;		  // - current record
+	FILE		*fp;		  // - set for spilled runs
+	sort_rec_t	*recs;		  // - set for in-memory runs
+	size_t		 next;
+	size_t		 count;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static boolean sort_cursor_advance(
+	sort_cursor_t *cur)
+{
+	unsigned len;
+
+	if (! cur->fp) {
+		if (cur->next == cur->count)
+			return FALSE;
+		cur->rec = cur->recs[cur->next++];
+		return TRUE;
+	}
+	if (fread(&cur->rec.key, sizeof(long long), 1, cur->fp) != 1)
+		return FALSE;
+	if (fread(&len, sizeof(unsigned), 1, cur->fp) != 1) {
+		fprintf(stderr, "%s: truncated sort run\n", progname);
+		exit(1);
+	}
+	cur->rec.path = malloc(len + 1);
+	assert(cur->rec.path);
+	if (fread(cur->rec.path, 1, len, cur->fp) != len) {
+		fprintf(stderr, "%s: truncated sort run\n", progname);
+		exit(1);
+	}
+	cur->rec.path[len] = '\0';
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void sort_sift_down(
+	sort_cursor_t **heap,
+	size_t count,
+	size_t i)
+{
+	while (TRUE) {
+		size_t smallest = i, l = 2*i + 1, r = 2*i + 2;
+		sort_cursor_t *tmp;
+		if (l < count && sort_cmp(&heap[l]->rec, &heap[smallest]->rec) < 0)
+			smallest = l;
+		if (r < count && sort_cmp(&heap[r]->rec, &heap[smallest]->rec) < 0)
+			smallest = r;
+		if (smallest == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void sort_print(
+	sort_rec_t *rec)
+{
+	if (end_with_null)
+		printf("%s%c", rec->path, '\0');
+	else if (sort_key == SORT_SIZE)
+		printf("%-19lld %s\n", rec->key, rec->path);
+	else if (sort_key != SORT_PATH || modtimelist) {
+		char *timestr = printable_time((time_t) rec->key);
+		printf("%s %s\n", timestr, rec->path);
+		free(timestr);
+	} else
+		puts(rec->path);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// k-way merge of all in-memory and spilled runs of all threads, through a binary min-heap of run cursors.
+static void sort_merge()
+{
+	sort_cursor_t *cursors = NULL, **heap;
+	size_t count = 0, i, j;
+
+	for (i = 0; i <= thread_cnt; i++) {
+		sort_run_t *run = thread_data[i].sort;
+		cursors = realloc(cursors, (count + run->filecount + 1) * sizeof(sort_cursor_t));
+		assert(cursors);
+		for (j = 0; j < run->filecount; j++) {
+			memset(&cursors[count], 0, sizeof(sort_cursor_t));
+			cursors[count++].fp = run->files[j];
+		}
+		if (run->count) {
+			qsort(run->recs, run->count, sizeof(sort_rec_t), sort_cmp);
+			memset(&cursors[count], 0, sizeof(sort_cursor_t));
+			cursors[count].recs = run->recs;
+			cursors[count++].count = run->count;
+		}
+	}
+
+	heap = malloc((count + 1) * sizeof(sort_cursor_t *));
+	assert(heap);
+	for (i = j = 0; i < count; i++)
+		if (sort_cursor_advance(&cursors[i]))
+			heap[j++] = &cursors[i];
+	count = j;
+	for (i = count / 2; i-- > 0; )
+		sort_sift_down(heap, count, i);
+
+	while (count) {
+		sort_print(&heap[0]->rec);
+		free(heap[0]->rec.path);
+		if (! sort_cursor_advance(heap[0])) {
+			if (heap[0]->fp)
+				fclose(heap[0]->fp);
+			heap[0] = heap[--count];
+		}
+		sort_sift_down(heap, count, 0);
+	}
+
+	for (i = 0; i <= thread_cnt; i++) {
+		free(thread_data[i].sort->recs);
+		free(thread_data[i].sort->files);
+		free(thread_data[i].sort);
+	}
+	free(heap);
+	free(cursors);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) long long sort_key_of(
+	struct stat *st,
+	char *path)
+{
+	switch (sort_key) {
+		case SORT_SIZE:	 return (long long) st->st_size;
+		case SORT_MTIME: return (long long) st->st_mtime;
+		case SORT_ATIME: return (long long) st->st_atime;
+		default:	 return modtimelist ? (long long) (lstat_needed ? st->st_mtime : get_mtime(path)) : 0;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static timecache_t *timecache_new()
+{
+	timecache_t *tc = calloc(1, sizeof(timecache_t));
+	unsigned i;
+
+	assert(tc);
+	for (i = 0; i < TIMECACHE_SIZE; i++)
+		tc->qbase[i] = 1;
+	return tc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void put_digits(
+	char *buf,
+	unsigned value,
+	int digits)
+{
+	while (digits--) {
+		buf[digits] = '0' + value % 10;
+		value /= 10;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Like printable_time(), but writing to buf (at least 20 bytes), and mostly without calling localtime_r().
+static inline __attribute__((always_inline)) void format_time(
+	timecache_t *tc,
+	time_t t,
+	char *buf)
+{
+	unsigned slot = (unsigned long) t & (TIMECACHE_SIZE-1);
+	time_t base = t - (time_t) (((t % 900) + 900) % 900);
+	struct tm tm;
+
+	if (tc->sec[slot] == t && tc->secstr[slot][0]) {
+		memcpy(buf, tc->secstr[slot], 20);
+		return;
+	}
+
+	if (tc->qbase[(unsigned long) (base / 900) & (TIMECACHE_SIZE-1)] != base) {
+		unsigned q = (unsigned long) (base / 900) & (TIMECACHE_SIZE-1);
+		(void) localtime_r(&base, &tc->qtm[q]);
+		tc->qbase[q] = base;
+	}
+	tm = tc->qtm[(unsigned long) (base / 900) & (TIMECACHE_SIZE-1)];
+	if (tm.tm_sec || tm.tm_min % 15) // - odd historical time zone offset
+		(void) localtime_r(&t, &tm);
+	else {
+		tm.tm_min += (t - base) / 60;
+		tm.tm_sec += (t - base) % 60;
+	}
+
+	put_digits(buf, 1900 + tm.tm_year, 4);
+	buf[4] = '-';
+	put_digits(buf + 5, tm.tm_mon + 1, 2);
+	buf[7] = '-';
+	put_digits(buf + 8, tm.tm_mday, 2);
+	buf[10] = ' ';
+	put_digits(buf + 11, tm.tm_hour, 2);
+	buf[13] = ':';
+	put_digits(buf + 14, tm.tm_min, 2);
+	buf[16] = ':';
+	put_digits(buf + 17, tm.tm_sec, 2);
+	buf[19] = '\0';
+
+	tc->sec[slot] = t;
+	memcpy(tc->secstr[slot], buf, 20);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void out_write_all(
+	const char *data,
+	size_t len,
+	off_t offset)
+{
+	while (len) {
+		ssize_t written;
+#	      if ! defined(__MINGW32__)
+		if (out_pwrite)
+			written = pwrite(STDOUT_FILENO, data, len, offset);
+		else
+#	      endif
+			written = write(STDOUT_FILENO, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			pthread_mutex_lock(&perror_lock);
+			fprintf(stderr, "%s: ", progname);
+			perror("write to stdout");
+			pthread_mutex_unlock(&perror_lock);
+			exit(1);
+		}
+		data += written;
+		len -= written;
+		offset += written;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void *out_writer_routine(
+	void *arg)
+{
+	outbuf_t *buf;
+
+	(void) arg;
+	while (TRUE) {
+		pthread_mutex_lock(&out_lock);
+		while (! out_full && ! out_done)
+			pthread_cond_wait(&out_full_cond, &out_lock);
+		if (! (buf = out_full)) {
+			pthread_mutex_unlock(&out_lock);
+			return NULL;
+		}
+		if (! (out_full = buf->next))
+			out_full_tail = NULL;
+		pthread_mutex_unlock(&out_lock);
+
+		out_write_all(buf->data, buf->len, 0);
+		buf->len = 0;
+
+		pthread_mutex_lock(&out_lock);
+		buf->next = out_free;
+		out_free = buf;
+		pthread_cond_signal(&out_free_cond);
+		pthread_mutex_unlock(&out_lock);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Hand over the full buffer, and return an empty one.
+static outbuf_t *out_flush(
+	outbuf_t *buf)
+{
+	if (! buf->len)
+		return buf;
+	if (out_pwrite) {
+		off_t offset;
+		pthread_mutex_lock(&out_lock);
+		offset = out_offset;
+		out_offset += buf->len;
+		pthread_mutex_unlock(&out_lock);
+		out_write_all(buf->data, buf->len, offset);
+		buf->len = 0;
+		return buf;
+	}
+
+	pthread_mutex_lock(&out_lock);
+	buf->next = NULL;
+	if (out_full_tail)
+		out_full_tail->next = buf;
+	else
+		out_full = buf;
+	out_full_tail = buf;
+	pthread_cond_signal(&out_full_cond);
+	while (! out_free)
+		pthread_cond_wait(&out_free_cond, &out_lock);
+	buf = out_free;
+	out_free = buf->next;
+	pthread_mutex_unlock(&out_lock);
+	return buf;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Reserve room for a whole line in the thread's buffer, so that a line is never split across two buffers.
+static inline __attribute__((always_inline)) char *out_reserve(
+	thread_data_t *tdata,
+	size_t len)
+{
+	outbuf_t *buf = tdata->out;
+	char *p;
+
+	if (buf->len + len > buf->size) {
+		buf = tdata->out = out_flush(buf);
+		if (len > buf->size) { // - a single line longer than the buffer
+			buf->data = realloc(buf->data, len);
+			assert(buf->data);
+			buf->size = len;
+		}
+	}
+	p = buf->data + buf->len;
+	buf->len += len;
+	return p;
+}
+static inline __attribute__((always_inline)) void out_append(
+	thread_data_t *tdata,
+	const char *s,
+	size_t len)
+{
+	memcpy(out_reserve(tdata, len), s, len);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void output_match(thread_data_t *, const char *, time_t);
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Print out a matched path, preceded by its modtime if option -j is given.
+// Each call outputs one complete line, so lines from different threads never interleave.
+static inline __attribute__((always_inline)) void output_path(
+	thread_data_t *tdata,
+	const char *path,
+	time_t mtime)
+{
+	char timestr[20];
+	size_t pathlen;
+	char *p;
+
+	if (show_match)
+		return output_match(tdata, path, mtime);
+	if (! buffered_output) {
+		if (end_with_null)
+			printf("%s%c", path, '\0');
+		else if (modtimelist) {
+			format_time(tdata->tc, mtime, timestr);
+			printf("%s %s\n", timestr, path); // - one call, so no need for a lock
+		} else
+			puts(path);
+		return;
+	}
+
+	pathlen = strlen(path);
+	if (modtimelist && ! end_with_null) {
+		p = out_reserve(tdata, 20 + pathlen + 1);
+		format_time(tdata->tc, mtime, p);
+		p[19] = ' ';
+		p += 20;
+	} else
+		p = out_reserve(tdata, pathlen + 1);
+	memcpy(p, path, pathlen);
+	p[pathlen] = end_with_null ? '\0' : '\n';
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Compile the --printf format into printf_fields[], and return TRUE if lstat(2) data is needed.
+static boolean printf_compile(
+	const char *format)
+{
+	const char *p = format;
+	boolean stat_needed = FALSE;
+
+	while (*p) {
+		printf_field_t *f;
+		printf_fields = realloc(printf_fields, (printf_fieldcount + 1) * sizeof(printf_field_t));
+		assert(printf_fields);
+		f = &printf_fields[printf_fieldcount++];
+		memset(f, 0, sizeof(printf_field_t));
+
+		if (*p == '%' && p[1] != '%') {
+			p++;
+			if (*p == '-') {
+				f->left = TRUE;
+				p++;
+			}
+			while (isdigit((unsigned char) *p))
+				f->width = 10 * f->width + *p++ - '0';
+			if (! *p || ! strchr("pfhdsbkmMnuUgGyltacTi", *p)) {
+				fprintf(stderr, "%s: unknown --printf directive %%%s\n", progname, *p ? p : "");
+				exit(1);
+			}
+			f->conv = *p++;
+			if (! strchr("pfhd", f->conv))
+				stat_needed = TRUE;
+			continue;
+		}
+
+		f->lit = malloc(strlen(p) + 1);
+		assert(f->lit);
+		while (*p && ! (*p == '%' && p[1] != '%')) {
+			char c = *p++;
+			if (c == '%')
+				p++; // - %%
+			else if (c == '\\' && *p) {
+				switch (c = *p++) {
+					case 'n':  c = '\n'; break;
+					case 't':  c = '\t'; break;
+					case '0':  c = '\0'; break;
+					case 'r':  c = '\r'; break;
+					case '\\': c = '\\'; break;
+					default:   f->lit[f->litlen++] = '\\'; break;
+				}
+			}
+			f->lit[f->litlen++] = c;
+		}
+	}
+	return stat_needed;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Look up a user or group name once per thread and id.  An id without name is cached as its number.
+static const char *name_lookup(
+	name_elem_t **table,
+	unsigned long id,
+	boolean isgroup)
+{
+	name_elem_t **bucket = &table[id % NAMECACHE_SIZE], *elem;
+	char numstr[24];
+	const char *name = NULL;
+
+	for (elem = *bucket; elem; elem = elem->next)
+		if (elem->id == id)
+			return elem->name;
+
+#     if ! defined(__MINGW32__)
+	char buf[4096];
+	if (isgroup) {
+		struct group gr, *grp = NULL;
+		if (getgrgid_r((gid_t) id, &gr, buf, sizeof(buf), &grp) == 0 && grp)
+			name = grp->gr_name;
+	} else {
+		struct passwd pw, *pwp = NULL;
+		if (getpwuid_r((uid_t) id, &pw, buf, sizeof(buf), &pwp) == 0 && pwp)
+			name = pwp->pw_name;
+	}
+#     endif
+	if (! name) {
+		snprintf(numstr, sizeof(numstr), "%lu", id);
+		name = numstr;
+	}
+	elem = malloc(sizeof(name_elem_t) + strlen(name));
+	assert(elem);
+	elem->id = id;
+	strcpy(elem->name, name);
+	elem->next = *bucket;
+	*bucket = elem;
+	return elem->name;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void mode_string( // - like ls -l
+	mode_t mode,
+	char *buf)
+{
+	const char *rwx = "rwxrwxrwx";
+	int i;
+
+	switch (mode & S_IFMT) {
+		case S_IFDIR:	buf[0] = 'd'; break;
+#	      if ! defined(__MINGW32__)
+		case S_IFLNK:	buf[0] = 'l'; break;
+		case S_IFBLK:	buf[0] = 'b'; break;
+		case S_IFSOCK:	buf[0] = 's'; break;
+#	      endif
+		case S_IFCHR:	buf[0] = 'c'; break;
+		case S_IFIFO:	buf[0] = 'p'; break;
+		default:	buf[0] = '-'; break;
+	}
+	for (i = 0; i < 9; i++)
+		buf[i+1] = mode & (0400 >> i) ? rwx[i] : '-';
+#     if ! defined(__MINGW32__)
+	if (mode & S_ISUID)
+		buf[3] = mode & S_IXUSR ? 's' : 'S';
+	if (mode & S_ISGID)
+		buf[6] = mode & S_IXGRP ? 's' : 'S';
+	if (mode & S_ISVTX)
+		buf[9] = mode & S_IXOTH ? 't' : 'T';
+#     endif
+	buf[10] = '\0';
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void line_append(
+	thread_data_t *tdata,
+	size_t *len,
+	const char *s,
+	size_t slen)
+{
+	if (*len + slen + 1 > tdata->linesize) {
+		tdata->linesize = 2 * (*len + slen + 1) + 256;
+		tdata->line = realloc(tdata->line, tdata->linesize);
+		assert(tdata->line);
+	}
+	memcpy(tdata->line + *len, s, slen);
+	*len += slen;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Format path according to printf_fields[] into tdata->line, and return its length.
+// The stat data is the one already fetched by handle_dirent(), so no extra system calls are done (except for %l).
+static size_t printf_format(
+	thread_data_t *tdata,
+	const char *path,
+	unsigned depth,
+	struct stat *st)
+{
+	size_t len = 0;
+	unsigned i;
+
+	for (i = 0; i < printf_fieldcount; i++) {
+		printf_field_t *f = &printf_fields[i];
+		char numstr[32];
+		const char *cstr = NULL;
+		size_t slen = 0;
+		int pad;
+
+		switch (f->conv) {
+			case 0:
+				line_append(tdata, &len, f->lit, f->litlen);
+				continue;
+			case 'p':
+				cstr = path;
+				break;
+			case 'f':
+				cstr = strrchr(path, '/') && strrchr(path, '/')[1] ? strrchr(path, '/') + 1 : path;
+				break;
+			case 'h':
+				cstr = strrchr(path, '/');
+				if (! cstr)
+					cstr = ".";
+				else if (cstr == path)
+					cstr = "/";
+				else {
+					slen = cstr - path;
+					cstr = path;
+				}
+				break;
+			case 'd':
+				snprintf(numstr, sizeof(numstr), "%u", depth);
+				break;
+			case 's':
+				snprintf(numstr, sizeof(numstr), "%lld", (long long) st->st_size);
+				break;
+			case 'b':
+				snprintf(numstr, sizeof(numstr), "%llu", allocated_bytes(st) / 512);
+				break;
+			case 'k':
+				snprintf(numstr, sizeof(numstr), "%llu", (allocated_bytes(st) + 1023) / 1024);
+				break;
+			case 'm':
+				snprintf(numstr, sizeof(numstr), "%o", (unsigned) (st->st_mode & 07777));
+				break;
+			case 'M':
+				mode_string(st->st_mode, numstr);
+				break;
+			case 'n':
+				snprintf(numstr, sizeof(numstr), "%lu", (unsigned long) st->st_nlink);
+				break;
+			case 'i':
+				snprintf(numstr, sizeof(numstr), "%llu", (unsigned long long) st->st_ino);
+				break;
+			case 'u':
+				cstr = name_lookup(tdata->unames, (unsigned long) st->st_uid, FALSE);
+				break;
+			case 'U':
+				snprintf(numstr, sizeof(numstr), "%lu", (unsigned long) st->st_uid);
+				break;
+			case 'g':
+				cstr = name_lookup(tdata->gnames, (unsigned long) st->st_gid, TRUE);
+				break;
+			case 'G':
+				snprintf(numstr, sizeof(numstr), "%lu", (unsigned long) st->st_gid);
+				break;
+			case 'y':
+				mode_string(st->st_mode, numstr);
+				numstr[0] = numstr[0] == '-' ? 'f' : numstr[0];
+				numstr[1] = '\0';
+				break;
+			case 'l':
+				numstr[0] = '\0';
+#			      if ! defined(__MINGW32__)
+				if (S_ISLNK(st->st_mode)) {
+					char target[PATH_MAX+1];
+					ssize_t n = readlink(path, target, PATH_MAX);
+					if (n > 0) {
+						line_append(tdata, &len, target, n); // - width ignored
+						continue;
+					}
+				}
+#			      endif
+				break;
+			case 't':
+				format_time(tdata->tc, st->st_mtime, numstr);
+				break;
+			case 'a':
+				format_time(tdata->tc, st->st_atime, numstr);
+				break;
+			case 'c':
+				format_time(tdata->tc, st->st_ctime, numstr);
+				break;
+			case 'T':
+				snprintf(numstr, sizeof(numstr), "%lld", (long long) st->st_mtime);
+				break;
+		}
+		if (! cstr)
+			cstr = numstr;
+		if (! slen)
+			slen = strlen(cstr);
+		pad = f->width > (int) slen ? f->width - (int) slen : 0;
+		while (! f->left && pad-- > 0)
+			line_append(tdata, &len, " ", 1);
+		line_append(tdata, &len, cstr, slen);
+		while (f->left && pad-- > 0)
+			line_append(tdata, &len, " ", 1);
+	}
+	line_append(tdata, &len, "", 0);
+	tdata->line[len] = '\0';
+	return len;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Print out a line formatted by printf_format(), as one write.
+static inline __attribute__((always_inline)) void output_line(
+	thread_data_t *tdata,
+	size_t len)
+{
+	if (buffered_output)
+		out_append(tdata, tdata->line, len);
+	else
+		fwrite(tdata->line, 1, len, stdout);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Print out a matched path for option --show-match: the path, a tab and the -N pattern it matched.
+static void output_match(
+	thread_data_t *tdata,
+	const char *path,
+	time_t mtime)
+{
+	const char *name = path, *pattern, *p;
+	char timestr[20];
+	size_t n = 0;
+
+	if (! match_all_path_elems)
+		for (p = path; *p; p++)
+			if (*p == '/' && p[1])
+				name = p + 1;
+	pattern = fast_match_ac ? fast_match_list[strmatch_ac_find(fast_match_ac, name)] : fast_match_list[0];
+	if (modtimelist && ! end_with_null) {
+		format_time(tdata->tc, mtime, timestr);
+		timestr[19] = ' ';
+		line_append(tdata, &n, timestr, sizeof(timestr));
+	}
+	line_append(tdata, &n, path, strlen(path));
+	line_append(tdata, &n, "\t", 1);
+	line_append(tdata, &n, pattern, strlen(pattern));
+	line_append(tdata, &n, end_with_null ? "" : "\n", 1);
+	output_line(tdata, n);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Append a srchrec_t record for option --binary.  d_type is used for the type if lstat() failed.
+static inline __attribute__((always_inline)) void output_record(
+	thread_data_t *tdata,
+	const char *path,
+	const struct stat *st,
+	boolean have_stat,
+	unsigned char d_type)
+{
+	size_t pathlen = strlen(path);
+	size_t reclen = SRCHREC_LEN(pathlen);
+	srchrec_t rec;
+	mode_t type;
+	char *p;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.reclen = reclen;
+	rec.pathlen = pathlen;
+	if (have_stat) {
+		rec.flags = SRCHREC_STAT;
+		rec.ino = st->st_ino;
+		rec.size = st->st_size;
+#	      if ! defined(__MINGW32__)
+		rec.blocks = st->st_blocks;
+#	      endif
+		rec.mtime = st->st_mtime;
+		rec.atime = st->st_atime;
+		rec.uid = st->st_uid;
+		rec.gid = st->st_gid;
+		rec.mode = st->st_mode;
+		type = st->st_mode & S_IFMT;
+	} else
+#	      if defined(DTTOIF)
+		type = DTTOIF(d_type);
+#	      else
+		type = 0;
+#	      endif
+
+	switch (type) {
+		case S_IFREG:  rec.type = SRCHREC_REG; break;
+		case S_IFDIR:  rec.type = SRCHREC_DIR; break;
+#	      if ! defined(__MINGW32__)
+		case S_IFLNK:  rec.type = SRCHREC_LNK; break;
+		case S_IFSOCK: rec.type = SRCHREC_SOCK; break;
+#	      endif
+		case S_IFBLK:  rec.type = SRCHREC_BLK; break;
+		case S_IFCHR:  rec.type = SRCHREC_CHR; break;
+		case S_IFIFO:  rec.type = SRCHREC_FIFO; break;
+		default:       rec.type = SRCHREC_UNKNOWN; break;
+	}
+
+	p = out_reserve(tdata, reclen); // - a record is never split across two buffers
+	memcpy(p, &rec, sizeof(rec));
+	memcpy(p + sizeof(rec), path, pathlen);
+	memset(p + sizeof(rec) + pathlen, 0, reclen - sizeof(rec) - pathlen);
+}
+
+#if ! defined(__MINGW32__)
+/////////////////////////////////////////////////////////////////////////////
+
+// Search len bytes of whole lines for the --grep or --grep-re pattern.  Returns TRUE at the first match, or with
+// option --grep-lines, prints out every matching line as path:lineno:line, counting lines from *lineno.
+static boolean grep_block(
+	thread_data_t *tdata,
+	const char *path,
+	const char *buf,
+	size_t len,
+	unsigned long long *lineno)
+{
+	const char *p = buf, *end = buf + len, *counted = buf, *match, *bol, *eol;
+	boolean found = FALSE;
+	char num[24];
+	size_t n;
+
+	while (p < end) {
+		if (grep_regex) {
+			regmatch_t pm;
+			pm.rm_so = p - buf;
+			pm.rm_eo = len;
+			if (regexec(thread_regex(&tdata->grepre, grep_pattern, grep_reflags), buf, 1, &pm, REG_STARTEND) != 0)
+				break;
+			match = buf + pm.rm_so;
+		} else if (! (match = memmem(p, end - p, grep_pattern, grep_patternlen)))
+			break;
+		found = TRUE;
+		if (! grep_lines)
+			return TRUE;
+
+		for (bol = match; bol > p && bol[-1] != '\n'; bol--)
+			;
+		if (! (eol = memchr(match, '\n', end - match)))
+			eol = end;
+		for (; (counted = memchr(counted, '\n', bol - counted)); counted++)
+			(*lineno)++;
+		n = 0;
+		line_append(tdata, &n, path, strlen(path));
+		line_append(tdata, &n, num, sprintf(num, ":%llu:", *lineno));
+		line_append(tdata, &n, bol, eol - bol);
+		line_append(tdata, &n, "\n", 1);
+		output_line(tdata, n);
+		if (eol == end)
+			return found;
+		(*lineno)++;
+		counted = p = eol + 1;
+	}
+	if (grep_lines)
+		for (; (counted = memchr(counted, '\n', end - counted)); counted++)
+			(*lineno)++;
+	return found;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Content filter of options --grep and --grep-re, checked after the other filters: returns TRUE if the regular file
+// at path contains the pattern.  Binary files, and files larger than grep_max, are skipped.  With --grep-lines, the
+// matching lines are printed out right away, and FALSE is returned so the path is not.
+static boolean grep_match(
+	thread_data_t *tdata,
+	const char *path,
+	const struct stat *st)
+{
+	unsigned long long lineno = 1;
+	size_t have = 0, len;
+	boolean found = FALSE, first = TRUE;
+	ssize_t n;
+	char *q;
+	int fd;
+
+	if (! S_ISREG(st->st_mode) || ! st->st_size)
+		return FALSE;
+	if (grep_max && (unsigned long long) st->st_size > grep_max) {
+		tdata->grep_large++;
+		return FALSE;
+	}
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (output_lstat_errors) {
+			pthread_mutex_lock(&perror_lock);
+			fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+			pthread_mutex_unlock(&perror_lock);
+		}
+		return FALSE;
+	}
+#     if defined(POSIX_FADV_SEQUENTIAL)
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#     endif
+	if (! tdata->grepbuf) {
+		tdata->grepbufsize = GREP_BUF_SIZE;
+		tdata->grepbuf = malloc(tdata->grepbufsize);
+		assert(tdata->grepbuf);
+	}
+	tdata->grep_files++;
+	for (;;) {
+		if (have == tdata->grepbufsize) { // - a line longer than the buffer
+			tdata->grepbufsize *= 2;
+			tdata->grepbuf = realloc(tdata->grepbuf, tdata->grepbufsize);
+			assert(tdata->grepbuf);
+		}
+		if ((n = read(fd, tdata->grepbuf + have, tdata->grepbufsize - have)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (output_lstat_errors) {
+				pthread_mutex_lock(&perror_lock);
+				fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+				pthread_mutex_unlock(&perror_lock);
+			}
+			break;
+		}
+		tdata->grep_bytes += n;
+		len = have + n;
+		if (first) {
+			first = FALSE;
+			if (memchr(tdata->grepbuf, '\0', len < GREP_BINARY_PROBE ? len : GREP_BINARY_PROBE)) {
+				tdata->grep_binary++;
+				break;
+			}
+		}
+		if (! n) { // - the last line has no newline
+			if (have)
+				found |= grep_block(tdata, path, tdata->grepbuf, have, &lineno);
+			break;
+		}
+		for (q = tdata->grepbuf + len; q > tdata->grepbuf && q[-1] != '\n'; q--)
+			;
+		if (q == tdata->grepbuf) {
+			have = len;
+			continue;
+		}
+		found |= grep_block(tdata, path, tdata->grepbuf, q - tdata->grepbuf, &lineno);
+		if (found && ! grep_lines)
+			break;
+		have = tdata->grepbuf + len - q;
+		memmove(tdata->grepbuf, q, have);
+	}
+	close(fd);
+	return found && ! grep_lines;
+}
+#endif
+
+#if ! defined(__MINGW32__)
+/////////////////////////////////////////////////////////////////////////////
+
+// Write value in octal into a tar header field of width bytes, including the terminating NUL.
+static void tar_octal(
+	char *field,
+	size_t width,
+	unsigned long long value)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%0*llo", (int) width - 1, value);
+	memcpy(field, buf, width);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Set the size field of the ustar header block hdr, and its checksum.
+static void tar_set_size(
+	char *hdr,
+	unsigned long long size)
+{
+	unsigned sum = 0, i;
+
+	tar_octal(hdr + 124, 12, size);
+	memset(hdr + 148, ' ', 8);
+	for (i = 0; i < TAR_BLOCK; i++)
+		sum += (unsigned char) hdr[i];
+	snprintf(hdr + 148, 8, "%06o", sum); // - six digits, NUL and the space left from above
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Append one "<length> <key>=<value>\n" record of a pax extended header at p, returning its length.
+static size_t tar_pax_record(
+	char *p,
+	const char *key,
+	const char *value)
+{
+	size_t len = strlen(key) + strlen(value) + 3, total, digits;
+
+	for (digits = 1; ; digits++) {
+		total = len + digits;
+		if (snprintf(NULL, 0, "%zu", total) == (int) digits)
+			break;
+	}
+	return sprintf(p, "%zu %s=%s\n", total, key, value);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Room needed by tar_header() for a name and link target of the given lengths.
+static size_t tar_header_size(
+	size_t namelen,
+	size_t linklen)
+{
+	return 3 * TAR_BLOCK + ((namelen + linklen + 128 + TAR_BLOCK - 1) & ~(size_t) (TAR_BLOCK - 1));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Write the header blocks of a member to hdr, and return their length.  A pax extended header goes first if the name,
+// link target, size or an id does not fit in ustar.
+static size_t tar_header(
+	thread_data_t *tdata,
+	char *hdr,
+	const char *name,
+	const struct stat *st,
+	char type,
+	unsigned long long size,
+	const char *link)
+{
+	size_t namelen = strlen(name), linklen = link ? strlen(link) : 0, paxlen = 0, i, split = 0;
+	char *ustar, *pax = hdr + TAR_BLOCK, numstr[24];
+	const char *uname, *gname;
+
+	if (namelen > 100) { // - try to split it into prefix and name at a slash
+		for (i = namelen - 101; i < namelen - 1 && i <= 155; i++)
+			if (name[i] == '/' && i > 0) {
+				split = i;
+				break;
+			}
+		if (! split)
+			paxlen += tar_pax_record(pax + paxlen, "path", name);
+	}
+	if (linklen > 100)
+		paxlen += tar_pax_record(pax + paxlen, "linkpath", link);
+	if (size > 077777777777ULL) {
+		snprintf(numstr, sizeof(numstr), "%llu", size);
+		paxlen += tar_pax_record(pax + paxlen, "size", numstr);
+	}
+	if ((unsigned long) st->st_uid > 07777777) {
+		snprintf(numstr, sizeof(numstr), "%lu", (unsigned long) st->st_uid);
+		paxlen += tar_pax_record(pax + paxlen, "uid", numstr);
+	}
+	if ((unsigned long) st->st_gid > 07777777) {
+		snprintf(numstr, sizeof(numstr), "%lu", (unsigned long) st->st_gid);
+		paxlen += tar_pax_record(pax + paxlen, "gid", numstr);
+	}
+
+	if (paxlen) {
+		size_t padded = (paxlen + TAR_BLOCK - 1) & ~(size_t) (TAR_BLOCK - 1);
+		memset(pax + paxlen, 0, padded - paxlen);
+		memset(hdr, 0, TAR_BLOCK);
+		strcpy(hdr, "PaxHeader");
+		tar_octal(hdr + 100, 8, 0644);
+		tar_octal(hdr + 108, 8, 0);
+		tar_octal(hdr + 116, 8, 0);
+		tar_octal(hdr + 136, 12, 0);
+		hdr[156] = 'x';
+		memcpy(hdr + 257, "ustar", 6);
+		memcpy(hdr + 263, "00", 2);
+		tar_set_size(hdr, paxlen);
+		ustar = pax + padded;
+	} else
+		ustar = hdr;
+
+	memset(ustar, 0, TAR_BLOCK);
+	if (split) {
+		memcpy(ustar + 345, name, split);
+		memcpy(ustar, name + split + 1, namelen - split - 1);
+	} else
+		memcpy(ustar, name, namelen > 100 ? 100 : namelen);
+	tar_octal(ustar + 100, 8, st->st_mode & 07777);
+	tar_octal(ustar + 108, 8, (unsigned long) st->st_uid > 07777777 ? 0 : st->st_uid);
+	tar_octal(ustar + 116, 8, (unsigned long) st->st_gid > 07777777 ? 0 : st->st_gid);
+	tar_octal(ustar + 136, 12, st->st_mtime > 0 ? (unsigned long long) st->st_mtime : 0);
+	ustar[156] = type;
+	if (link)
+		memcpy(ustar + 157, link, linklen > 100 ? 100 : linklen);
+	memcpy(ustar + 257, "ustar", 6);
+	memcpy(ustar + 263, "00", 2);
+	uname = name_lookup(tdata->unames, (unsigned long) st->st_uid, FALSE);
+	gname = name_lookup(tdata->gnames, (unsigned long) st->st_gid, TRUE);
+	if (! isdigit((unsigned char) *uname)) // - a number means no name
+		strncpy(ustar + 265, uname, 31);
+	if (! isdigit((unsigned char) *gname))
+		strncpy(ustar + 297, gname, 31);
+#     if ! defined(__MINGW32__)
+	if (type == '3' || type == '4') {
+		tar_octal(ustar + 329, 8, major(st->st_rdev));
+		tar_octal(ustar + 337, 8, minor(st->st_rdev));
+	}
+#     endif
+	tar_set_size(ustar, size > 077777777777ULL ? 0 : size);
+	return ustar + TAR_BLOCK - hdr;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Put a member in the queue of the writer thread, waiting while it holds TAR_BUFFER_SIZE bytes.
+static void tar_enqueue(
+	tar_entry_t *entry)
+{
+	struct timeval start, now;
+
+	entry->next = NULL;
+	pthread_mutex_lock(&tar_lock);
+	if (tar_queued && tar_queued + entry->len > TAR_BUFFER_SIZE) {
+		(void) gettimeofday(&start, NULL);
+		while (tar_queued && tar_queued + entry->len > TAR_BUFFER_SIZE)
+			pthread_cond_wait(&tar_room_cond, &tar_lock);
+		(void) gettimeofday(&now, NULL);
+		tar_throttled += (now.tv_sec - start.tv_sec) * 1000000LL + now.tv_usec - start.tv_usec;
+	}
+	if (tar_tail)
+		tar_tail->next = entry;
+	else
+		tar_head = entry;
+	tar_tail = entry;
+	entry->held = entry->len;
+	tar_queued += entry->len;
+	pthread_cond_signal(&tar_cond);
+	pthread_mutex_unlock(&tar_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void tar_error(
+	const char *path)
+{
+	pthread_mutex_lock(&perror_lock);
+	fprintf(stderr, "%s: tar ", progname);
+	perror(path);
+	pthread_mutex_unlock(&perror_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Make a member of the --tar archive for path, or return NULL if it can not be archived.  Regular files up to
+// TAR_PREFETCH_MAX bytes are read right away, so the threads read many small files in parallel while the writer only
+// writes; larger ones are read by the writer.  With --ordered, the writer may be waiting for another directory, so
+// instead of waiting for room, files are left to the writer when TAR_BUFFER_SIZE bytes are read ahead.
+static tar_entry_t *tar_member(
+	thread_data_t *tdata,
+	const char *path,
+	const struct stat *st)
+{
+	const char *name = path;
+	char *dirname = NULL, *link = NULL, type;
+	unsigned long long size = 0;
+	size_t namelen, hdrmax, hdrlen, datalen = 0, held = 0;
+	tar_entry_t *entry;
+	int fd = -1;
+
+	for (;;) { // - like tar, store absolute paths and paths above the current directory as relative
+		if (name[0] == '/')
+			name++;
+		else if (name[0] == '.' && name[1] == '.' && (name[2] == '/' || ! name[2]))
+			name += name[2] ? 3 : 2;
+		else
+			break;
+	}
+	switch (st->st_mode & S_IFMT) {
+		case S_IFREG:
+			type = '0';
+			size = st->st_size;
+			if (size > TAR_PREFETCH_MAX)
+				break;
+			if ((fd = open(path, O_RDONLY)) < 0) {
+				tar_error(path);
+				return NULL;
+			}
+			if (ordered) {
+				pthread_mutex_lock(&tar_lock);
+				if (tar_queued + size <= TAR_BUFFER_SIZE) {
+					held = size;
+					tar_queued += held;
+				}
+				pthread_mutex_unlock(&tar_lock);
+				if (! held && size) {
+					close(fd);
+					fd = -1;
+				}
+			}
+			break;
+		case S_IFDIR:
+			type = '5';
+			namelen = strlen(name);
+			while (namelen > 1 && name[namelen-1] == '/')
+				namelen--;
+			dirname = malloc(namelen + 3);
+			assert(dirname);
+			memcpy(dirname, name, namelen);
+			strcpy(dirname + namelen, namelen ? "/" : "./"); // - directories end with a slash, "/" is stored as "./"
+			name = dirname;
+			break;
+		case S_IFLNK: {
+			char target[PATH_MAX];
+			ssize_t n = readlink(path, target, sizeof(target) - 1);
+			if (n < 0) {
+				tar_error(path);
+				return NULL;
+			}
+			target[n] = '\0';
+			link = strdup(target);
+			assert(link);
+			type = '2';
+			break;
+		}
+		case S_IFCHR:	type = '3'; break;
+		case S_IFBLK:	type = '4'; break;
+		case S_IFIFO:	type = '6'; break;
+		case S_IFSOCK:
+			pthread_mutex_lock(&perror_lock);
+			fprintf(stderr, "%s: tar %s: socket ignored\n", progname, path);
+			pthread_mutex_unlock(&perror_lock);
+			return NULL;
+		default:
+			return NULL;
+	}
+
+	hdrmax = tar_header_size(strlen(name), link ? strlen(link) : 0);
+	if (fd >= 0)
+		datalen = (size + TAR_BLOCK - 1) & ~(unsigned long long) (TAR_BLOCK - 1);
+	entry = malloc(sizeof(tar_entry_t) + hdrmax + datalen);
+	assert(entry);
+	hdrlen = tar_header(tdata, entry->buf, name, st, type, size, link);
+	free(dirname);
+	free(link);
+	entry->path = NULL;
+	entry->size = 0;
+	entry->held = held;
+	if (fd >= 0) {
+		// - read the file now; if it has shrunk since lstat(), store what is there
+		size_t got = 0;
+		ssize_t n;
+		while (got < size && (n = read(fd, entry->buf + hdrlen + got, size - got)) != 0) {
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				tar_error(path);
+				close(fd);
+				free(entry);
+				if (held) {
+					pthread_mutex_lock(&tar_lock);
+					tar_queued -= held;
+					pthread_mutex_unlock(&tar_lock);
+				}
+				return NULL;
+			}
+			got += n;
+		}
+		close(fd);
+		if (got < size) {
+			size = got;
+			datalen = (size + TAR_BLOCK - 1) & ~(unsigned long long) (TAR_BLOCK - 1);
+			tar_set_size(entry->buf + hdrlen - TAR_BLOCK, size);
+		}
+		memset(entry->buf + hdrlen + size, 0, datalen - size);
+		pthread_mutex_lock(&tar_lock);
+		tar_prefetched++;
+		pthread_mutex_unlock(&tar_lock);
+	} else if (size) {
+		entry->path = strdup(path);
+		assert(entry->path);
+		entry->size = size;
+	}
+	entry->len = hdrlen + datalen;
+	return entry;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Write size bytes of path to the archive, padded to whole blocks, for files not read ahead.  The size in the header
+// is already written, so a file that has shrunk is padded with NULs, and one that has grown is cut.
+static void tar_stream(
+	const char *path,
+	unsigned long long size)
+{
+	static char *buf = NULL; // - only used by the writer
+	unsigned long long left = size;
+	ssize_t n = 0;
+	int fd = open(path, O_RDONLY);
+
+	if (! buf) {
+		buf = malloc(TAR_PREFETCH_MAX);
+		assert(buf);
+	}
+	if (fd < 0)
+		tar_error(path);
+	while (left && fd >= 0) {
+		n = read(fd, buf, left > TAR_PREFETCH_MAX ? TAR_PREFETCH_MAX : left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		fwrite(buf, 1, n, stdout);
+		left -= n;
+	}
+	if (left && fd >= 0) {
+		if (n < 0)
+			tar_error(path);
+		else {
+			pthread_mutex_lock(&perror_lock);
+			fprintf(stderr, "%s: tar %s: file shrank by %llu bytes, padded with NULs\n", progname, path, left);
+			pthread_mutex_unlock(&perror_lock);
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	memset(buf, 0, TAR_PREFETCH_MAX);
+	left += (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+	while (left) {
+		n = left > TAR_PREFETCH_MAX ? TAR_PREFETCH_MAX : left;
+		fwrite(buf, 1, n, stdout);
+		left -= n;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Write a member to the archive and free it.  Only called by the writer thread, or the emitter thread if --ordered.
+static void tar_write(
+	tar_entry_t *entry)
+{
+	fwrite(entry->buf, 1, entry->len, stdout);
+	tar_bytes += entry->len;
+	if (entry->path) {
+		tar_stream(entry->path, entry->size);
+		tar_bytes += (entry->size + TAR_BLOCK - 1) & ~(unsigned long long) (TAR_BLOCK - 1);
+		tar_streamed++;
+		free(entry->path);
+	}
+	pthread_mutex_lock(&tar_lock);
+	tar_members++;
+	tar_queued -= entry->held;
+	pthread_cond_broadcast(&tar_room_cond);
+	pthread_mutex_unlock(&tar_lock);
+	free(entry);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// End the archive with two zero blocks, padded to a whole record like tar does.
+static void tar_end()
+{
+	unsigned long long end = (tar_bytes + 2 * TAR_BLOCK + TAR_RECORD - 1) / TAR_RECORD * TAR_RECORD;
+	static char zeros[TAR_RECORD];
+
+	while (tar_bytes < end) {
+		size_t n = end - tar_bytes > TAR_RECORD ? TAR_RECORD : end - tar_bytes;
+		fwrite(zeros, 1, n, stdout);
+		tar_bytes += n;
+	}
+	fflush(stdout);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// The single writer of option --tar, unless --ordered: writes the members in the order they are queued.
+static void *tar_writer_routine(
+	void *arg)
+{
+	tar_entry_t *entry;
+
+	(void) arg;
+	for (;;) {
+		pthread_mutex_lock(&tar_lock);
+		while (! tar_head && ! tar_closed)
+			pthread_cond_wait(&tar_cond, &tar_lock);
+		entry = tar_head;
+		if (entry) {
+			tar_head = entry->next;
+			if (! tar_head)
+				tar_tail = NULL;
+		}
+		pthread_mutex_unlock(&tar_lock);
+		if (! entry)
+			break;
+		tar_write(entry);
+	}
+	tar_end();
+	return NULL;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) char *line_dup(
+	thread_data_t *tdata,
+	size_t len)
+{
+	char *line = malloc(len + 1);
+
+	assert(line);
+	memcpy(line, tdata->line, len + 1);
+	return line;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Set up twice as many buffers as threads (main thread included), one for each thread and the rest for the queue.
+static void output_start(
+	thread_data_t *tdata,
+	unsigned count)
+{
+	struct stat st;
+	unsigned i;
+
+	fflush(stdout);
+#     if ! defined(__MINGW32__)
+	if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode)
+	    && ! (fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND)
+	    && (out_offset = lseek(STDOUT_FILENO, 0, SEEK_CUR)) >= 0)
+		out_pwrite = TRUE;
+#     endif
+	for (i = 0; i < 2 * count; i++) {
+		outbuf_t *buf = malloc(sizeof(outbuf_t));
+		assert(buf);
+		buf->data = malloc(OUTBUF_SIZE);
+		assert(buf->data);
+		buf->len = 0;
+		buf->size = OUTBUF_SIZE;
+		if (i < count) {
+			tdata[i].out = buf;
+			continue;
+		}
+		buf->next = out_free;
+		out_free = buf;
+	}
+	if (! out_pwrite && pthread_create(&out_writer, NULL, out_writer_routine, NULL)) {
+		fprintf(stderr, "%s: ", progname);
+		perror("pthread_create()");
+		exit(1);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Flush the remaining buffers of all threads, and wait for the writer thread to finish.
+static void output_finish(
+	thread_data_t *tdata,
+	unsigned count)
+{
+	outbuf_t *buf;
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		tdata[i].out = out_flush(tdata[i].out);
+		tdata[i].out->next = out_free;
+		out_free = tdata[i].out;
+	}
+	if (out_pwrite) {
+		(void) lseek(STDOUT_FILENO, out_offset, SEEK_SET); // - later output goes after ours
+	} else {
+		pthread_mutex_lock(&out_lock);
+		out_done = TRUE;
+		pthread_cond_signal(&out_full_cond);
+		pthread_mutex_unlock(&out_lock);
+		pthread_join(out_writer, NULL);
+	}
+	while ((buf = out_free)) {
+		out_free = buf->next;
+		free(buf->data);
+		free(buf);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void ordered_print(
+	const char *path,
+	time_t mtime)
+{
+	static timecache_t *tc = NULL; // - only used by the emitter thread
+	char timestr[20];
+
+	if (end_with_null)
+		printf("%s%c", path, '\0');
+	else if (modtimelist) {
+		if (! tc)
+			tc = timecache_new();
+		format_time(tc, mtime, timestr);
+		printf("%s %s\n", timestr, path);
+	} else
+		puts(path);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Print out ent, followed by its subtree in pre-order, waiting for directories not read yet.
+static void ordered_emit(
+	outent_t *ent)
+{
+	outnode_t *node = ent->child;
+	size_t i;
+
+	if (ent->listed && ent->tar)
+		tar_write(ent->tar);
+	else if (ent->listed && ent->line)
+		fwrite(ent->line, 1, ent->linelen, stdout);
+	else if (ent->listed)
+		ordered_print(ent->path, ent->mtime);
+	if (node) {
+		pthread_mutex_lock(&ordered_lock);
+		while (! node->ready)
+			pthread_cond_wait(&ordered_cond, &ordered_lock);
+		pthread_mutex_unlock(&ordered_lock);
+
+		if (node->zlisted)
+			ordered_print(ent->path, node->zmtime);
+		for (i = 0; i < node->count; i++)
+			ordered_emit(&node->ents[i]);
+		free(node->ents);
+		free(node);
+	}
+	free(ent->line);
+	free(ent->path);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void *ordered_emitter_routine(
+	void *arg)
+{
+	size_t i;
+
+	(void) arg;
+	for (i = 0; ; i++) {
+		outent_t ent;
+		pthread_mutex_lock(&ordered_lock);
+		while (i >= ordered_root.count && ! ordered_root.ready)
+			pthread_cond_wait(&ordered_cond, &ordered_lock);
+		if (i >= ordered_root.count) {
+			pthread_mutex_unlock(&ordered_lock);
+			break;
+		}
+		ent = ordered_root.ents[i]; // - a copy, since ordered_root.ents may be realloc'ed meanwhile
+		pthread_mutex_unlock(&ordered_lock);
+		ordered_emit(&ent);
+	}
+	free(ordered_root.ents);
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) boolean modtimecheck(
+        time_t mtime)
+{
+        return ! older_or_younger
+            || (olderthan && mtime < olderthan && ! youngerthan)
+            || (youngerthan && mtime > youngerthan && ! olderthan)
+            || (older_and_younger && mtime < olderthan && mtime > youngerthan);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) boolean uidgidcheck(
+	uid_t uid,
+	gid_t gid)
+{
+	return ! uid_or_gid
+	    || (uidsearch && uid_match(uid))
+	    || (uidnegsearch && ! uid_match(uid))
+            || (gidsearch && gid_match(gid))
+	    || (gidnegsearch && ! gid_match(gid));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) boolean sizecheck(
+	size_t size)
+{
+	if (! filesizesearch)
+		return TRUE;
+
+	if (filesizeabove && filesizebelow)
+		return size >= lowfilesize && size <= filesize;
+	else
+		return (filesizeabove && size >= filesize)
+	            || (filesizebelow && size <= filesize)
+	    	    || size == filesize;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Tree size estimation (option --estimate), after D. E. Knuth, "Estimating the efficiency of backtrack programs":
+// Each probe reads one directory per level, from a start directory down to a leaf, picking a random subdir
+// at each level.  The entries of a directory at depth k are weighted by b1*b2*...*bk, where bi is the number
+// of subdirs seen at depth i along the probe path.  The mean over all probes is an unbiased estimate of the totals.
+
+static dirlist_t	*estimate_roots = NULL;		// - the verified start directories
+static unsigned		 estimate_rootcount = 0;
+static unsigned		 estimate_started = 0;		// - number of probe rounds handed out, protected by estimate_lock
+static struct timeval	 estimate_deadline;
+static pthread_mutex_t	 estimate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) void estimate_add_subdir(
+	estimate_t *est,
+	char *path,		// - kept, to be freed by walk_dir() or estimate_probe()
+	unsigned depth,
+	struct stat *st,
+	exclude_node_t *exclude)
+{
+	dirlist_t *subdir;
+
+	if (est->subdir_count == est->subdir_size) {
+		est->subdir_size = est->subdir_size ? 2 * est->subdir_size : 64;
+		est->subdirs = realloc(est->subdirs, est->subdir_size * sizeof(dirlist_t));
+		assert(est->subdirs);
+	}
+	subdir = &est->subdirs[est->subdir_count++];
+	memset(subdir, 0, sizeof(dirlist_t));
+	subdir->dirpath = path;
+	subdir->depth = depth;
+	subdir->st_nlink = simulate_posix_compliance ? DIRTY_CONSTANT : st->st_nlink;
+	subdir->modtime = st->st_mtime;
+	subdir->st_dev = st->st_dev;
+	subdir->exclude = exclude;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline void handle_dirent(dirlist_t *, struct dirent *); // - used by walk_dir()
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Act on a directory whose subtree is done, for option --post-order: dir either matched, or with -z, contains
+// nothing but directories without files.  Returns FALSE if it was left out after all.
+static boolean post_order_action(
+	thread_data_t *tdata,
+	dirlist_t *dir)
+{
+	if (zerosized && ! (modtimecheck(dir->modtime) && (! mindepth || dir->depth-1 >= mindepth)))
+		return FALSE;
+	if (run_cmd)
+		do_run(tdata, AT_FDCWD, dir->dirpath, dir->dirpath, NULL);
+	else
+		output_path(tdata, dir->dirpath, dir->modtime);
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void walk_dir(
+	dirlist_t *curdir)
+{
+	DIR *dir = NULL;
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+	int fd = 0;    			// - only used on Linux/*BSD if option -X is given
+	char *buf = NULL;   		// - same
+	unsigned bpos = 0, nread = 0;	// - same
+#endif
+	struct dirent *dent = NULL;
+
+	//assert(curdir->dirpath);
+
+#    if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+	if (extreme_readdir) {
+		if ((fd = open(curdir->dirpath, O_RDONLY | O_DIRECTORY)) < 0) {
+			pthread_mutex_lock(&perror_lock);
 			fprintf(stderr, "%s: ", progname);
 			perror(curdir->dirpath);
 			pthread_mutex_unlock(&perror_lock);
+			if (ordered)
+				ordered_ready(curdir->outnode);
+			curdir->filecnt = 1; // - not known to be empty, for -z with --post-order
+			if (! track_completion) // - else freed by dirlist_done()
+				free(curdir->dirpath);
 			return;
 		}
 		dent = malloc(sizeof(struct dirent));
 		assert(dent);
 		buf = malloc(buf_size);
 		assert(buf);
+		curdir->dirfd = fd;
 	} else
 #    endif
 	if (! (dir = opendir(curdir->dirpath))) {
@@ -625,8 +3781,17 @@ static void walk_dir(
 			fprintf(stderr, "%s: ", progname);
 			perror(curdir->dirpath);
 			pthread_mutex_unlock(&perror_lock);
+			if (ordered)
+				ordered_ready(curdir->outnode);
+			curdir->filecnt = 1; // - not known to be empty, for -z with --post-order
+			if (! track_completion) // - else freed by dirlist_done()
+				free(curdir->dirpath);
 			return;
 	}
+#    if ! defined(__MINGW32__)
+	else
+		curdir->dirfd = dirfd(dir);
+#    endif
 
 	if (curdir->st_nlink < 2 && ! simulate_posix_compliance) {
 		if (debug)	
@@ -675,23 +3840,21 @@ static void walk_dir(
 		heap_elem_t *elem = heap_new_elem(curdir->depth-1, curdir->dirpath);
 		if (! heap_push(elem, ASCEND))
 			heap_free_elem(elem);
-	} else if (zerosized && curdir->filecnt == 0 && modtimecheck(curdir->modtime)
+	} else if (zerosized && ! post_order && curdir->filecnt == 0 && modtimecheck(curdir->modtime)
 		   && (! mindepth || curdir->depth-1 >= mindepth)) {
 		if (run_cmd)
-			do_run(cmd, curdir->dirpath);
-		else if (end_with_null)
-			printf("%s%c", curdir->dirpath, '\0');
-		else if (modtimelist) {
-			char *timestr = printable_time(curdir->modtime);
-			pthread_mutex_lock(&modtimelist_lock);
-			printf("%s %s\n", timestr, curdir->dirpath);
-			pthread_mutex_unlock(&modtimelist_lock);
-			free(timestr);
+			do_run(curdir->tdata, AT_FDCWD, curdir->dirpath, curdir->dirpath, NULL);
+		else if (ordered) {
+			curdir->outnode->zlisted = TRUE;
+			curdir->outnode->zmtime = curdir->modtime;
 		} else
-			puts(curdir->dirpath);
+			output_path(curdir->tdata, curdir->dirpath, curdir->modtime);
 	}
 
-	if (curdir->dirpath)
+	if (ordered)
+		ordered_ready(curdir->outnode);
+
+	if (curdir->dirpath && ! track_completion) // - else freed by dirlist_done()
 		free(curdir->dirpath);
 
 	return;
@@ -704,6 +3867,9 @@ static inline __attribute__((always_inline)) void handle_dirent(
 	struct dirent *dent)
 {
 	boolean dive_into_subdir = FALSE;
+	long ordered_idx = -1;	// - index of this entry in curdir->outnode if option --ordered is given
+	boolean have_stat = FALSE; // - st is filled in by lstat()
+	boolean post_match = FALSE; // - a matched subdir to act on when its subtree is done, for --post-order
 	int ftype = 0;
 	int lstaterror = 0;
 	struct stat st;
@@ -730,6 +3896,7 @@ static inline __attribute__((always_inline)) void handle_dirent(
 		// - on directories we don't own ourselves.
 		// - on NFS shares.
 		lstaterror = lstat(path, &st);
+		have_stat = ! lstaterror;
 		if (lstaterror) {
 			st.st_mode = st.st_mtime = st.st_size = st.st_blocks = 0;
 			st.st_uid = st.st_gid = -1;
@@ -789,7 +3956,6 @@ static inline __attribute__((always_inline)) void handle_dirent(
 	if (dent->d_type == DT_DIR) {
 		ftype = S_IFDIR;
 		curdir->st_nlink--;
-		curdir->modtime = st.st_mtime;
 		dive_into_subdir = TRUE;
 
 
@@ -829,6 +3995,7 @@ static inline __attribute__((always_inline)) void handle_dirent(
 	    || lstat_needed) {
 #	      if ! defined(__MINGW32__)
 		lstaterror = lstat(path, &st);
+		have_stat = ! lstaterror;
 		if (lstaterror) {
 			st.st_mode = st.st_mtime = st.st_size = st.st_blocks = 0;
 			st.st_uid = st.st_gid = -1;
@@ -874,7 +4041,6 @@ static inline __attribute__((always_inline)) void handle_dirent(
 
 		if (S_ISDIR(st.st_mode)) {
 			curdir->st_nlink--;
-			curdir->modtime = st.st_mtime;
 			dive_into_subdir = TRUE;
 
 			if (xdev && curdir->st_dev != st.st_dev)
@@ -887,28 +4053,54 @@ static inline __attribute__((always_inline)) void handle_dirent(
 #endif // - non-Linux/BSD
 
 	if (excludelist_count > 0 && dive_into_subdir) {
-		unsigned i;
-		for (i = 0; i < excludelist_count; i++)
-			if (excluderecomp) {
-				if (regexec(excluderecomp[i], dent->d_name, 0, NULL, 0) == 0) {
+		if (exclude_trie) {
+			curdir->child_exclude = curdir->exclude ? exclude_child(curdir->exclude, dent->d_name, strlen(dent->d_name)) : NULL;
+			if (curdir->child_exclude && curdir->child_exclude->excluded) {
+				if (debug)
+					fprintf(stderr, "==> Skipping dir %s (path given with -E)\n", path);
+				free(path);
+				return;		// - skip directories specified through -E <path>
+			}
+		}
+		if (exclude_names) {
+			exclude_elem_t *elem = exclude_name_find(dent->d_name);
+			if (elem) {
+				if (debug)
+					fprintf(stderr, "==> Skipping dir %s (%s)\n", path, elem->name);
+				free(path);
+				return;		// - skip directories specified through -E
+			}
+		} else if (exclude_re_arg) {
+			int r = exclude_pre ? strmatch_re_check(exclude_pre, dent->d_name) : STRMATCH_RE_MAYBE;
+			if (r == STRMATCH_RE_MAYBE)
+				r = regexec(thread_regex(&curdir->tdata->excludeall, exclude_re_arg, REG_EXTENDED|REG_NOSUB),
+					    dent->d_name, 0, NULL, 0) ? STRMATCH_RE_NO : STRMATCH_RE_YES;
+			if (r == STRMATCH_RE_YES) {
+				if (debug)
+					fprintf(stderr, "==> Skipping dir %s (%s)\n", path, exclude_re_arg);
+				free(path);
+				return;		// - skip directories specified through -e
+			}
+		} else if (excluderecomp) {
+			unsigned i;
+			if (! curdir->tdata->excludere) {
+				curdir->tdata->excludere = calloc(excludelist_count, sizeof(regex_t *));
+				assert(curdir->tdata->excludere);
+			}
+			for (i = 0; i < excludelist_count; i++)
+				if (regexec(thread_regex(&curdir->tdata->excludere[i], excludelist[i], REG_EXTENDED|REG_NOSUB),
+					    dent->d_name, 0, NULL, 0) == 0) {
 					if (debug)
 						fprintf(stderr, "==> Skipping dir %s (%s)\n", path, excludelist[i]);
 					free(path);
 					return;		// - skip directories specified through -e
 				}
-			} else {
-				if (strcmp(excludelist[i], dent->d_name) == 0) {
-					if (debug)
-						fprintf(stderr, "==> Skipping dir %s (%s)\n", path, excludelist[i]);
-					free(path);
-					return;		// - skip directories specified through -E
-				}
-			}
+		}
 	}
 
 	// List the file or not - that is the big question at this point:
 	if ((! mindepth || curdir->depth >= mindepth)
-	    && filename_match(match_all_path_elems ? path : dent->d_name)
+	    && filename_match(curdir->tdata, match_all_path_elems ? path : dent->d_name)
 	    && (
 		! filetypemask
 		|| ((filetypemask & FILETYPE_REGFILE) && ftype == S_IFREG)
@@ -961,7 +4153,11 @@ static inline __attribute__((always_inline)) void handle_dirent(
 			 	curdir->filecnt++;
 		} else if (modtimecheck(st.st_mtime)
 			   && uidgidcheck(st.st_uid, st.st_gid)
-			   && sizecheck(st.st_size)) {
+			   && sizecheck(st.st_size)
+#		      if ! defined(__MINGW32__)
+			   && (! grep_pattern || grep_match(curdir->tdata, path, &st)) // - last, as it reads the file
+#		      endif
+			   ) {
 #		      if defined(__CYGWIN__)
 			if (summarize_diskusage && st.st_blocks) {
 				curdir->du += st.st_blocks * 2;
@@ -972,78 +4168,380 @@ static inline __attribute__((always_inline)) void handle_dirent(
 			}
 #		      else
 			if (summarize_diskusage && st.st_size) {
-				if (st.st_nlink == 1 || (st.st_nlink > 1 && ! is_in_ino_dev_hashtable(&st))) {
+				if (st.st_nlink == 1 || estimate || (st.st_nlink > 1 && ! is_in_ino_dev_hashtable(&st))) {
 					if (st.st_size < TWO_TB)
 						curdir->du += st.st_blocks;
 					else
 						curdir->du += st.st_size / 512ULL;
-					if (st.st_nlink > 1 && ! dive_into_subdir)
+					if (st.st_nlink > 1 && ! dive_into_subdir && ! estimate)
 						add_to_ino_dev_hashtable(&st);
 				}
 			}
+#		      endif
+			if (rollup)
+				tally_add_stat(&curdir->own, &st);
+			if (histogram && ! lstaterror)
+				hist_add(curdir->tdata->hist, &st);
+#		      if ! defined(__MINGW32__)
+			if (owners && ! lstaterror) {
+				owner_add(curdir->tdata->uids, st.st_uid, &st);
+				owner_add(curdir->tdata->gids, st.st_gid, &st);
+			}
+#		      endif
+			if (suffixes)
+				suffix_add(curdir->tdata->suffixes, dent->d_name, suffix_bytes && ! lstaterror ? &st : NULL);
+#		      if ! defined(__MINGW32__)
+			if (dupes && ! lstaterror && S_ISREG(st.st_mode) && st.st_size > 0)
+				dupe_add(curdir->tdata->dupes, path, &st);
+#		      endif
+#		      if ! defined(__MINGW32__)
+			if (copy_root) {
+				copy_entry(path, &st);
+				if (verbose_count)
+					curdir->filecnt++;
+			} else if (manifest) {
+				if (! lstaterror && S_ISREG(st.st_mode))
+					manifest_entry(path, &st);
+				if (verbose_count)
+					curdir->filecnt++;
+			} else
 #		      endif
 			if (just_count || verbose_count)
 			 	curdir->filecnt++;
-			else if (run_cmd)
-				do_run(cmd, path);
-			else if (end_with_null)
-				printf("%s%c", path, '\0');
-			else if (modtimelist) {
-				time_t mtime = lstat_needed ? st.st_mtime : get_mtime(path);
-				char *timestr = printable_time(mtime);
-				pthread_mutex_lock(&modtimelist_lock);
-				printf("%s %s\n", timestr, path);
-				pthread_mutex_unlock(&modtimelist_lock);
-				free(timestr);
-			} else if (! inode || inode == st.st_ino)
-				puts(path);
+			else if (post_order && dive_into_subdir && ! (maxdepth && curdir->depth >= maxdepth))
+				post_match = run_cmd || ! inode || inode == st.st_ino;
+			else if (sort_key) {
+				if (! inode || inode == st.st_ino)
+					sort_add(curdir->tdata->sort, sort_key_of(&st, path), path);
+			} else if (run_cmd)
+				do_run(curdir->tdata, curdir->dirfd, dent->d_name, path, have_stat ? &st : NULL);
+			else if (binary_output) {
+				if (! inode || inode == st.st_ino)
+					output_record(curdir->tdata, path, &st, have_stat, dent->d_type);
+#		      if ! defined(__MINGW32__)
+			} else if (tar_output) {
+				tar_entry_t *tarent;
+				if (have_stat && (! inode || inode == st.st_ino) && (tarent = tar_member(curdir->tdata, path, &st))) {
+					if (ordered) {
+						ordered_idx = ordered_add(curdir->outnode, path, 0, TRUE);
+						curdir->outnode->ents[ordered_idx].tar = tarent;
+					} else
+						tar_enqueue(tarent);
+				}
+#		      endif
+			} else if (printf_fields) {
+				if (! inode || inode == st.st_ino) {
+					size_t len = printf_format(curdir->tdata, path, curdir->depth, &st);
+					if (ordered) {
+						ordered_idx = ordered_add(curdir->outnode, path, 0, TRUE);
+						curdir->outnode->ents[ordered_idx].line = line_dup(curdir->tdata, len);
+						curdir->outnode->ents[ordered_idx].linelen = len;
+					} else
+						output_line(curdir->tdata, len);
+				}
+			} else if (ordered) {
+				if (end_with_null || modtimelist || ! inode || inode == st.st_ino)
+					ordered_idx = ordered_add(curdir->outnode, path,
+						modtimelist ? (have_stat ? st.st_mtime : get_mtime(path)) : 0, TRUE);
+			} else if (end_with_null || modtimelist)
+				output_path(curdir->tdata, path, modtimelist ? (have_stat ? st.st_mtime : get_mtime(path)) : 0);
+			else if (! inode || inode == st.st_ino)
+				output_path(curdir->tdata, path, 0);
 		} else if (zerosized) {
 		 	curdir->filecnt++;
 		}
 	}
 
-	if (dive_into_subdir) {
-		if (maxdepth) {
-			if (curdir->depth >= maxdepth) {
-				free(path);
-				return;
-			}
-		}
+	if (dive_into_subdir) {
+		if (maxdepth) {
+			if (curdir->depth >= maxdepth) {
+				free(path);
+				return;
+			}
+		}
+
+		if (estimate) { // - just remember the subdir, estimate_probe() decides where to go next
+			estimate_add_subdir(curdir->tdata->est, path, curdir->depth+1, &st, exclude_trie ? curdir->child_exclude : NULL);
+			return;
+		}
+
+		if (ordered) {
+			if (ordered_idx < 0)
+				ordered_idx = ordered_add(curdir->outnode, path, 0, FALSE);
+			curdir->child_outnode = curdir->outnode->ents[ordered_idx].child = outnode_new();
+		}
+		curdir->child_post_match = post_match;
+
+		// fprintf(stderr, "%s: curdir->st_nlink = %i\n", curdir->dirpath, curdir->st_nlink);
+		if (inline_processing_threshold &&
+		    (curdir->st_nlink < inline_processing_threshold + 2 ||				// - posix compliant
+		    (simulate_posix_compliance && curdir->inlined < inline_processing_threshold))) {	// - non-compliant (btrfs)
+			// Process up to n subdirs inline, n = inline_processing_threshold.
+			curdir->inlined++;
+
+			dirlist_t subdirentry;
+			// - when tracking completion, subdirs may still be pending after walk_dir() returns, so use the heap
+			dirlist_t *subdir = track_completion ? malloc(sizeof(dirlist_t)) : &subdirentry;
+			assert(subdir);
+
+			subdir->dirpath = strdup(path);
+			assert(subdir->dirpath);
+			subdir->depth = curdir->depth+1;
+			subdir->inlined = 0;
+			subdir->st_nlink = simulate_posix_compliance ? DIRTY_CONSTANT : st.st_nlink;
+			subdir->modtime = st.st_mtime;
+			subdir->st_dev = st.st_dev;
+			subdir->filecnt = 0;
+			subdir->du = 0;
+			subdir->tdata = curdir->tdata;
+			dirlist_link_parent(subdir, curdir);
+
+			walk_dir(subdir);
+
+			if (summarize_diskusage) {
+				curdir->du += subdir->du;
+				curdir->filecnt += subdir->filecnt;
+			} else if (wc || verbose_count)
+				curdir->filecnt += subdir->filecnt;
+
+			if (track_completion)
+				dirlist_done(subdir, curdir->tdata);
+		} else {
+                        // - The first n subdirs, n <= inline_processing_threshold, will be enqueued and processed when a thread is available.
+			dirlist_add_dir(path, curdir->depth+1, &st, curdir);
+		}
+	}
+
+	free(path);
+	return;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) unsigned long long estimate_random(
+	estimate_t *est)
+{
+	est->seed ^= est->seed << 13;
+	est->seed ^= est->seed >> 7;
+	est->seed ^= est->seed << 17;
+	return est->seed;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// One probe from root down to a leaf directory, adding the weighted counts to *files and *du.
+static void estimate_probe(
+	thread_data_t *tdata,
+	dirlist_t *root,
+	double *files,
+	double *du)
+{
+	estimate_t *est = tdata->est;
+	dirlist_t dir = *root;
+	double weight = 1.0;
+
+	dir.dirpath = strdup(root->dirpath);
+	assert(dir.dirpath);
+	while (TRUE) {
+		size_t i, pick;
+
+		dir.filecnt = 0;
+		dir.du = 0;
+		dir.tdata = tdata;
+		est->subdir_count = 0;
+		walk_dir(&dir);
+		est->dirs++;
+		*files += weight * dir.filecnt;
+		*du += weight * dir.du;
+
+		if (! est->subdir_count)
+			break;
+		pick = estimate_random(est) % est->subdir_count;
+		for (i = 0; i < est->subdir_count; i++)
+			if (i != pick)
+				free(est->subdirs[i].dirpath);
+		weight *= est->subdir_count;
+		dir = est->subdirs[pick];
+		dir.depth = est->subdirs[pick].depth;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Hand out the next probe round, unless the probe count or time budget is used up.
+static boolean estimate_next()
+{
+	boolean next = TRUE;
+
+	pthread_mutex_lock(&estimate_lock);
+	if (estimate_seconds) {
+		struct timeval now;
+		(void) gettimeofday(&now, NULL);
+		if (now.tv_sec > estimate_deadline.tv_sec
+		    || (now.tv_sec == estimate_deadline.tv_sec && now.tv_usec >= estimate_deadline.tv_usec))
+			next = FALSE;
+	} else if (estimate_started >= estimate_probes)
+		next = FALSE;
+	if (next)
+		estimate_started++;
+	pthread_mutex_unlock(&estimate_lock);
+	return next;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void *estimate_routine(
+	void *arg)
+{
+	thread_data_t *tdata = arg;
+	estimate_t *est = tdata->est;
+
+	while (estimate_next()) {
+		double files = 0, du = 0;
+		unsigned i;
+		for (i = 0; i < estimate_rootcount; i++) // - one probe per start dir makes up one sample
+			estimate_probe(tdata, &estimate_roots[i], &files, &du);
+		est->probes++;
+		est->files += files;
+		est->files2 += files * files;
+		est->du += du;
+		est->du2 += du * du;
+	}
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
 
-		// fprintf(stderr, "%s: curdir->st_nlink = %i\n", curdir->dirpath, curdir->st_nlink);
-		if (inline_processing_threshold &&
-		    (curdir->st_nlink < inline_processing_threshold + 2 ||				// - posix compliant
-		    (simulate_posix_compliance && curdir->inlined < inline_processing_threshold))) {	// - non-compliant (btrfs)
-			// Process up to n subdirs inline, n = inline_processing_threshold.
-			curdir->inlined++;
+static double square_root( // - to avoid linking with libm just for this
+	double x)
+{
+	double r = x > 1.0 ? x : 1.0;
+	int i;
+
+	if (x <= 0.0)
+		return 0.0;
+	for (i = 0; i < 200 && r * r - x > x * 1e-12; i++)
+		r = (r + x / r) / 2.0;
+	return r;
+}
 
-			dirlist_t subdirentry;
+/////////////////////////////////////////////////////////////////////////////
 
-			subdirentry.dirpath = strdup(path);
-			assert(subdirentry.dirpath);
-			subdirentry.depth = curdir->depth+1;
-			subdirentry.inlined = 0;
-			subdirentry.st_nlink = simulate_posix_compliance ? DIRTY_CONSTANT : st.st_nlink;
-			subdirentry.modtime = st.st_mtime;
-			subdirentry.st_dev = st.st_dev;
-			subdirentry.filecnt = 0;
-			subdirentry.du = 0;
+static void estimate_print_blocks( // - same units as option -H
+	double blocks)
+{
+	double KiB = blocks / 2.0;
+
+	if (KiB < 1024)
+		printf("%-.1lFK", KiB);
+	else if (KiB < 1024 * 1024)
+		printf("%-.1lFM", KiB/1024);
+	else if (KiB < 1024 * 1024 * 1024)
+		printf("%-.1lFG", KiB/1024/1024);
+	else
+		printf("%-.1lFT", KiB/1024/1024/1024);
+}
 
-			walk_dir(&subdirentry);
+/////////////////////////////////////////////////////////////////////////////
 
-			if (summarize_diskusage) {
-				curdir->du += subdirentry.du;
-				curdir->filecnt += subdirentry.filecnt;
-			} else if (wc || verbose_count)
-				curdir->filecnt += subdirentry.filecnt;
-		} else {
-                        // - The first n subdirs, n <= inline_processing_threshold, will be enqueued and processed when a thread is available.
-			dirlist_add_dir(path, curdir->depth+1, &st);
+// Run the probes with one thread per thread_data entry, and print out the estimates with 95% confidence intervals.
+static void estimate_trees(
+	char **dirpaths,
+	int dirpathcount)
+{
+	pthread_t *tids = malloc(thread_cnt * sizeof(pthread_t));
+	struct stat st;
+	double n = 0, files = 0, files2 = 0, du = 0, du2 = 0, dirs = 0;
+	double files_ci = 0, du_ci = 0;
+	unsigned i;
+
+	assert(tids);
+	estimate_roots = calloc(dirpathcount, sizeof(dirlist_t));
+	assert(estimate_roots);
+	for (i = 0; i < (unsigned) dirpathcount; i++) {
+		dirlist_t *root = &estimate_roots[estimate_rootcount];
+		char *rightmost;
+
+		if (stat(dirpaths[i], &st) < 0 || ! S_ISDIR(st.st_mode)) {
+			errno = S_ISDIR(st.st_mode) ? errno : ENOTDIR;
+			fprintf(stderr, "%s: ", progname);
+			perror(dirpaths[i]);
+			continue;
 		}
+		if (st.st_nlink < 2) // - assumed to be the case for btrfs, fuse, ntfs, fat
+			simulate_posix_compliance = TRUE;
+		rightmost = dirpaths[i] + strlen(dirpaths[i]) - 1;
+		while (*rightmost == '/' && rightmost != dirpaths[i])
+			*rightmost-- = '\0';
+		root->dirpath = dirpaths[i];
+		root->depth = 1;
+		root->exclude = exclude_trie ? exclude_path_node(root->dirpath) : NULL;
+		root->st_nlink = simulate_posix_compliance ? DIRTY_CONSTANT : st.st_nlink;
+		root->modtime = st.st_mtime;
+		root->st_dev = st.st_dev;
+		estimate_rootcount++;
 	}
 
-	free(path);
-	return;
+	if (estimate_seconds) {
+		(void) gettimeofday(&estimate_deadline, NULL);
+		estimate_deadline.tv_sec += estimate_seconds;
+	}
+	for (i = 0; i < thread_cnt; i++) {
+		thread_data[i].est->seed = (unsigned long long) time(NULL) * 2654435761ULL + i + 1;
+		if (pthread_create(&tids[i], NULL, estimate_routine, &thread_data[i])) {
+			fprintf(stderr, "%s: ", progname);
+			perror("pthread_create()");
+			exit(1);
+		}
+	}
+	for (i = 0; i < thread_cnt; i++) {
+		estimate_t *est = thread_data[i].est;
+		pthread_join(tids[i], NULL);
+		n += est->probes;
+		dirs += est->dirs;
+		files += est->files;
+		files2 += est->files2;
+		du += est->du;
+		du2 += est->du2;
+		free(est->subdirs);
+		free(est);
+	}
+	free(tids);
+	free(estimate_roots);
+
+	if (n > 1) { // - half width of the 95% confidence interval, i.e. 1.96 standard errors of the mean
+		files_ci = 1.96 * square_root((files2 - files * files / n) / (n - 1) / n);
+		du_ci = 1.96 * square_root((du2 - du * du / n) / (n - 1) / n);
+	}
+	if (n > 0) {
+		files /= n;
+		du /= n;
+	}
+
+	printf("Files:      %.0f +/- %.0f\n", accum_filecnt + files, files_ci);
+	printf("Disk usage: ");
+	estimate_print_blocks(du);
+	printf(" +/- ");
+	estimate_print_blocks(du_ci);
+	printf("\n");
+	printf("Probes:     %.0f, reading %.0f directories (95%% confidence intervals)\n", n, dirs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Add a pattern of option -N or --name-list.  The first one is also kept in lower case as fast_match_arg.
+static void fast_match_add(
+	const char *pattern)
+{
+	fast_match_list = realloc(fast_match_list, (fast_match_count + 1) * sizeof(char *));
+	assert(fast_match_list);
+	fast_match_list[fast_match_count] = strdup(pattern);
+	assert(fast_match_list[fast_match_count]);
+	if (! fast_match_count++) {
+		fast_match_arg = strdup(pattern);
+		str_to_lc(fast_match_arg);
+	}
+	fast_match_opt = TRUE;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1056,6 +4554,19 @@ static int usage()
 	printf("\t    [-o <days> | -O <minutes> | -P <tstamp-file>] [-y <days> | -Y <minutes> | -W <tstamp-file>]\n");
 	printf("\t    [-s [+|-]<size>[k|m|g|t] | +<size>[k|m|g|t]:-<size>[k|m|g|t]]\n");
 	printf("\t    [-D <count> | -F <count> | -M <count> | -A <count> | -L <count> | -B <count>]\n");
+	printf("\t    [--rollup=<depth>[,<count>]]\n");
+	printf("\t    [--histogram[=csv]]\n");
+	printf("\t    [--suffixes[=<count>][,bytes]]\n");
+	printf("\t    [--estimate[=<probes>|<seconds>s]]\n");
+	printf("\t    [--sort=[-]size|mtime|atime|path[,<MiB>]]\n");
+	printf("\t    [--ordered]\n");
+	printf("\t    [--printf=<format>]\n");
+	printf("\t    [--binary]\n");
+	printf("\t    [--jobs=<count>]\n");
+	printf("\t    [--post-order]\n");
+	printf("\t    [--queue=<count>]\n");
+	printf("\t    [--name-list=<file>] [--show-match]\n");
+	printf("\t    [--glob=[!]<pattern> ...]\n");
 	printf("\t    [-I <count>] [-q | -Q] [-C] [-S] [-T] [-V] [-h] [arg1 [arg2] ...]\n\n");
 #else
 	printf("Usage: %s [-t <count>|*] [[-n|-i [!]<re1|re2|...> | -N [!]<name>] [-a]] [-e <dir> ... | -E <dir> ... | -Z]\n", progname);
@@ -1066,6 +4577,25 @@ static int usage()
 	printf("\t    [-o <days> | -O <minutes> | -P <tstamp-file>] [-y <days> | -Y <minutes>] | -W <tstamp-file>]\n");
 	printf("\t    [-s [+|-]<size>[k|m|g|t] | +<size>[k|m|g|t]:-<size>[k|m|g|t]]\n");
 	printf("\t    [-D <count> | -F <count> | -M <count> | -A <count> | -L <count> | -B <count> | -R <count>]\n");
+	printf("\t    [--rollup=<depth>[,<count>]]\n");
+	printf("\t    [--histogram[=csv]]\n");
+	printf("\t    [--owners[=<count>]]\n");
+	printf("\t    [--suffixes[=<count>][,bytes]]\n");
+	printf("\t    [--estimate[=<probes>|<seconds>s]]\n");
+	printf("\t    [--sort=[-]size|mtime|atime|path[,<MiB>]]\n");
+	printf("\t    [--ordered]\n");
+	printf("\t    [--printf=<format>]\n");
+	printf("\t    [--binary]\n");
+	printf("\t    [--jobs=<count>]\n");
+	printf("\t    [--post-order]\n");
+	printf("\t    [--queue=<count>]\n");
+	printf("\t    [--copy=<dir>]\n");
+	printf("\t    [--tar]\n");
+	printf("\t    [--dupes[=<count>]]\n");
+	printf("\t    [--manifest[=<old manifest>] | --verify=<manifest>[,quick]]\n");
+	printf("\t    [--grep=<string> | --grep-re=<re>] [--grep-lines] [--grep-max=<size>[k|m|g|t]]\n");
+	printf("\t    [--name-list=<file>] [--show-match]\n");
+	printf("\t    [--glob=[!]<pattern> ...]\n");
 	printf("\t    [-I <count>] [-q | -Q] [-X] [-C] [-S] [-T] [-V] [-h] [arg1 [arg2] ...]\n\n");
 #endif
 	printf("-t <count>|*\t Run up to <count> or '*' threads in parallel.\n");
@@ -1081,6 +4611,8 @@ static int usage()
 	printf("\t\t * Extended regular expressions (REG_EXTENDED) are supported.\n");
 	printf("\t\t * For an exact match, '^filename$' can be specified (\"^filename$\" on Windows).\n");
 	printf("\t\t * To search for files containing a dot, '\\.' or \\\\. can be specified (\"\\.\" on Windows).\n");
+	printf("\t\t * Expressions that are only literals, like '^core$' or '\\.c$|\\.h$', are matched by string compares alone,\n");
+	printf("\t\t   and names lacking a literal that every match must contain are skipped before the regular expression is run.\n");
 	printf("\t\t * Also consider option -N <name> which gives better performance, especially on large directory structures.\n");
 	printf("\t\t * Only one -n option is supported.\n\n");
 
@@ -1092,20 +4624,25 @@ static int usage()
 	printf("\t\t * Use '!' to negate, i.e. search for file names NOT matching shell pattern *name*.\n");
 	printf("\t\t * This is usually much faster than -n/-i when searching through millions of files.\n");
 	printf("\t\t * This option is implemented to be simple and portable, and supports pure ASCII characters only.\n");
+	printf("\t\t * On x86-64, names are compared 16 or 32 bytes at a time with SSE2 or AVX2, whichever the CPU supports.\n");
 	printf("\t\t * Option -N is default if -n/-i is not given.\n");
 	printf("\t\t * If both option -N and -n/-i are given, -n or -i is silently ignored.\n");
-	printf("\t\t * Only one -N option is supported.\n\n");
+	printf("\t\t * Any number of -N options may be given, to search for names matching any of them, all at once by an\n");
+	printf("\t\t   Aho-Corasick automaton.  '!' is only supported for a single one.  See also --name-list and --show-match.\n\n");
 
         printf("-a\t\t Together with option -n/-i/-N, match <re> or <name> against all of the directory elements\n");
 	printf("\t\t in the tree structure being traversed, treating '/' as an ordinary character, like locate(1).\n\n");
 
 	printf("-e <dir>\t Exclude directories matching <dir> from traversal.\n");
 	printf("\t\t * Extended regular expressions are supported.\n");
-	printf("\t\t * Any number of -e options are supported, up to command line limit.\n\n");
+	printf("\t\t * Any number of -e options are supported, up to command line limit.\n");
+	printf("\t\t * Several -e patterns are joined by | into one expression, unless one has a back reference.\n\n");
 
 	printf("-E <dir>\t Exclude directory <dir> from traversal.\n");
 	printf("\t\t * For simplicity, only exact matches are excluded with this option.\n");
-	printf("\t\t * Any number of -E options are supported, up to command line limit.\n");
+	printf("\t\t * Any number of -E options are supported, up to command line limit, and looked up all at once.\n");
+	printf("\t\t * A <dir> containing a '/' is a path, e.g. -E /home/joe/tmp, and only that directory is excluded.\n");
+	printf("\t\t   It must start the same way as the start directory it is in: /home or /home/joe in the example.\n");
 	printf("\t\t * Hint: Excluding .snapshot is usually desired on (the root of) NFS shares from NAS\n");
 	printf("\t\t         where visible snapshots are enabled.\n\n");
 
@@ -1163,14 +4700,21 @@ static int usage()
 
         printf("-r <cmd>\t For each matched file/directory, execute the shell command <cmd>.\n");
 	printf("\t\t * If <cmd> contains a space, it must be escaped by a '\\', or <cmd> must be enclosed by single or double quotes.\n");
-	printf("\t\t * A character pair `{}' within <cmd>, is replaced by the current file path.\n");
-	printf("\t\t * Note that just up to 2 occurences of the `{}' pair are replaced by the file path.\n");
-	printf("\t\t * If more than 2 are needed, a variable f=`{}' can be introduced for one of the two pairs.\n");
+	printf("\t\t * Every character pair `{}' within <cmd>, is replaced by the current file path.\n");
 	printf("\t\t * If no `{}' pair is found in <cmd>, the file path is appended at the end of <cmd>, enclosed by single quotes.\n");
 	printf("\t\t * Using quotes around a brace pair is recommended, so that file names containing spaces are correctly handled.\n");
 	printf("\t\t * If file path is not needed at the end of <cmd>, adding ' #' or ';:' to <cmd>, makes it invisible.\n");
-	printf("\t\t * This option may be CPU intensive as it creates a new process for each file/directory matched,\n");
-	printf("\t\t   by default using 8 threads in parallel, or less if there are fewer cores.\n\n");
+	printf("\t\t * If <cmd> ends with `{} +', as many file paths as the system allows (ARG_MAX) are passed to each command,\n");
+	printf("\t\t   like find -exec ... {} +.  No other `{}' pair may be used then.\n");
+	printf("\t\t * A <cmd> without pipes, redirections, variables, wildcards or other shell syntax, is started directly\n");
+	printf("\t\t   with posix_spawn(), after removing quotes like the shell does.  Otherwise it is run by /bin/sh -c.\n");
+	printf("\t\t * Unless `{} +' is used, this option may be CPU intensive as it creates a new process for each file/directory\n");
+	printf("\t\t   matched, by default using 8 threads in parallel, or less if there are fewer cores.  See also --jobs.\n");
+	printf("\t\t * These commands, without other options, are run in-process by the threads using directory relative system\n");
+	printf("\t\t   calls: rm, rm -f, unlink, rmdir, chmod <mode>, chown [-h] <user>[:<group>], chgrp [-h] <group>, touch,\n");
+	printf("\t\t   truncate -s <size> and mv -t <dir> or mv {} <dir>.  Like the commands, all but rm, rmdir, mv and chown -h\n");
+	printf("\t\t   act on the target of a symbolic link; a link to a missing file is left to the command, e.g. touch\n");
+	printf("\t\t   creates the target.  Use -S to see how many entries failed.\n\n");
 
         printf("-v <count>\t Print out a progress line after every <count> files have been processed.\n\n");
 
@@ -1255,6 +4799,195 @@ static int usage()
 	printf("-V\t\t Print out version and exit.\n");
 	printf("-h\t\t Print this help text.\n");
 
+	printf("\nLong options are given as --<name> or --<name>=<value> (no space around '='):\n\n");
+	printf("--rollup=<depth>[,<count>]\n");
+	printf("\t\t Print out the number of files, the allocated bytes and the newest/oldest modification time for\n");
+	printf("\t\t every directory down to <depth> levels below the start point(s), each summing up everything below it.\n");
+	printf("\t\t * Output columns are bytes, files, newest mtime, oldest mtime and path, sorted on path.\n");
+	printf("\t\t * If <count> is given, just the <count> directories with most bytes are printed, biggest first.\n");
+	printf("\t\t * Everything is counted in one parallel pass, also for subdirectories handled by other threads.\n");
+	printf("\t\t * May be combined with the name, type, age, owner and size options to count only matching files.\n");
+	printf("\t\t * Hard linked files are counted once per link.\n");
+
+	printf("\n--histogram[=csv]\n");
+	printf("\t\t Print out histograms of file sizes (power of two buckets) and of modification and access time age\n");
+	printf("\t\t (1 hour, 1 day, 1 week, 30/90/180 days, 1/2/3/5/10 years), split on regular files, directories, symlinks\n");
+	printf("\t\t and other types, with the allocated bytes per bucket.\n");
+	printf("\t\t * All three histograms are built in one parallel pass, using per-thread counters.\n");
+	printf("\t\t * With =csv, the output is comma separated: histogram,bucket,regular,directory,symlink,other,total,bytes\n");
+	printf("\t\t   where bucket is the lower limit in bytes or seconds of age (-1 means in the future).\n");
+	printf("\t\t * May be combined with the name, type, age, owner and size options to count only matching files.\n");
+#if ! defined(__MINGW32__)
+	printf("\n--owners[=<count>]\n");
+	printf("\t\t Print out the allocated bytes, the number of files and the newest modification time for each user and each group\n");
+	printf("\t\t owning files in the selected tree structure(s), biggest first.\n");
+	printf("\t\t * Output columns are bytes, files, newest mtime and user:<name> or group:<name> (uid/gid if no name is found).\n");
+	printf("\t\t * If <count> is given, just the <count> biggest users and the <count> biggest groups are printed.\n");
+	printf("\t\t * Everything is counted in one parallel pass, using per-thread tables that are merged at the end.\n");
+	printf("\t\t * May be combined with the name, type, age, owner and size options to count only matching files.\n");
+	printf("\t\t * Not implemented for Windows.\n");
+#endif
+	printf("\n--suffixes[=<count>][,bytes]\n");
+	printf("\t\t Print out the number of files for each file name suffix (the part after the last '.'), most common first.\n");
+	printf("\t\t * Output columns are bytes, files and suffix. Names without a suffix, or with a suffix longer than 16\n");
+	printf("\t\t   characters, are counted as (none).\n");
+	printf("\t\t * The allocated bytes are only summed up if another option already requires lstat(2) on every entry,\n");
+	printf("\t\t   otherwise the bytes column is '-' and no extra system calls are done.\n");
+	printf("\t\t * If <count> is given, just the <count> most common suffixes are printed.\n");
+	printf("\t\t * With ,bytes the suffixes are sorted on bytes instead, which implies an lstat(2) on every entry.\n");
+	printf("\t\t * May be combined with the name, type, age, owner and size options to count only matching files.\n");
+	printf("\n--estimate[=<probes>|<seconds>s]\n");
+	printf("\t\t Print out an estimate of the number of files/directories (like -w) and of the disk usage (like -H),\n");
+	printf("\t\t with 95%% confidence intervals, without traversing the whole tree.\n");
+	printf("\t\t * Each probe reads one directory per level, from the start point(s) down to a leaf directory,\n");
+	printf("\t\t   picking a random subdirectory at each level (Knuth's estimator).  The probes run in parallel.\n");
+	printf("\t\t * Defaults to 1000 probes. <probes> sets another count, <seconds>s runs as many probes as possible\n");
+	printf("\t\t   within the given time instead.\n");
+	printf("\t\t * Trees with a few huge subtrees need more probes for a tight interval.\n");
+	printf("\t\t * The name, type, age, owner, size, depth, exclude and -x options are honoured like for -w and -H.\n");
+	printf("\n--sort=[-]size|mtime|atime|path[,<MiB>]\n");
+	printf("\t\t Print out all matched files/directories sorted on size, modification time, access time or path,\n");
+	printf("\t\t in ascending order, or descending order if the key is prefixed with '-'.\n");
+	printf("\t\t * Like -F, -M and -A, but without a count limit: sizes and times are printed in front of the path,\n");
+	printf("\t\t   just the path is printed when sorting on path (modtime and path with -j, just the path with -0).\n");
+	printf("\t\t * Ties, and paths, are sorted bytewise, which equals `LC_ALL=C sort'.\n");
+	printf("\t\t * Each thread keeps its matches in memory, up to its share of <MiB> (default 256) for all threads,\n");
+	printf("\t\t   then sorts them and spills them to a temporary file.  All sorted runs are merged at the end.\n");
+	printf("\n--ordered\n");
+	printf("\t\t Print out the matched files/directories in a deterministic order: the entries of each directory sorted\n");
+	printf("\t\t bytewise on name, each subdirectory followed by its own entries (pre-order), start points in given order.\n");
+	printf("\t\t * Two runs on the same tree give identical output, suitable for diff(1), without sorting all lines.\n");
+	printf("\t\t * The directories are still read in parallel.  A single thread prints each directory as soon as it and\n");
+	printf("\t\t   all directories before it are done, so directories finishing early are kept in memory until their turn.\n");
+	printf("\t\t * May be combined with -j, -0 and -z.\n");
+	printf("\n--printf=<format>\n");
+	printf("\t\t Print out each matched file/directory according to <format>, like find -printf.  Directives are\n");
+	printf("\t\t %%p path, %%f name, %%h parent directory, %%d depth, %%s size, %%b 512-byte blocks, %%k KiB blocks,\n");
+	printf("\t\t %%m octal permissions, %%M symbolic permissions, %%n links, %%i inode, %%u/%%U user name/uid,\n");
+	printf("\t\t %%g/%%G group name/gid, %%y type (f, d, l, b, c, p, s), %%l symbolic link target, %%t/%%a/%%c\n");
+	printf("\t\t modification/access/change time as 'yyyy-mm-dd hh:mm:ss', %%T modification time in seconds since the\n");
+	printf("\t\t epoch and %%%% a percent sign; a width like %%10s or %%-8u pads the field.  Escapes are \\n, \\t, \\r, \\0\n");
+	printf("\t\t and \\\\.  No newline is added.\n");
+	printf("\t\t * Uses the lstat() data already fetched for matching, so there is at most one lstat() per entry, and\n");
+	printf("\t\t   none if only %%p, %%f, %%h and %%d are used.  User and group names are cached per thread.\n");
+	printf("\t\t * May be combined with --ordered; not with -j, -0, -z, -r, --sort or the report options.\n");
+	printf("\n--binary\n");
+	printf("\t\t Write a binary record for each matched file/directory instead of its name: path, type, inode, size,\n");
+	printf("\t\t blocks, mtime, atime, uid, gid and mode, taken from the lstat() done while matching.  Standard output\n");
+	printf("\t\t must be a file or a pipe.  The format is described in srchrec.h, which also has a small reader, and\n");
+	printf("\t\t srchdump prints the records as text.\n");
+	printf("\t\t * Records are in no particular order, and in the byte order of the machine running srch.\n");
+	printf("\t\t * Can not be combined with -j, -0, -z, -r, the report options or other long options.\n");
+	printf("\n--jobs=<count>\n");
+	printf("\t\t Run at most <count> commands of option -r at a time.  The commands are started by a pool of <count>\n");
+	printf("\t\t executor threads, separate from the traversal threads, which go on reading directories while the commands\n");
+	printf("\t\t run.  By default there is one executor per thread.  With --post-order, the traversal threads run the\n");
+	printf("\t\t commands themselves.  With --copy, the executor threads copy the chunks of large files, and with --dupes,\n");
+	printf("\t\t --manifest and --verify they hash the files.\n");
+	printf("\n--post-order\n");
+	printf("\t\t Print out or run the -r command for a matched directory only after everything below it is done,\n");
+	printf("\t\t like find -depth, while the directories are still read in parallel.\n");
+	printf("\t\t * With -z, a directory containing nothing but such empty directories matches as well, so\n");
+	printf("\t\t   'srch -z --post-order -r rmdir <dir>' removes a whole tree of empty directories in one pass.\n");
+	printf("\t\t * Output is not buffered, and `{} +' runs one command per entry, to keep children before parents.\n");
+	printf("\t\t * May be combined with -j, -0, -z and -r; not with --ordered, --sort, --printf, --binary or the report options.\n");
+	printf("\n--queue=<count>\n");
+	printf("\t\t Let at most <count> commands of option -r, or chunks or files to hash of the other options using the\n");
+	printf("\t\t executor threads, wait for one.  Traversal pauses while the queue is full.  Defaults to 1024, 2 per\n");
+	printf("\t\t executor with `{} +' and 4 with --copy.\n");
+	printf("\t\t * -S shows how long traversal waited for room, and mean, percentiles and maximum of the time commands spent\n");
+	printf("\t\t   in the queue and running.  Percentiles are rounded up to a power of two microseconds.\n");
+#if ! defined(__MINGW32__)
+	printf("\n--copy=<dir>\n");
+	printf("\t\t Copy the matched files, directories and symbolic links to below <dir>, which is created if needed,\n");
+	printf("\t\t with their paths as listed, without `.' components and with each `..' taking away the directory before\n");
+	printf("\t\t it, if any, so that nothing lands outside <dir>.  Missing directories above them are created, and modes\n");
+	printf("\t\t and modification/access times are preserved, also of matched directories.\n");
+	printf("\t\t * The threads copy the files while traversing, with copy_file_range() where the system supports it.\n");
+	printf("\t\t   Files larger than 128 MiB are split in 64 MiB chunks, copied in parallel by the executor threads of\n");
+	printf("\t\t   --jobs, so a few large files do not leave the other threads idle.\n");
+	printf("\t\t * Ownership is not preserved, hard links are copied as separate files, and other file types are skipped.\n");
+	printf("\t\t * -v <count> reports the MiB copied as well.  -S shows the number of entries and bytes copied.\n");
+	printf("\t\t * Not to be used with <dir> inside the tree being copied.\n");
+#endif
+#if ! defined(__MINGW32__)
+	printf("\n--tar\n");
+	printf("\t\t Write a tar archive (POSIX ustar, with pax headers for long names, large sizes and ids) of the matched\n");
+	printf("\t\t files, directories, symbolic links and devices to standard output, which must be a file or a pipe.\n");
+	printf("\t\t Member names are the paths as listed, without leading `/' and `../'.\n");
+	printf("\t\t * The headers are made from the lstat() data already fetched for matching.  The threads read files of up\n");
+	printf("\t\t   to 1 MiB into a queue of at most 64 MiB while traversing; a single writer thread writes the members and\n");
+	printf("\t\t   reads larger files itself.  -S shows how many members were read ahead and how long traversal waited.\n");
+	printf("\t\t * Members are in no particular order, so GNU tar needs --delay-directory-restore to restore the\n");
+	printf("\t\t   modification times of directories.  With --ordered the archive is written in deterministic pre-order.\n");
+	printf("\t\t * Hard links are stored as separate files, and sockets are skipped.\n");
+	printf("\t\t * Can not be combined with -j, -0, -z, -r, the report options or other long options than --ordered.\n");
+#endif
+#if ! defined(__MINGW32__)
+	printf("\n--dupes[=<count>]\n");
+	printf("\t\t Print out the groups of regular files with identical content, the groups with the most bytes to reclaim\n");
+	printf("\t\t first, followed by the total number of bytes and files that could be reclaimed.\n");
+	printf("\t\t * Output columns are size, group number and path, and for the last line bytes, files and (reclaimable).\n");
+	printf("\t\t * If <count> is given, just the <count> groups with the most bytes to reclaim are printed.\n");
+	printf("\t\t * The threads collect the sizes while traversing.  Only files sharing their size with another file are read:\n");
+	printf("\t\t   first 4 KiB at the head and at the tail, and then the whole content of those still alike, hashed by\n");
+	printf("\t\t   the executor threads of --jobs with 64-bit XXH64.  Empty files are not considered.\n");
+	printf("\t\t * Hard links to a file already seen are not duplicates, and are skipped.  -S shows how many.\n");
+	printf("\t\t * May be combined with the name, type, age, owner and size options to consider only matching files.\n");
+#endif
+#if ! defined(__MINGW32__)
+	printf("\n--manifest[=<old manifest>]\n");
+	printf("\t\t Write a manifest of the matched regular files: a header line, then one line per file with its SHA-256\n");
+	printf("\t\t in hex, size, modification time as seconds.nanoseconds since the epoch, and path, with `\\' and newline\n");
+	printf("\t\t escaped as `\\\\' and `\\n'.  Files are in no particular order.\n");
+	printf("\t\t * The files are hashed by the executor threads of --jobs while traversal goes on.  Files larger than 64 MiB\n");
+	printf("\t\t   are hashed in 64 MiB chunks in parallel, and get the SHA-256 of the SHA-256 of each chunk instead, so\n");
+	printf("\t\t   only the hashes of smaller files equal those of sha256sum(1).\n");
+	printf("\t\t * With <old manifest>, files with the same path, size and modification time as there are not read again.\n");
+	printf("\t\t * Can not be combined with -w, -H, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R or other long options than\n");
+	printf("\t\t   --jobs and --queue.\n");
+	printf("\n--verify=<manifest>[,quick]\n");
+	printf("\t\t Check the files of a manifest written by --manifest, in parallel by the executor threads of --jobs, and\n");
+	printf("\t\t print out `FAILED <path>' for each file that is changed and `MISSING <path>' for each file that is gone.\n");
+	printf("\t\t The exit status is 1 if any file did not verify.  No directory is traversed.\n");
+	printf("\t\t * With ,quick, files with the same size and modification time as in the manifest are not read.\n");
+	printf("\t\t * -S shows how many files were hashed and how many passed unchanged.\n");
+#endif
+#if ! defined(__MINGW32__)
+	printf("\n--grep=<string>\n");
+	printf("\t\t Print out only the regular files containing <string>.  The content is checked last, after the name,\n");
+	printf("\t\t type, age, owner and size options, so only files matching those are read.\n");
+	printf("\t\t * Files with a NUL byte among the first 32 KiB are binary, and are skipped.\n");
+	printf("\t\t * The files are read by the traversing threads in blocks of 1 MiB, and the search stops at the first match.\n");
+	printf("\t\t * Can not be combined with -d, -l, -b, -c, -p, -k, -z, -D, -R, --estimate or --verify.\n");
+	printf("\n--grep-re=<re>\n");
+	printf("\t\t Same as --grep, but search for lines matching extended regular expression <re>.\n");
+	printf("\n--grep-lines\n");
+	printf("\t\t Together with --grep or --grep-re, print out each matching line as <path>:<line number>:<line>, like\n");
+	printf("\t\t grep -rn, instead of the path only.\n");
+	printf("\t\t * Can not be combined with -w, -H, -v, -r, -j, -0, -F, -M, -A, -L, -B or other long options than --grep-max.\n");
+	printf("\n--grep-max=<size>[k|m|g|t]\n");
+	printf("\t\t Together with --grep or --grep-re, skip files larger than <size> bytes, KiB, MiB, GiB or TiB.\n");
+	printf("\t\t * -S shows how many files were read, and how many were skipped as binary or too large.\n");
+#endif
+	printf("\n--name-list=<file>\n");
+	printf("\t\t Add the lines of <file>, or of standard input for -, as -N patterns.  Empty lines are skipped.\n");
+	printf("\t\t * Meant for long lists, like known bad file names; the names are matched all at once, so each name\n");
+	printf("\t\t   found is scanned only once, however many patterns there are.  -S shows the size of the automaton.\n");
+	printf("\n--show-match\n");
+	printf("\t\t Print out each path followed by a tab and the -N pattern it matched.\n");
+	printf("\t\t * Can not be combined with '!', -w, -H, -v, -r, -D, -F, -M, -A, -L, -B, -R or other long options than\n");
+	printf("\t\t   --name-list and --grep.\n");
+	printf("\n--glob=[!]<pattern>\n");
+	printf("\t\t Search for file names matching shell pattern <pattern> as a whole, with *, ?, [...] and \\ as in sh(1) and\n");
+	printf("\t\t fnmatch(3), and case sensitive, like find -name.  Quote the pattern to keep the shell from expanding it.\n");
+	printf("\t\t * Use '!' to negate, i.e. search for file names NOT matching <pattern>.\n");
+	printf("\t\t * Any number of --glob options may be given, to search for names matching any of them.  '!' is only\n");
+	printf("\t\t   supported for a single one.\n");
+	printf("\t\t * Each pattern is compiled once: a literal with * only at the start and/or the end becomes a string\n");
+	printf("\t\t   compare, the rest a small DFA.  -S shows which.  [[:alpha:]] and the like are not supported.\n");
+	printf("\t\t * Together with -a, match against the whole path, where * and ? also match '/'.\n");
+	printf("\t\t * Can not be combined with -n, -i, -N, --name-list or --show-match.\n");
 	printf("\n* If no argument is specified, current directory (.) will be traversed, and all file and directory names found,\n");
 	printf("  will be printed in no particular order.\n\n");
 	printf("* If one argument (arg1) is specified, and this is a directory or a symlink to a directory, it will be traversed,\n");
@@ -1307,11 +5040,12 @@ int main(
 {
 	char **startdirs;
 	unsigned startdircount;
-	int ch, i;
+	int ch, i, globerr;
 	char *dash;
 	struct stat st;
 	boolean stats = FALSE;
 	boolean e_option = FALSE, E_option = FALSE;
+	char *value;		// - argument to a long option, i.e. what follows '='
 	struct timeval starttime;
 	boolean timer = FALSE;
 	unsigned threads, cpu_cnt = 1;
@@ -1339,10 +5073,10 @@ int main(
 	tzset(); // - core dumps on Ubuntu 16.04.6 LTS with kernel 4.4.0-174-generic when executed through localtime() at the end of main()
 
 #    if defined(__MINGW32__)
-	while ((ch = getopt(argc, argv, "ht:I:e:E:n:N:i:afdCm:wv:r:D:F:M:A:L:B:R:o:O:P:y:Y:W:xzju:U:0qQs:STVH")) != -1)
+	while ((ch = getopt(argc, argv, "ht:I:e:E:n:N:i:afdCm:wv:r:D:F:M:A:L:B:R:o:O:P:y:Y:W:xzju:U:0qQs:STVH-:")) != -1)
 #    else
 	setlocale(LC_ALL, "");
-	while ((ch = getopt(argc, argv, "ht:I:e:E:n:N:i:afdlbcpkCm:wr:v:D:F:M:A:L:B:R:o:O:P:y:Y:W:xzZjJ:u:U:g:G:0qQs:STVXH")) != -1)
+	while ((ch = getopt(argc, argv, "ht:I:e:E:n:N:i:afdlbcpkCm:wr:v:D:F:M:A:L:B:R:o:O:P:y:Y:W:xzZjJ:u:U:g:G:0qQs:STVXH-:")) != -1)
 #    endif
 	switch (ch) {
 		case 't':
@@ -1404,8 +5138,12 @@ int main(
 				}
 			}
 
-			if (! regex_init(&regexcomp, optarg, REG_EXTENDED|REG_NOSUB))
+			regex_arg = optarg;
+			regex_flags = REG_EXTENDED|REG_NOSUB;
+			if (! regex_init(&regexcomp, regex_arg, regex_flags))
 				exit(1);
+			strmatch_re_free(regexpre);
+			regexpre = strmatch_re_compile(optarg, 0);
 
 			regex_opt = TRUE;
 			break;
@@ -1414,8 +5152,8 @@ int main(
 				fprintf(stderr, "Searching for empty directories in combination with a pattern is not supported.\n");
 				exit(1);
 			}
-			if (regex_opt || fast_match_opt) {
-				fprintf(stderr, "Option -N can't be specified multiple times nor combined with -n or -i.\n");
+			if (regex_opt) {
+				fprintf(stderr, "Option -N can't be combined with -n or -i.\n");
 				exit(1);
 			}
 			if (! str_is_ascii(optarg)) {
@@ -1432,9 +5170,7 @@ int main(
                                 }
                         }
 
-			fast_match_opt = TRUE;
-			fast_match_arg = strdup(optarg);
-			str_to_lc(fast_match_arg);
+			fast_match_add(optarg);
 			break;
 		case 'i':
 			if (zerosized) {
@@ -1455,8 +5191,12 @@ int main(
 				}
 			}
 
-			if (! regex_init(&regexcomp, optarg, REG_EXTENDED|REG_NOSUB|REG_ICASE))
+			regex_arg = optarg;
+			regex_flags = REG_EXTENDED|REG_NOSUB|REG_ICASE;
+			if (! regex_init(&regexcomp, regex_arg, regex_flags))
 				return usage();
+			strmatch_re_free(regexpre);
+			regexpre = strmatch_re_compile(optarg, 1);
 			regex_opt = TRUE;
 			break;
 		case 'a':
@@ -2029,12 +5769,482 @@ int main(
 			exit(1);
 #		      endif
 			break;
+		case '-': // - long options, since we have run out of letters
+			if ((value = strchr(optarg, '=')))
+				*value++ = '\0';
+			if (strcmp(optarg, "name-list") == 0) {
+				FILE *fp;
+				char line[LINE_MAX];
+				unsigned before = fast_match_count;
+				size_t len;
+				if (! value || ! *value)
+					return usage();
+				if (regex_opt || zerosized) {
+					fprintf(stderr, "Option --name-list can't be combined with -n, -i or -z.\n");
+					exit(1);
+				}
+				if (! (fp = strcmp(value, "-") == 0 ? stdin : fopen(value, "r"))) {
+					fprintf(stderr, "%s: ", progname);
+					perror(value);
+					exit(1);
+				}
+				while (fgets(line, sizeof(line), fp)) {
+					len = strlen(line);
+					while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+						line[--len] = '\0';
+					if (! len)
+						continue;
+					if (! str_is_ascii(line)) {
+						fprintf(stderr, "Only pure ASCII characters supported for option --name-list: %s\n", line);
+						exit(1);
+					}
+					fast_match_add(line);
+				}
+				if (fp != stdin)
+					fclose(fp);
+				if (fast_match_count == before) {
+					fprintf(stderr, "Option --name-list: no names found in %s.\n", value);
+					exit(1);
+				}
+			} else if (strcmp(optarg, "glob") == 0) {
+				if (! value || zerosized)
+					return usage();
+				if (*value == '!') {
+					if (globlist_count) {
+						fprintf(stderr, "Negating with '!' is only supported for a single --glob pattern.\n");
+						exit(1);
+					}
+					negate_match = TRUE;
+					value++;
+				}
+				globlist = realloc(globlist, (globlist_count + 1) * sizeof(strmatch_glob_t *));
+				assert(globlist);
+				if (! (globlist[globlist_count++] = strmatch_glob_compile(value, &globerr))) {
+					if (globerr == STRMATCH_GLOB_CLASS)
+						fprintf(stderr, "Option --glob: %s uses a [[:class:]], [[=c=]] or [[.c.]], which is not supported.\n",
+							value);
+					else if (globerr == STRMATCH_GLOB_TOOLONG)
+						fprintf(stderr, "Option --glob: %s has more than %d characters besides *.\n",
+							value, STRMATCH_GLOB_ELEMS);
+					else
+						fprintf(stderr, "Option --glob: out of memory compiling %s.\n", value);
+					exit(1);
+				}
+			} else if (strcmp(optarg, "show-match") == 0) {
+				if (value)
+					return usage();
+				show_match = TRUE;
+			} else if (strcmp(optarg, "rollup") == 0) {
+				if (! value || ! isdigit((unsigned char)*value))
+					return usage();
+				rollupdepth = atoi(value);
+				if ((value = strchr(value, ','))) {
+					if (atoi(value+1) < 1)
+						return usage();
+					cntrollup = atoi(value+1);
+				}
+				rollup = TRUE;
+				track_completion = TRUE;
+				just_count = TRUE;
+				lstat_needed = TRUE;
+			} else if (strcmp(optarg, "histogram") == 0) {
+				if (value && strcmp(value, "csv") == 0)
+					histogram_csv = TRUE;
+				else if (value)
+					return usage();
+				histogram = TRUE;
+				just_count = TRUE;
+				lstat_needed = TRUE;
+#		      if ! defined(__MINGW32__)
+			} else if (strcmp(optarg, "owners") == 0) {
+				if (value && atoi(value) < 1)
+					return usage();
+				cntowners = value ? atoi(value) : 0;
+				owners = TRUE;
+				just_count = TRUE;
+				lstat_needed = TRUE;
+#		      endif
+			} else if (strcmp(optarg, "suffixes") == 0) {
+				if (value && isdigit((unsigned char)*value)) {
+					if (atoi(value) < 1)
+						return usage();
+					cntsuffixes = atoi(value);
+					value = strchr(value, ',') ? strchr(value, ',') + 1 : NULL;
+				}
+				if (value && strcmp(value, "bytes") == 0) {
+					suffixes_by_bytes = TRUE;
+					lstat_needed = TRUE;
+				} else if (value)
+					return usage();
+				suffixes = TRUE;
+				just_count = TRUE;
+#		      if ! defined(__MINGW32__)
+			} else if (strcmp(optarg, "dupes") == 0) {
+				if (value && atoi(value) < 1)
+					return usage();
+				cntdupes = value ? atoi(value) : 0;
+				dupes = TRUE;
+				just_count = TRUE;
+				lstat_needed = TRUE;
+#		      endif
+			} else if (strcmp(optarg, "estimate") == 0) {
+				if (value) {
+					char *unit;
+					unsigned long count;
+					if (! isdigit((unsigned char)*value))
+						return usage();
+					count = strtoul(value, &unit, 10);
+					if (! count || count > UINT_MAX || (*unit && strcmp(unit, "s") != 0))
+						return usage();
+					if (*unit)
+						estimate_seconds = count;
+					else
+						estimate_probes = count;
+				}
+				estimate = TRUE;
+				summarize_diskusage = TRUE;
+				just_count = TRUE;
+				lstat_needed = TRUE;
+			} else if (strcmp(optarg, "printf") == 0) {
+				if (! value || ! *value)
+					return usage();
+				if (printf_compile(value))
+					lstat_needed = TRUE;
+			} else if (strcmp(optarg, "binary") == 0) {
+				binary_output = TRUE;
+				lstat_needed = TRUE;
+#		      if ! defined(__MINGW32__)
+			} else if (strcmp(optarg, "tar") == 0) {
+				if (value)
+					return usage();
+				tar_output = TRUE;
+				lstat_needed = TRUE;
+#		      endif
+			} else if (strcmp(optarg, "jobs") == 0) {
+				if (! value || atoi(value) < 1)
+					return usage();
+				cmd_jobs = atoi(value);
+#		      if ! defined(__MINGW32__)
+			} else if (strcmp(optarg, "copy") == 0) {
+				if (! value || ! *value)
+					return usage();
+				copy_root = value;
+				copy_rootlen = strlen(value);
+				while (copy_rootlen > 1 && copy_root[copy_rootlen-1] == '/')
+					copy_root[--copy_rootlen] = '\0';
+				lstat_needed = TRUE;
+			} else if (strcmp(optarg, "manifest") == 0) {
+				if (value && ! *value)
+					return usage();
+				manifest_old = value;
+				manifest = TRUE;
+				lstat_needed = TRUE;
+			} else if (strcmp(optarg, "verify") == 0) {
+				char *comma;
+				if (! value || ! *value)
+					return usage();
+				if ((comma = strrchr(value, ',')) && strcmp(comma, ",quick") == 0) {
+					*comma = '\0';
+					verify_quick = TRUE;
+				}
+				verify_path = value;
+			} else if (strcmp(optarg, "grep") == 0 || strcmp(optarg, "grep-re") == 0) {
+				if (! value || ! *value || grep_pattern)
+					return usage();
+				grep_pattern = value;
+				grep_patternlen = strlen(value);
+				grep_regex = optarg[4] == '-';
+				lstat_needed = TRUE;
+			} else if (strcmp(optarg, "grep-lines") == 0) {
+				if (value)
+					return usage();
+				grep_lines = TRUE;
+			} else if (strcmp(optarg, "grep-max") == 0) {
+				char *unit;
+				if (! value || ! isdigit((unsigned char)*value))
+					return usage();
+				grep_max = strtoull(value, &unit, 10);
+				switch (*unit) {
+					case 't': case 'T': grep_max *= 1024; // - fall through
+					case 'g': case 'G': grep_max *= 1024; // - fall through
+					case 'm': case 'M': grep_max *= 1024; // - fall through
+					case 'k': case 'K': grep_max *= 1024; unit++; break;
+				}
+				if (*unit || ! grep_max)
+					return usage();
+#		      endif
+			} else if (strcmp(optarg, "queue") == 0) {
+				if (! value || atoi(value) < 1)
+					return usage();
+				cmd_queue_max = atoi(value);
+			} else if (strcmp(optarg, "ordered") == 0) {
+				if (value)
+					return usage();
+				ordered = TRUE;
+			} else if (strcmp(optarg, "post-order") == 0) {
+				if (value)
+					return usage();
+				post_order = TRUE;
+				track_completion = TRUE;
+			} else if (strcmp(optarg, "sort") == 0) {
+				char *limit;
+				if (! value)
+					return usage();
+				if ((limit = strchr(value, ','))) {
+					*limit++ = '\0';
+					if (atoi(limit) < 1)
+						return usage();
+					sort_memlimit = atoi(limit);
+				}
+				if (*value == '-') {
+					sort_descending = TRUE;
+					value++;
+				}
+				if (strcmp(value, "size") == 0)
+					sort_key = SORT_SIZE;
+				else if (strcmp(value, "mtime") == 0)
+					sort_key = SORT_MTIME;
+				else if (strcmp(value, "atime") == 0)
+					sort_key = SORT_ATIME;
+				else if (strcmp(value, "path") == 0)
+					sort_key = SORT_PATH;
+				else
+					return usage();
+				if (sort_key != SORT_PATH)
+					lstat_needed = TRUE;
+			} else {
+				fprintf(stderr, "Unknown option --%s\n", optarg);
+				return usage();
+			}
+			break;
 		case 'h':
 		case '?':
 		default:
 			return usage();
 	}
 
+	if (rollup && (zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth)) {
+		fprintf(stderr, "Option --rollup can not be combined with -z, -r, -D, -F, -M, -A, -L, -B, -R.\n");
+		exit(1);
+	}
+	if (histogram && (zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth)) {
+		fprintf(stderr, "Option --histogram can not be combined with -z, -r, -D, -F, -M, -A, -L, -B, -R.\n");
+		exit(1);
+	}
+	if (owners && (zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth)) {
+		fprintf(stderr, "Option --owners can not be combined with -z, -r, -D, -F, -M, -A, -L, -B, -R.\n");
+		exit(1);
+	}
+	if (suffixes && (zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth)) {
+		fprintf(stderr, "Option --suffixes can not be combined with -z, -r, -D, -F, -M, -A, -L, -B, -R.\n");
+		exit(1);
+	}
+	if (dupes && (zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth)) {
+		fprintf(stderr, "Option --dupes can not be combined with -z, -r, -D, -F, -M, -A, -L, -B, -R.\n");
+		exit(1);
+	}
+	if (estimate && (zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth
+			 || rollup || histogram || owners || suffixes || dupes)) {
+		fprintf(stderr, "Option --estimate can not be combined with -z, -r, -D, -F, -M, -A, -L, -B, -R or other long options.\n");
+		exit(1);
+	}
+	if (sort_key && (just_count || verbose_count || zerosized || run_cmd || timestamp_or_size_on_heap)) {
+		fprintf(stderr, "Option --sort can not be combined with -w, -H, -v, -z, -r, -D, -F, -M, -A, -L, -B, -R or the report options.\n");
+		exit(1);
+	}
+	if (ordered && ((just_count && ! zerosized) || verbose_count || run_cmd || timestamp_or_size_on_heap || sort_key)) {
+		fprintf(stderr, "Option --ordered can not be combined with -w, -H, -v, -r, -D, -F, -M, -A, -L, -B, -R, --sort or the report options.\n");
+		exit(1);
+	}
+	if (post_order && ((just_count && ! zerosized) || verbose_count || timestamp_or_size_on_heap || sort_key
+			   || ordered || printf_fields || binary_output)) {
+		fprintf(stderr, "Option --post-order can not be combined with -w, -H, -v, -D, -F, -M, -A, -L, -B, -R, --ordered, --sort, --printf, --binary or the report options.\n");
+		exit(1);
+	}
+	if (printf_fields && (just_count || verbose_count || run_cmd || timestamp_or_size_on_heap || sort_key
+			      || modtimelist || end_with_null)) {
+		fprintf(stderr, "Option --printf can not be combined with -w, -H, -v, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R, --sort or the report options.\n");
+		exit(1);
+	}
+	if (binary_output && (just_count || verbose_count || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs
+			      || cntlongestdepth || modtimelist || end_with_null || printf_fields || sort_key || ordered
+			      || rollup || histogram || owners || suffixes || dupes || estimate)) {
+		fprintf(stderr, "Option --binary can not be combined with -w, -H, -v, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R or other long options.\n");
+		exit(1);
+	}
+	if (binary_output && isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Option --binary needs standard output redirected to a file or a pipe.\n");
+		exit(1);
+	}
+	if (tar_output && (just_count || verbose_count || zerosized || run_cmd || timestamp_or_size_on_heap || cntbiggestdirs
+			   || cntlongestdepth || modtimelist || end_with_null || printf_fields || sort_key
+			   || post_order || binary_output)) {
+		fprintf(stderr, "Option --tar can not be combined with -w, -H, -v, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R or other long options than --ordered.\n");
+		exit(1);
+	}
+	if (tar_output && isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Option --tar needs standard output redirected to a file or a pipe.\n");
+		exit(1);
+	}
+	if (copy_root && (just_count || zerosized || run_cmd || timestamp_or_size_on_heap || modtimelist || end_with_null
+			  || sort_key || ordered || post_order || printf_fields || binary_output || tar_output)) {
+		fprintf(stderr, "Option --copy can not be combined with -w, -H, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R or other long options than --jobs and --queue.\n");
+		exit(1);
+	}
+	if (manifest && (just_count || zerosized || run_cmd || timestamp_or_size_on_heap || modtimelist || end_with_null
+			 || sort_key || ordered || post_order || printf_fields || binary_output || tar_output || copy_root)) {
+		fprintf(stderr, "Option --manifest can not be combined with -w, -H, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R or other long options than --jobs and --queue.\n");
+		exit(1);
+	}
+	if (verify_path && (just_count || verbose_count || zerosized || run_cmd || timestamp_or_size_on_heap || modtimelist
+			    || end_with_null || sort_key || ordered || post_order || printf_fields || binary_output || tar_output
+			    || copy_root || manifest || argc > optind)) {
+		fprintf(stderr, "Option --verify takes no directory arguments, and can not be combined with -w, -H, -v, -z, -r, -j, -0, -D, -F, -M, -A, -L, -B, -R or other long options than --jobs and --queue.\n");
+		exit(1);
+	}
+	if (grep_pattern && ((filetypemask & ~FILETYPE_REGFILE) || zerosized || cntbiggestdirs || cntlongestdepth || estimate
+			     || verify_path)) {
+		fprintf(stderr, "Options --grep and --grep-re can not be combined with -d, -l, -b, -c, -p, -k, -z, -D, -R, --estimate or --verify.\n");
+		exit(1);
+	}
+	if ((grep_lines || grep_max) && ! grep_pattern) {
+		fprintf(stderr, "Options --grep-lines and --grep-max require --grep or --grep-re.\n");
+		exit(1);
+	}
+	if (grep_lines && (just_count || verbose_count || run_cmd || timestamp_or_size_on_heap || modtimelist || end_with_null
+			   || sort_key || ordered || post_order || printf_fields || binary_output || tar_output || copy_root
+			   || manifest || rollup || histogram || owners || suffixes || dupes)) {
+		fprintf(stderr, "Option --grep-lines can not be combined with -w, -H, -v, -r, -j, -0, -F, -M, -A, -L, -B or other long options than --grep-max.\n");
+		exit(1);
+	}
+	if (cmd_jobs && ! run_cmd && ! copy_root && ! dupes && ! manifest && ! verify_path) {
+		fprintf(stderr, "Option --jobs requires -r, --copy, --dupes, --manifest or --verify.\n");
+		exit(1);
+	}
+	if (cmd_queue_max && ((! run_cmd && ! copy_root && ! dupes && ! manifest && ! verify_path) || post_order)) {
+		fprintf(stderr, "Option --queue requires -r, --copy, --dupes, --manifest or --verify, and can not be combined with --post-order.\n");
+		exit(1);
+	}
+#     if ! defined(__MINGW32__)
+	if (copy_root) {
+		struct stat rootst;
+		if (mkdir(copy_root, 0777) < 0 && errno != EEXIST) {
+			fprintf(stderr, "%s: ", progname);
+			perror(copy_root);
+			exit(1);
+		}
+		if (stat(copy_root, &rootst) < 0 || ! S_ISDIR(rootst.st_mode)) {
+			fprintf(stderr, "Option --copy: %s is not a directory.\n", copy_root);
+			exit(1);
+		}
+	}
+	if (grep_pattern)
+		filetypemask = FILETYPE_REGFILE; // - only regular files are read, which also leaves out the start directories
+	if (grep_regex) {
+#	      if defined(REG_STARTEND)
+		int rc;
+		grep_reflags = REG_EXTENDED | REG_NEWLINE | (grep_lines ? 0 : REG_NOSUB);
+		rc = regcomp(&grep_re, grep_pattern, grep_reflags);
+		if (rc != 0) {
+			char errbuf[256];
+			(void) regerror(rc, &grep_re, errbuf, sizeof(errbuf));
+			fprintf(stderr, "Option --grep-re: %s\n", errbuf);
+			exit(1);
+		}
+#	      else
+		fprintf(stderr, "Option --grep-re is not supported on this platform.\n");
+		exit(1);
+#	      endif
+	}
+#     endif
+	if (excludelist_count)
+		exclude_prepare();
+	if (run_cmd) {
+		cmd_compile(cmd);
+		if (cmd_tmpl.builtin == BUILTIN_CHMOD)
+			lstat_needed = TRUE; // - the current mode is needed for symbolic modes
+	}
+	suffix_bytes = lstat_needed; // - sizes are only summed up if we stat every entry anyway
+
+	thread_data = calloc(threads + 1, sizeof(thread_data_t));
+	assert(thread_data);
+	buffered_output = ! isatty(STDOUT_FILENO) && ! just_count && ! verbose_count && ! run_cmd
+			  && ! sort_key && ! timestamp_or_size_on_heap && ! ordered
+			  && ! post_order // - the per-thread buffers would be written in any order
+			  && ! tar_output && ! copy_root && ! manifest && ! verify_path;
+	if (binary_output) {
+		srchrec_header_t hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, SRCHREC_MAGIC, sizeof(hdr.magic));
+		hdr.version = SRCHREC_VERSION;
+		hdr.byteorder = SRCHREC_BYTEORDER;
+		fwrite(&hdr, sizeof(hdr), 1, stdout); // - flushed by output_start()
+	}
+	if (buffered_output)
+		output_start(thread_data, threads + 1);
+	for (i = 0; i <= threads; i++) {
+		if (histogram) {
+			thread_data[i].hist = calloc(1, sizeof(histogram_t));
+			assert(thread_data[i].hist);
+		}
+		if (owners) {
+			thread_data[i].uids = calloc(OWNER_HASH_SIZE, sizeof(owner_elem_t *));
+			thread_data[i].gids = calloc(OWNER_HASH_SIZE, sizeof(owner_elem_t *));
+			assert(thread_data[i].uids && thread_data[i].gids);
+		}
+		if (suffixes) {
+			thread_data[i].suffixes = calloc(SUFFIX_HASH_SIZE, sizeof(suffix_elem_t *));
+			assert(thread_data[i].suffixes);
+		}
+		if (dupes) {
+			thread_data[i].dupes = calloc(1, sizeof(dupe_list_t));
+			assert(thread_data[i].dupes);
+		}
+		if (estimate) {
+			thread_data[i].est = calloc(1, sizeof(estimate_t));
+			assert(thread_data[i].est);
+		}
+		if (sort_key) {
+			thread_data[i].sort = calloc(1, sizeof(sort_run_t));
+			assert(thread_data[i].sort);
+		}
+		if (modtimelist || printf_fields)
+			thread_data[i].tc = timecache_new();
+		if (printf_fields || tar_output) {
+			thread_data[i].unames = calloc(NAMECACHE_SIZE, sizeof(name_elem_t *));
+			thread_data[i].gnames = calloc(NAMECACHE_SIZE, sizeof(name_elem_t *));
+			assert(thread_data[i].unames && thread_data[i].gnames);
+		}
+		if (run_cmd && cmd_tmpl.batch) {
+			thread_data[i].batch = calloc(1, sizeof(cmd_batch_t));
+			assert(thread_data[i].batch);
+			thread_data[i].batch->buf = malloc(cmd_tmpl.argmax);
+			assert(thread_data[i].batch->buf);
+		}
+	}
+	hist_now = time(NULL);
+	if ((run_cmd && ! cmd_tmpl.builtin && ! post_order) // - with --post-order, a directory must wait for its command
+	    || copy_root || manifest || verify_path)
+		cmd_executor_start(threads);
+#     if ! defined(__MINGW32__)
+	if (manifest) {
+		if (manifest_old)
+			manifest_read(manifest_old);
+		printf(MANIFEST_HEADER, MANIFEST_CHUNK_SIZE);
+	}
+#     endif
+#     if ! defined(__MINGW32__)
+	if (tar_output) {
+		static char tarbuf[TAR_RECORD * 16];
+		setvbuf(stdout, tarbuf, _IOFBF, sizeof(tarbuf)); // - only the writer thread writes to stdout
+		if (! ordered && pthread_create(&tar_writer, NULL, tar_writer_routine, NULL)) {
+			fprintf(stderr, "%s: ", progname);
+			perror("pthread_create()");
+			exit(1);
+		}
+	}
+#     endif
+
 	argc -= optind;
 	argv += optind;
 
@@ -2067,7 +6277,6 @@ int main(
 			}
 			if (debug)
 				fprintf(stderr, "%s is NOT interpreted as a directory, but as a file name to search for.\n", argv[0]);
-			fast_match_opt = TRUE;
                         if (! str_is_ascii(argv[0])) {
                                 fprintf(stderr, "Only pure ASCII characters supported for (silently selected) option -N.\n");
                                 fprintf(stderr, "Please use -n or -i instead for localized characters.\n");
@@ -2081,8 +6290,7 @@ int main(
 					exit(1);
 				}
 			}
-			fast_match_arg = strdup(argv[0]);
-			str_to_lc(fast_match_arg);
+			fast_match_add(argv[0]);
 			if (argc == 1) {
 				startdirs[0] = ".";
 				startdircount = 1;
@@ -2099,6 +6307,35 @@ int main(
 			}
 		}
 	}
+	if (globlist_count && (regex_opt || fast_match_opt || show_match)) {
+		fprintf(stderr, "Option --glob can not be combined with -n, -i, -N, --name-list, --show-match or a name argument.\n");
+		exit(1);
+	}
+	if (negate_match && globlist_count > 1) {
+		fprintf(stderr, "Negating with '!' is only supported for a single --glob pattern.\n");
+		exit(1);
+	}
+	if (negate_match && fast_match_count > 1) {
+		fprintf(stderr, "Negating with '!' is only supported for a single -N pattern.\n");
+		exit(1);
+	}
+	if (show_match && (! fast_match_opt || negate_match || just_count || verbose_count || run_cmd || summarize_diskusage
+			   || wc || timestamp_or_size_on_heap || cntbiggestdirs || cntlongestdepth || printf_fields
+			   || binary_output || tar_output || copy_root || manifest || sort_key || ordered || post_order
+			   || grep_lines)) {
+		fprintf(stderr, "Option --show-match requires -N or --name-list without '!', and can not be combined with -w, -H, -v, -r,\n");
+		fprintf(stderr, "-D, -F, -M, -A, -L, -B, -R or other long options than --name-list and --grep.\n");
+		exit(1);
+	}
+	if (fast_match_opt) {
+		fast_match_len = strlen(fast_match_arg);
+		strstr_ignorecase = strmatch_select(&strstr_impl);
+		if (fast_match_count > 1) {
+			fast_match_ac = strmatch_ac_compile(fast_match_list, fast_match_count);
+			assert(fast_match_ac);
+			strstr_impl = "Aho-Corasick";
+		}
+	}
 
 	if (cntbiggestdirs > 0) {
 		if (heap_init(cntbiggestdirs)) {
@@ -2137,7 +6374,21 @@ int main(
 		}
 	}
 
-	if (! filetypemask || filetypemask & FILETYPE_DIR) {
+	if (ordered) {
+		ordered_starts = calloc(startdircount, sizeof(ordered_start_t));
+		assert(ordered_starts);
+		for (i = 0; i < startdircount; i++)
+			ordered_starts[i].path = startdirs[i];
+		ordered_startcount = startdircount;
+	}
+
+	if (post_order) {
+		post_start_matched = calloc(startdircount, sizeof(boolean));
+		post_start_mtime = calloc(startdircount, sizeof(time_t));
+		assert(post_start_matched && post_start_mtime);
+	}
+
+	if ((! filetypemask || filetypemask & FILETYPE_DIR) && ! verify_path) {
 		for (i = 0; i < startdircount; i++) {
 		    char *dirname = strrchr(startdirs[i], '/'); // remove final / if any
 		    if (dirname && dirname[1]) // - don't remove / if startdirs[i] equals /
@@ -2145,7 +6396,7 @@ int main(
 		    else
 			dirname = startdirs[i];
 
-		    if (filename_match(dirname)) {
+		    if (filename_match(&thread_data[threads], dirname)) {
 			if (debug)
 				fprintf(stderr, "filename_match() returned TRUE for startdir = %s\n", dirname);
 
@@ -2159,9 +6410,21 @@ int main(
 			    && mindepth < 2
 			    && modtimecheck(st.st_mtime)
 			    && uidgidcheck(st.st_uid, st.st_gid)
-			    && sizecheck(st.st_size))
+			    && sizecheck(st.st_size)) {
 				accum_filecnt++;
-			else if (timestamp_or_size_on_heap
+#			      if ! defined(__MINGW32__)
+				if (copy_root)
+					copy_entry(startdirs[i], &st);
+#			      endif
+				if (histogram)
+					hist_add(thread_data[threads].hist, &st);
+#			      if ! defined(__MINGW32__)
+				if (owners) {
+					owner_add(thread_data[threads].uids, st.st_uid, &st);
+					owner_add(thread_data[threads].gids, st.st_gid, &st);
+				}
+#			      endif
+			} else if (timestamp_or_size_on_heap
 				 && mindepth < 2) {
 				if (cntmodmostrecently > 0) {
 					heap_elem_t *elem = heap_new_elem(st.st_mtime, startdirs[i]);
@@ -2197,29 +6460,139 @@ int main(
 				   && uidgidcheck(st.st_uid, st.st_gid)
 				   && sizecheck(st.st_size)
 				   && ! zerosized) {
-				if (run_cmd) 
-					do_run(cmd, startdirs[i]);
-				else if (end_with_null)
-					printf("%s%c", startdirs[i], '\0');
-				else if (modtimelist) {
-					char *timestr = printable_time(st.st_mtime);
-					printf("%s %s\n", timestr, startdirs[i]);
-					free(timestr);
-				} else if (! inode || inode == st.st_ino)
-					puts(startdirs[i]);
+				if (post_order) {
+					post_start_matched[i] = run_cmd || ! inode || inode == st.st_ino;
+					post_start_mtime[i] = st.st_mtime;
+#			      if ! defined(__MINGW32__)
+				} else if (copy_root) {
+					copy_entry(startdirs[i], &st);
+				} else if (manifest) {
+					; // - only regular files go into the manifest
+#			      endif
+				} else if (sort_key) {
+					if (! inode || inode == st.st_ino)
+						sort_add(thread_data[threads].sort, sort_key_of(&st, startdirs[i]), startdirs[i]);
+				} else if (run_cmd) 
+					do_run(&thread_data[threads], AT_FDCWD, startdirs[i], startdirs[i], &st);
+				else if (binary_output) {
+					if (! inode || inode == st.st_ino)
+						output_record(&thread_data[threads], startdirs[i], &st, TRUE, DT_DIR);
+#			      if ! defined(__MINGW32__)
+				} else if (tar_output) {
+					tar_entry_t *tarent;
+					if ((! inode || inode == st.st_ino) && (tarent = tar_member(&thread_data[threads], startdirs[i], &st))) {
+						if (ordered) {
+							ordered_starts[i].listed = TRUE;
+							ordered_starts[i].tar = tarent;
+						} else
+							tar_enqueue(tarent);
+					}
+#			      endif
+				} else if (printf_fields) {
+					if (! inode || inode == st.st_ino) {
+						size_t len = printf_format(&thread_data[threads], startdirs[i], 0, &st);
+						if (ordered) {
+							ordered_starts[i].listed = TRUE;
+							ordered_starts[i].line = line_dup(&thread_data[threads], len);
+							ordered_starts[i].linelen = len;
+						} else
+							output_line(&thread_data[threads], len);
+					}
+				} else if (ordered) {
+					if (end_with_null || modtimelist || ! inode || inode == st.st_ino) {
+						ordered_starts[i].listed = TRUE;
+						ordered_starts[i].mtime = st.st_mtime;
+					}
+				} else if (end_with_null || modtimelist)
+					output_path(&thread_data[threads], startdirs[i], st.st_mtime);
+				else if (! inode || inode == st.st_ino)
+					output_path(&thread_data[threads], startdirs[i], 0);
 			}
 		    } // if (filename_match(dirname)
 		} // for (i = 0; i < startdircount; i++)
 	} // if (! filetypemask || filetypemask & FILETYPE_DIR)
 
+	if (buffered_output) // - let the start dirs go first
+		thread_data[threads].out = out_flush(thread_data[threads].out);
+
+	if (ordered && pthread_create(&ordered_emitter, NULL, ordered_emitter_routine, NULL)) {
+		fprintf(stderr, "%s: ", progname);
+		perror("pthread_create()");
+		exit(1);
+	}
+
 	if (threads == 1)
 		inline_processing_threshold = DIRTY_CONSTANT; // - process everything inline if we have just 1 CPU...
 	thread_cnt = threads; // thread_cnt is used globally
-	thread_prepare();
+	if (estimate) {
+		estimate_trees(startdirs, startdircount);
+		free(thread_data[threads].est);
+#     if ! defined(__MINGW32__)
+	} else if (verify_path) {
+		manifest_read(verify_path);
+#     endif
+	} else {
+		thread_prepare();
+
+		traverse_trees(startdirs, startdircount);
+
+		thread_cleanup();
+	}
+
+	if (post_order) { // - the start dirs go last, after everything below them
+		for (i = 0; i < startdircount; i++)
+			if (post_start_matched[i]) {
+				if (run_cmd)
+					do_run(&thread_data[threads], AT_FDCWD, startdirs[i], startdirs[i], NULL);
+				else
+					output_path(&thread_data[threads], startdirs[i], post_start_mtime[i]);
+			}
+		free(post_start_matched);
+		free(post_start_mtime);
+	}
+
+	if (run_cmd && cmd_tmpl.batch)
+		for (i = 0; i <= threads; i++) {
+			cmd_flush(thread_data[i].batch);
+			free(thread_data[i].batch->buf);
+			free(thread_data[i].batch);
+		}
+	if (cmd_executor)
+		cmd_executor_finish();
+	if (verify_path && manifest_failed) {
+		fflush(stdout);
+		fprintf(stderr, "%s: %lu of %lu files did not verify.\n", progname, manifest_failed, manifest_records);
+	}
+#     if ! defined(__MINGW32__)
+	if (copy_root)
+		copy_finish();
+	if (tar_output && ! ordered) {
+		pthread_mutex_lock(&tar_lock);
+		tar_closed = TRUE;
+		pthread_cond_signal(&tar_cond);
+		pthread_mutex_unlock(&tar_lock);
+		pthread_join(tar_writer, NULL);
+	}
+#     endif
 
-	traverse_trees(startdirs, startdircount);
+	if (buffered_output)
+		output_finish(thread_data, threads + 1);
+
+	if (ordered) {
+		pthread_mutex_lock(&ordered_lock);
+		ordered_root.ready = TRUE;
+		pthread_cond_signal(&ordered_cond);
+		pthread_mutex_unlock(&ordered_lock);
+		pthread_join(ordered_emitter, NULL);
+		free(ordered_starts);
+#	      if ! defined(__MINGW32__)
+		if (tar_output)
+			tar_end();
+#	      endif
+	}
 
-	thread_cleanup();
+	if (sort_key)
+		sort_merge();
 
 	if (timestamp_or_size_on_heap) {
 		i = cntmodmostrecently + cntaccmostrecently + cntmodleastrecently + cntaccleastrecently + cntfattestfiles;
@@ -2270,7 +6643,63 @@ int main(
 		heap_term();
 	}
 
-	if (summarize_diskusage) {
+	if (rollup) {
+		qsort(rolluplist, rolluplist_count, sizeof(rollup_elem_t), cntrollup ? rollup_cmp_bytes : rollup_cmp_path);
+		for (i = 0; i < rolluplist_count && (! cntrollup || i < cntrollup); i++) {
+			tally_t *t = &rolluplist[i].tally;
+			char *newest = t->newest ? printable_time(t->newest) : strdup("-");
+			char *oldest = t->oldest ? printable_time(t->oldest) : strdup("-");
+			printf("%-19llu %-12llu %-19s %-19s %s\n", t->bytes, t->files, newest, oldest, rolluplist[i].name);
+			free(newest);
+			free(oldest);
+			free(rolluplist[i].name);
+		}
+		free(rolluplist);
+	}
+
+	if (histogram) {
+		histogram_t *hist = thread_data[threads].hist;
+		unsigned long long *sum = (unsigned long long *) hist;
+		for (i = 0; i < threads; i++) {
+			unsigned long long *add = (unsigned long long *) thread_data[i].hist;
+			size_t j;
+			for (j = 0; j < sizeof(histogram_t) / sizeof(unsigned long long); j++)
+				sum[j] += add[j];
+			free(thread_data[i].hist);
+		}
+		hist_print(hist);
+		free(hist);
+	}
+
+#     if ! defined(__MINGW32__)
+	if (owners) {
+		for (i = 0; i < threads; i++) {
+			owner_merge(thread_data[threads].uids, thread_data[i].uids);
+			owner_merge(thread_data[threads].gids, thread_data[i].gids);
+		}
+		owner_print(thread_data[threads].uids, FALSE);
+		owner_print(thread_data[threads].gids, TRUE);
+	}
+#     endif
+
+	if (suffixes) {
+		for (i = 0; i < threads; i++)
+			suffix_merge(thread_data[threads].suffixes, thread_data[i].suffixes);
+		suffix_print(thread_data[threads].suffixes);
+	}
+
+#     if ! defined(__MINGW32__)
+	if (dupes)
+		dupe_report(threads);
+	if (grep_pattern) {
+		for (i = 0; i <= threads; i++)
+			free(thread_data[i].grepbuf);
+		if (grep_regex)
+			regfree(&grep_re);
+	}
+#     endif
+
+	if (summarize_diskusage && ! estimate) {
 		off_t KiB = accum_du / 2UL;
 
 		if (KiB < 1024)
@@ -2286,7 +6715,7 @@ int main(
 		}
 		printf("\n");
 	}
-	if (wc)
+	if (wc && ! estimate)
 		printf("%u\n", accum_filecnt);
 
 	if (timer) {
@@ -2315,10 +6744,94 @@ int main(
 #	      if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__APPLE__)
 		fprintf(stderr, "- Unexpected lstat calls (when returned d_type is DT_UNKNOWN): %i\n", statcount_unexp);
 #	      endif
+		if (fast_match_ac)
+			fprintf(stderr, "- Matcher used by -N: %s, %u patterns, %u states, %u byte classes\n", strstr_impl,
+				fast_match_count, fast_match_ac->states, fast_match_ac->classes);
+		else if (fast_match_opt)
+			fprintf(stderr, "- Matcher used by -N: %s\n", strstr_impl);
+		if (regex_opt) {
+			unsigned long rejected = 0, decided = 0, passed = 0;
+			for (i = 0; i <= threads; i++) {
+				rejected += thread_data[i].re_rejected;
+				decided += thread_data[i].re_decided;
+				passed += thread_data[i].re_regexec;
+			}
+			fprintf(stderr, "- Prefilter of -n/-i: %s; names rejected: %lu (%.1f%%), matched without regexec: %lu, passed to regexec: %lu\n",
+				! regexpre ? "none" : regexpre->exact ? "literals only, no regexec" : regexpre->ac ? "required literal per alternative"
+				: "required literal", rejected, rejected + decided + passed ? 100.0 * rejected / (rejected + decided + passed) : 0.0,
+				decided, passed);
+		}
+		if (excluderecomp)
+			fprintf(stderr, "- Patterns of -e: %u, matched %s\n", excludelist_count, ! exclude_re_arg ? "one by one"
+				: ! exclude_pre ? "as one expression" : exclude_pre->exact ? "as one expression, by literals only"
+				: "as one expression, after a literal prefilter");
+		else if (excludelist_count)
+			fprintf(stderr, "- Exclusions of -E: %u names in a hash table, %u paths in a trie of %u nodes\n",
+				exclude_names_count, exclude_paths_count, exclude_nodes_count);
+		if (globlist_count) {
+			static const char *kinds[] = { "exact", "prefix", "suffix", "infix", "DFA", "NFA" };
+			fprintf(stderr, "- Patterns of --glob:");
+			for (i = 0; i < globlist_count; i++) {
+				fprintf(stderr, "%s %s", i ? "," : "", kinds[globlist[i]->kind]);
+				if (globlist[i]->kind == STRMATCH_GLOB_DFA)
+					fprintf(stderr, " (%u states)", globlist[i]->states);
+			}
+			fprintf(stderr, "\n");
+		}
 		fprintf(stderr, "- Number of %s enqueued directories: %i\n", fifo_queue ? "FIFO" : (ino_queue ? "INODE" : "LIFO"), queued_dirs);
 		if (ino_queue) {
 			fprintf(stderr, "- INO queue insert bypasscount: %lu\n", inolist_bypasscount);
 		}
+		if (run_cmd && cmd_tmpl.builtin) {
+			unsigned long done = 0, failed = 0;
+			for (i = 0; i <= threads; i++) {
+				done += thread_data[i].builtin_done;
+				failed += thread_data[i].builtin_failed;
+			}
+			fprintf(stderr, "- Entries handled in-process by -r: %lu, of which failed: %lu, left to the command: %lu (failed: %lu)\n",
+				done + failed, failed, cmd_spawned, cmd_failed);
+		} else if (run_cmd) {
+			fprintf(stderr, "- Commands started by -r: %lu (%s), of which failed: %lu\n", cmd_spawned,
+				cmd_tmpl.shell ? "using /bin/sh" : "without a shell", cmd_failed);
+			if (cmd_jobs && ! post_order)
+				fprintf(stderr, "- Executor threads for -r: %u, queue size: %u, traversal waited for room: %.3f s\n",
+					cmd_jobs, cmd_queue_max, cmd_throttled / 1000000.0);
+			latency_print("Queue wait of -r commands", &cmd_wait_latency);
+			latency_print("Run time of -r commands", &cmd_run_latency);
+		} else if (copy_root) {
+			fprintf(stderr, "- Entries copied by --copy: %lu (%llu bytes), of which failed: %lu\n",
+				copy_done + copy_failed, copy_bytes, copy_failed);
+			fprintf(stderr, "- Executor threads for --copy: %u, chunks of large files: %lu, traversal waited for room: %.3f s\n",
+				cmd_jobs, copy_chunks, cmd_throttled / 1000000.0);
+			latency_print("Queue wait of --copy chunks", &cmd_wait_latency);
+		} else if (dupes) {
+			fprintf(stderr, "- Files hashed by --dupes: %lu by a sample, %lu in full (%llu bytes read), unreadable: %lu\n",
+				dupe_sampled, dupe_hashed, dupe_read, dupe_failed);
+			fprintf(stderr, "- Hard links skipped by --dupes: %lu, executor threads: %u\n", dupe_links, cmd_jobs);
+			latency_print("Queue wait of --dupes jobs", &cmd_wait_latency);
+		} else if (manifest || verify_path) {
+			fprintf(stderr, "- Files hashed by --%s: %lu (%llu bytes), chunks of large files: %lu, failed: %lu\n",
+				manifest ? "manifest" : "verify", manifest_hashed, manifest_bytes, manifest_chunks, manifest_failed);
+			fprintf(stderr, "- Files %s: %lu, executor threads: %u\n",
+				manifest ? "taken from the old manifest" : "passed with unchanged size and mtime", manifest_reused, cmd_jobs);
+			latency_print("Queue wait of chunks", &cmd_wait_latency);
+		} else if (tar_output) {
+			fprintf(stderr, "- Members written by --tar: %lu (%llu bytes), read ahead by the threads: %lu, read by the writer: %lu\n",
+				tar_members, tar_bytes, tar_prefetched, tar_streamed);
+			fprintf(stderr, "- Traversal waited for room in the --tar queue: %.3f s\n", tar_throttled / 1000000.0);
+		}
+		if (grep_pattern) {
+			unsigned long files = 0, binary = 0, large = 0;
+			unsigned long long bytes = 0;
+			for (i = 0; i <= threads; i++) {
+				files += thread_data[i].grep_files;
+				binary += thread_data[i].grep_binary;
+				large += thread_data[i].grep_large;
+				bytes += thread_data[i].grep_bytes;
+			}
+			fprintf(stderr, "- Files read by --grep: %lu (%llu bytes), skipped as binary: %lu, skipped as larger than --grep-max: %lu\n",
+				files, bytes, binary, large);
+		}
 #             if defined(PR_ATOMIC_ADD)
 		fprintf(stderr, "- Program compiled with support for __sync_add_and_fetch\n");
 #             endif
@@ -2326,5 +6839,14 @@ int main(
 		fprintf(stderr, "- Compiled using: %s\n", CC_USED);
 #	      endif
 	}
-	return 0;
+	if (fast_match_ac)
+		strmatch_ac_free(fast_match_ac); // - after -S, which shows its size
+	for (i = 0; i < globlist_count; i++)
+		strmatch_glob_free(globlist[i]);
+	free(globlist);
+	strmatch_re_free(regexpre);
+	for (i = 0; i <= threads; i++)
+		thread_regex_free(&thread_data[i]);
+	exclude_free();
+	return verify_path && manifest_failed ? 1 : 0;
 }
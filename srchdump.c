@@ -0,0 +1,79 @@
+/*
+   srchdump - print the records of a srch --binary stream as text
+
+   Copyright (C) 2020 - 2023 by Jorn I. Viken <jornv@1337.no>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Usage: srchdump [file ...]
+// Prints one line per record: type, octal permissions, uid, gid, size, 512-byte blocks, inode, mtime and atime in
+// seconds since the epoch, and the path.  Records where lstat() failed show '-' for the stat fields.
+// Reads standard input if no file is given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "srchrec.h"
+
+static int dump(
+	FILE *fp,
+	const char *name)
+{
+	srchrec_reader_t *r = srchrec_open(fp);
+	const srchrec_t *rec;
+
+	if (! r) {
+		fprintf(stderr, "srchdump: %s: not a srch --binary stream\n", name);
+		return 1;
+	}
+	while ((rec = srchrec_next(r))) {
+		if (rec->flags & SRCHREC_STAT)
+			printf("%c %04o %lu %lu %llu %llu %llu %lld %lld %s\n", rec->type, (unsigned) rec->mode & 07777,
+			       (unsigned long) rec->uid, (unsigned long) rec->gid, (unsigned long long) rec->size,
+			       (unsigned long long) rec->blocks, (unsigned long long) rec->ino, (long long) rec->mtime,
+			       (long long) rec->atime, SRCHREC_PATH(rec));
+		else
+			printf("%c - - - - - - - - %s\n", rec->type, SRCHREC_PATH(rec));
+	}
+	if (r->corrupt || ferror(fp)) {
+		fprintf(stderr, "srchdump: %s: %s\n", name, r->corrupt ? "bad or truncated record" : "read error");
+		srchrec_close(r);
+		return 1;
+	}
+	srchrec_close(r);
+	return 0;
+}
+
+int main(
+	int argc,
+	char *argv[])
+{
+	int i, rc = 0;
+
+	if (argc < 2)
+		return dump(stdin, "stdin");
+	for (i = 1; i < argc; i++) {
+		FILE *fp = fopen(argv[i], "rb");
+		if (! fp) {
+			fprintf(stderr, "srchdump: ");
+			perror(argv[i]);
+			rc = 1;
+			continue;
+		}
+		rc |= dump(fp, argv[i]);
+		fclose(fp);
+	}
+	return rc;
+}
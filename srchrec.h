@@ -0,0 +1,195 @@
+/*
+   srchrec.h - record format of srch --binary output, and a small reader for it
+
+   Copyright (C) 2020 - 2023 by Jorn I. Viken <jornv@1337.no>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The stream starts with a srchrec_header_t, followed by one record per matched file/directory.
+// All integers are in the byte order of the machine running srch; a reader on a machine with the other byte order
+// recognizes the stream by byteorder, and srchrec_next() swaps the fields.
+// Each record is a srchrec_t, followed by pathlen bytes of path and a terminating NUL, padded with NULs to a
+// multiple of 8 bytes.  reclen is the length of all of that, so unknown trailing fields added by later versions
+// can be skipped.  The records of different directories are interleaved in no particular order.
+//
+// Usage:
+//	srchrec_reader_t *r = srchrec_open(stdin);
+//	const srchrec_t *rec;
+//	while ((rec = srchrec_next(r)))
+//		printf("%llu %s\n", (unsigned long long) rec->size, SRCHREC_PATH(rec));
+//	srchrec_close(r);
+
+#if ! defined(SRCHREC_H)
+#define SRCHREC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SRCHREC_MAGIC		"SRCHREC"	  // - 7 characters and a NUL
+#define SRCHREC_VERSION		1
+#define SRCHREC_BYTEORDER	0x01020304u
+
+// - values of srchrec_t type
+#define SRCHREC_REG		'f'
+#define SRCHREC_DIR		'd'
+#define SRCHREC_LNK		'l'
+#define SRCHREC_BLK		'b'
+#define SRCHREC_CHR		'c'
+#define SRCHREC_FIFO		'p'
+#define SRCHREC_SOCK		's'
+#define SRCHREC_UNKNOWN		'?'
+
+// - bits of srchrec_t flags
+#define SRCHREC_STAT		1		  // - the stat fields are valid, i.e. lstat() did not fail
+
+typedef struct srchrec_header {
+	char		 magic[8];
+	uint32_t	 version;
+	uint32_t	 byteorder;		  // - SRCHREC_BYTEORDER
+} srchrec_header_t;
+
+typedef struct srchrec {
+	uint32_t	 reclen;		  // - total length including path and padding
+	uint32_t	 pathlen;		  // - excluding the terminating NUL
+	uint64_t	 ino;
+	uint64_t	 size;
+	uint64_t	 blocks;		  // - 512-byte blocks allocated
+	int64_t		 mtime;			  // - seconds since the epoch
+	int64_t		 atime;
+	uint32_t	 uid;
+	uint32_t	 gid;
+	uint32_t	 mode;			  // - st_mode, including the file type bits
+	uint8_t		 type;			  // - SRCHREC_REG etc.
+	uint8_t		 flags;			  // - SRCHREC_STAT
+	uint16_t	 reserved;
+} srchrec_t;
+
+#define SRCHREC_PATH(rec)	((const char *) (rec) + sizeof(srchrec_t))
+#define SRCHREC_LEN(pathlen)	((sizeof(srchrec_t) + (pathlen) + 1 + 7) & ~(size_t) 7)
+
+typedef struct srchrec_reader {
+	FILE		*fp;
+	int		 swap;			  // - set if written on a machine with the other byte order
+	int		 corrupt;		  // - set if srchrec_next() met a bad or truncated record
+	char		*buf;
+	size_t		 size;
+} srchrec_reader_t;
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t srchrec_swap32(
+	uint32_t v)
+{
+	return (v >> 24) | ((v >> 8) & 0xff00u) | ((v << 8) & 0xff0000u) | (v << 24);
+}
+
+static inline uint64_t srchrec_swap64(
+	uint64_t v)
+{
+	return ((uint64_t) srchrec_swap32((uint32_t) v) << 32) | srchrec_swap32((uint32_t) (v >> 32));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Read and check the stream header.  Returns NULL if fp is not a srch --binary stream of a known version.
+static inline srchrec_reader_t *srchrec_open(
+	FILE *fp)
+{
+	srchrec_header_t hdr;
+	srchrec_reader_t *r;
+	int swap;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, SRCHREC_MAGIC, sizeof(hdr.magic)) != 0)
+		return NULL;
+	if (hdr.byteorder == SRCHREC_BYTEORDER)
+		swap = 0;
+	else if (hdr.byteorder == srchrec_swap32(SRCHREC_BYTEORDER))
+		swap = 1;
+	else
+		return NULL;
+	if ((swap ? srchrec_swap32(hdr.version) : hdr.version) != SRCHREC_VERSION)
+		return NULL;
+
+	r = calloc(1, sizeof(srchrec_reader_t));
+	if (! r)
+		return NULL;
+	r->fp = fp;
+	r->swap = swap;
+	return r;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns the next record, valid until the next call, or NULL at the end of the stream, on a read error (see ferror()),
+// on a bad or truncated record (corrupt is set), or if out of memory.
+static inline const srchrec_t *srchrec_next(
+	srchrec_reader_t *r)
+{
+	srchrec_t *rec;
+	uint32_t reclen;
+
+	if (fread(&reclen, sizeof(reclen), 1, r->fp) != 1)
+		return NULL;
+	if (r->swap)
+		reclen = srchrec_swap32(reclen);
+	if (reclen < SRCHREC_LEN(0) || reclen % 8) {
+		r->corrupt = 1;
+		return NULL;
+	}
+	if (reclen > r->size) {
+		char *buf = realloc(r->buf, reclen);
+		if (! buf)
+			return NULL;
+		r->buf = buf;
+		r->size = reclen;
+	}
+	if (fread(r->buf + sizeof(reclen), reclen - sizeof(reclen), 1, r->fp) != 1) {
+		r->corrupt = ! ferror(r->fp);
+		return NULL;
+	}
+
+	rec = (srchrec_t *) r->buf;
+	rec->reclen = reclen;
+	if (r->swap) {
+		rec->pathlen = srchrec_swap32(rec->pathlen);
+		rec->ino = srchrec_swap64(rec->ino);
+		rec->size = srchrec_swap64(rec->size);
+		rec->blocks = srchrec_swap64(rec->blocks);
+		rec->mtime = (int64_t) srchrec_swap64((uint64_t) rec->mtime);
+		rec->atime = (int64_t) srchrec_swap64((uint64_t) rec->atime);
+		rec->uid = srchrec_swap32(rec->uid);
+		rec->gid = srchrec_swap32(rec->gid);
+		rec->mode = srchrec_swap32(rec->mode);
+	}
+	if (SRCHREC_LEN(rec->pathlen) > reclen) {
+		r->corrupt = 1;
+		return NULL;
+	}
+	r->buf[sizeof(srchrec_t) + rec->pathlen] = '\0';
+	return rec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline void srchrec_close(
+	srchrec_reader_t *r)
+{
+	free(r->buf);
+	free(r);
+}
+
+#endif
@@ -0,0 +1,946 @@
+/*
+   strmatch.h - case insensitive substring search used by srch -N
+
+   Copyright (C) 2020 - 2024 by Jorn I. Viken <jornv@1337.no>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// All matchers have the same signature and give the same result: a pointer to the first occurrence of needle in
+// haystack, or NULL.  Only ASCII A - Z is folded to lower case; needle must be in lower case already.
+// The vectorized matchers compare the first and the last byte of needle against 16 or 32 positions of haystack at
+// a time, folded in-register, and only compare the rest of needle at the positions where both match.  Their loads
+// past the end of haystack never cross a page boundary, so they can not fault.
+//
+// For many needles at once, strmatch_ac_compile() builds an Aho-Corasick automaton, with the transitions of every
+// state laid out as a table indexed by byte class, so a haystack is scanned once, one table lookup per byte,
+// whatever the number of needles.  Those needles may be in any case.
+//
+// strmatch_glob_compile() compiles a shell pattern with *, ?, [...] and \ as fnmatch(3) without flags does, matching
+// case sensitively the whole of a name.  Patterns that are a literal with * at the start and/or the end only become
+// string compares; the rest become a DFA over byte classes, built from the bit-parallel (shift-and) NFA of the
+// pattern, which is used as it is for the odd pattern whose DFA would grow too big.  Matching never allocates.
+// Character classes like [[:alpha:]], equivalence classes and collating symbols are not supported.
+//
+// strmatch_re_compile() looks into an extended regular expression for what a name must contain to match.  An
+// expression that is only literals, anchored or not, separated by | is answered by string compares alone; otherwise
+// each alternative must contain a literal, and names containing none of those literals are rejected without calling
+// regexec(3).  Expressions with neither get no prefilter.
+//
+// Usage:
+//	const char *impl;
+//	strmatch_fn_t find = strmatch_select(&impl);
+//	if (find(name, strlen(name), "needle", 6))
+//		printf("%s matched by %s\n", name, impl);
+//
+//	strmatch_ac_t *ac = strmatch_ac_compile(needles, count);
+//	int i = strmatch_ac_find(ac, name);
+//	if (i >= 0)
+//		printf("%s matched by %s\n", name, needles[i]);
+//	strmatch_ac_free(ac);
+//
+//	strmatch_glob_t *g = strmatch_glob_compile("core.[0-9]*", NULL);
+//	if (g && strmatch_glob_match(g, name))
+//		printf("%s\n", name);
+//	strmatch_glob_free(g);
+//
+//	strmatch_re_t *pre = strmatch_re_compile(re, icase);
+//	int r = pre ? strmatch_re_check(pre, name) : STRMATCH_RE_MAYBE;
+//	if (r == STRMATCH_RE_YES || (r == STRMATCH_RE_MAYBE && regexec(&compiled, name, 0, NULL, 0) == 0))
+//		printf("%s\n", name);
+//	strmatch_re_free(pre);
+
+#if ! defined(STRMATCH_H)
+#define STRMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define STRMATCH_X86
+#  include <immintrin.h>
+#endif
+
+#define STRMATCH_PAGE_SIZE	4096
+#define STRMATCH_GLOB_ELEMS	63	  // - max characters, ? and [...] in a pattern that is not a plain literal
+#define STRMATCH_GLOB_STATES	1024	  // - max DFA states, else the NFA is used
+
+// - kinds of strmatch_glob_t
+#define STRMATCH_GLOB_EXACT	0	  // - literal
+#define STRMATCH_GLOB_PREFIX	1	  // - literal*
+#define STRMATCH_GLOB_SUFFIX	2	  // - *literal
+#define STRMATCH_GLOB_INFIX	3	  // - *literal*
+#define STRMATCH_GLOB_DFA	4
+#define STRMATCH_GLOB_NFA	5
+
+// - why strmatch_glob_compile() failed
+#define STRMATCH_GLOB_TOOLONG	1	  // - more than STRMATCH_GLOB_ELEMS characters
+#define STRMATCH_GLOB_CLASS	2	  // - [:class:], [=c=] or [.c.] within [...]
+#define STRMATCH_GLOB_NOMEM	3
+
+// - results of strmatch_re_check()
+#define STRMATCH_RE_NO		0	  // - does not match
+#define STRMATCH_RE_YES		1	  // - matches
+#define STRMATCH_RE_MAYBE	2	  // - regexec() must tell
+#define STRMATCH_CROSSES_PAGE(p, n) (((uintptr_t) (p) & (STRMATCH_PAGE_SIZE - 1)) > STRMATCH_PAGE_SIZE - (n))
+
+typedef char *(*strmatch_fn_t)(const char *haystack, size_t haylen, const char *needle, size_t needlelen);
+
+typedef struct strmatch_ac {
+	unsigned	 classes;		  // - byte classes: 0 for bytes in no needle, then one per folded byte
+	unsigned	 states;
+	unsigned char	 class[256];
+	uint32_t	*next;			  // - states * classes transitions
+	int32_t		*out;			  // - per state, a needle ending there or at one of its suffixes, or -1
+} strmatch_ac_t;
+
+typedef struct strmatch_glob {
+	int		 kind;			  // - STRMATCH_GLOB_EXACT etc.
+	char		*lit;			  // - the literal of the string compare kinds
+	size_t		 litlen;
+	unsigned	 classes;		  // - the rest is for STRMATCH_GLOB_DFA and STRMATCH_GLOB_NFA
+	unsigned	 states;		  // - DFA states, where 0 is the dead state and 1 the start state
+	unsigned char	 class[256];
+	uint64_t	 accept[256];		  // - per class, the NFA states that move on to the next one
+	uint64_t	 star;			  // - NFA states that stay on any byte
+	uint64_t	 final;
+	uint16_t	*next;			  // - states * classes transitions
+	unsigned char	*accepting;		  // - per DFA state
+} strmatch_glob_t;
+
+typedef struct strmatch_re_alt {
+	int		 kind;			  // - STRMATCH_GLOB_EXACT etc., from the ^ and $ anchors
+	char		*lit;			  // - in lower case if icase
+	size_t		 len;
+} strmatch_re_alt_t;
+
+typedef struct strmatch_re {
+	int		 exact;			  // - set if alts answer it all, else lits are required
+	int		 icase;
+	unsigned	 count;
+	strmatch_re_alt_t *alts;		  // - count alternatives, if exact
+	char		**lits;			  // - a literal from each of count alternatives, if not exact
+	strmatch_ac_t	*ac;			  // - those literals, if more than one
+	strmatch_fn_t	 find;			  // - case insensitive search for lits[0], or the infix alternatives
+} strmatch_re_t;
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) unsigned char strmatch_fold(
+	unsigned char c)
+{
+	return c - 'A' < 26u ? c | 0x20 : c;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) int strmatch_equal(
+	const char *s,
+	const char *needle,
+	size_t n)
+{
+	while (n--)
+		if (strmatch_fold(*s++) != (unsigned char) *needle++)
+			return 0;
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static char *strmatch_scalar(
+	const char *haystack,
+	size_t haylen,
+	const char *needle,
+	size_t needlelen)
+{
+	unsigned char first, last;
+	size_t i, positions;
+
+	if (! needlelen)
+		return (char *) haystack;
+	if (haylen < needlelen)
+		return NULL;
+	first = needle[0];
+	last = needle[needlelen-1];
+	positions = haylen - needlelen + 1;
+	for (i = 0; i < positions; i++)
+		if (strmatch_fold(haystack[i]) == first && strmatch_fold(haystack[i+needlelen-1]) == last
+		    && (needlelen <= 2 || strmatch_equal(haystack + i + 1, needle + 1, needlelen - 2)))
+			return (char *) haystack + i;
+	return NULL;
+}
+
+#if defined(STRMATCH_X86)
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline)) __m128i strmatch_fold128(
+	__m128i v)
+{
+	// - signed compares, so bytes from 0x80 and up are never taken for upper case
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static char *strmatch_sse2(
+	const char *haystack,
+	size_t haylen,
+	const char *needle,
+	size_t needlelen)
+{
+	__m128i first, last;
+	size_t i, positions;
+
+	if (! needlelen)
+		return (char *) haystack;
+	if (haylen < needlelen)
+		return NULL;
+	first = _mm_set1_epi8(needle[0]);
+	last = _mm_set1_epi8(needle[needlelen-1]);
+	positions = haylen - needlelen + 1;
+	for (i = 0; i < positions; i += 16) {
+		const char *a = haystack + i, *b = a + needlelen - 1;
+		unsigned mask;
+
+		if (positions - i < 16 && (STRMATCH_CROSSES_PAGE(a, 16) || STRMATCH_CROSSES_PAGE(b, 16)))
+			return strmatch_scalar(a, haylen - i, needle, needlelen);
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first, strmatch_fold128(_mm_loadu_si128((const __m128i *) a))),
+			_mm_cmpeq_epi8(last, strmatch_fold128(_mm_loadu_si128((const __m128i *) b)))));
+		if (positions - i < 16)
+			mask &= (1u << (positions - i)) - 1;
+		for (; mask; mask &= mask - 1) {
+			unsigned bit = __builtin_ctz(mask);
+			if (needlelen <= 2 || strmatch_equal(a + bit + 1, needle + 1, needlelen - 2))
+				return (char *) a + bit;
+		}
+	}
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __attribute__((always_inline, target("avx2"))) __m256i strmatch_fold256(
+	__m256i v)
+{
+	__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+					 _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+	return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static __attribute__((target("avx2"))) char *strmatch_avx2(
+	const char *haystack,
+	size_t haylen,
+	const char *needle,
+	size_t needlelen)
+{
+	__m256i first, last;
+	size_t i, positions;
+
+	if (! needlelen)
+		return (char *) haystack;
+	if (haylen < needlelen)
+		return NULL;
+	positions = haylen - needlelen + 1;
+	if (positions < 32) // - most file names; one or two SSE2 rounds are cheaper than a 32-byte one
+		return strmatch_sse2(haystack, haylen, needle, needlelen);
+	first = _mm256_set1_epi8(needle[0]);
+	last = _mm256_set1_epi8(needle[needlelen-1]);
+	for (i = 0; i < positions; i += 32) {
+		const char *a = haystack + i, *b = a + needlelen - 1;
+		unsigned mask;
+
+		if (positions - i < 32 && (STRMATCH_CROSSES_PAGE(a, 32) || STRMATCH_CROSSES_PAGE(b, 32)))
+			return strmatch_sse2(a, haylen - i, needle, needlelen);
+		mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first, strmatch_fold256(_mm256_loadu_si256((const __m256i *) a))),
+			_mm256_cmpeq_epi8(last, strmatch_fold256(_mm256_loadu_si256((const __m256i *) b)))));
+		if (positions - i < 32)
+			mask &= (1u << (positions - i)) - 1;
+		for (; mask; mask &= mask - 1) {
+			unsigned bit = __builtin_ctz(mask);
+			if (needlelen <= 2 || strmatch_equal(a + bit + 1, needle + 1, needlelen - 2))
+				return (char *) a + bit;
+		}
+	}
+	return NULL;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void strmatch_ac_free(
+	strmatch_ac_t *ac)
+{
+	free(ac->next);
+	free(ac->out);
+	free(ac);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns NULL if out of memory.
+static strmatch_ac_t *strmatch_ac_compile(
+	char **needles,
+	unsigned count)
+{
+	strmatch_ac_t *ac = calloc(1, sizeof(strmatch_ac_t));
+	uint32_t *fail, *queue, head = 0, tail = 0;
+	unsigned i, c, maxstates = 1;
+	const char *p;
+
+	if (! ac)
+		return NULL;
+	ac->classes = 1;
+	for (i = 0; i < count; i++)
+		for (p = needles[i]; *p; p++) {
+			unsigned char f = strmatch_fold(*p);
+			if (! ac->class[f])
+				ac->class[f] = ac->classes++;
+			maxstates++;
+		}
+	for (c = 'A'; c <= 'Z'; c++)
+		ac->class[c] = ac->class[c | 0x20];
+
+	ac->next = calloc((size_t) maxstates * ac->classes, sizeof(uint32_t));
+	ac->out = malloc(maxstates * sizeof(int32_t));
+	fail = malloc(maxstates * sizeof(uint32_t));
+	queue = malloc(maxstates * sizeof(uint32_t));
+	if (! ac->next || ! ac->out || ! fail || ! queue) {
+		free(fail);
+		free(queue);
+		strmatch_ac_free(ac);
+		return NULL;
+	}
+
+	// - the trie, where a transition to state 0 means none yet, as nothing goes back to the root
+	ac->states = 1;
+	ac->out[0] = -1;
+	for (i = 0; i < count; i++) {
+		uint32_t s = 0;
+		for (p = needles[i]; *p; p++) {
+			uint32_t *t = &ac->next[s * ac->classes + ac->class[(unsigned char) *p]];
+			if (! *t) {
+				*t = ac->states++;
+				ac->out[*t] = -1;
+			}
+			s = *t;
+		}
+		if (ac->out[s] < 0)
+			ac->out[s] = i;
+	}
+
+	// - breadth first, so the failure state of every state is complete when it is reached
+	fail[0] = 0;
+	for (c = 0; c < ac->classes; c++)
+		if (ac->next[c]) {
+			fail[ac->next[c]] = 0;
+			queue[tail++] = ac->next[c];
+		}
+	while (head < tail) {
+		uint32_t s = queue[head++];
+		if (ac->out[s] < 0)
+			ac->out[s] = ac->out[fail[s]];
+		for (c = 0; c < ac->classes; c++) {
+			uint32_t *t = &ac->next[s * ac->classes + c], f = ac->next[fail[s] * ac->classes + c];
+			if (*t) {
+				fail[*t] = f;
+				queue[tail++] = *t;
+			} else
+				*t = f;
+		}
+	}
+	free(fail);
+	free(queue);
+	return ac;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns the index of a needle found in haystack, or -1.
+static inline __attribute__((always_inline)) int strmatch_ac_find(
+	const strmatch_ac_t *ac,
+	const char *haystack)
+{
+	uint32_t s = 0;
+
+	if (ac->out[0] >= 0) // - an empty needle
+		return ac->out[0];
+	for (; *haystack; haystack++) {
+		s = ac->next[s * ac->classes + ac->class[(unsigned char) *haystack]];
+		if (ac->out[s] >= 0)
+			return ac->out[s];
+	}
+	return -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void strmatch_glob_free(
+	strmatch_glob_t *g)
+{
+	if (! g)
+		return;
+	free(g->lit);
+	free(g->next);
+	free(g->accepting);
+	free(g);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Parse one [...] at *pp, like fnmatch(3): a leading ! or ^ negates, a leading ] is literal, and a-z is a range.
+// Returns 0 if there is no closing ], so the [ is taken literally, or -1 for a [:class:], [=c=] or [.c.] in it.
+static int strmatch_glob_bracket(
+	const char **pp,
+	unsigned char set[256])
+{
+	const char *p = *pp + 1, *q;
+	int negate = 0, first = 1, c;
+
+	memset(set, 0, 256);
+	if (*p == '!' || *p == '^') {
+		negate = 1;
+		p++;
+	}
+	while (*p && (*p != ']' || first)) {
+		unsigned char lo, hi;
+		first = 0;
+		if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+			// - like fnmatch(3), a [: without a closing :] is taken literally; what it makes of [= or [. without
+			//   =] or .] depends on what follows, so those are refused too
+			for (q = p + 2; *q && (q[0] != p[1] || q[1] != ']'); q++)
+				;
+			if (*q || p[1] != ':')
+				return -1;
+		}
+		if (*p == '\\' && p[1])
+			p++;
+		lo = hi = *p++;
+		if (*p == '-' && p[1] && p[1] != ']') {
+			p++;
+			if (*p == '\\' && p[1])
+				p++;
+			hi = *p++;
+		}
+		for (c = lo; c <= hi; c++)
+			set[c] = 1;
+	}
+	if (*p != ']')
+		return 0;
+	if (negate)
+		for (c = 0; c < 256; c++)
+			set[c] = ! set[c];
+	*pp = p + 1;
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns NULL if the pattern has more than STRMATCH_GLOB_ELEMS characters besides *, unless it is a plain literal,
+// or if it uses a character class like [[:alpha:]], or if out of memory, with the reason in *error if error is set.
+static strmatch_glob_t *strmatch_glob_compile(
+	const char *pattern,
+	int *error)
+{
+	strmatch_glob_t *g = calloc(1, sizeof(strmatch_glob_t));
+	uint64_t elemset[256] = { 0 }, *sets = NULL;
+	unsigned char set[256];
+	unsigned n = 0, i, c, head, cap;
+	int literal = 1, lead = 0, trail = 0, bracket;
+	const char *p = pattern;
+	char *lit;
+
+	if (! g || ! (g->lit = lit = malloc(strlen(pattern) + 1))) {
+		strmatch_glob_free(g);
+		if (error)
+			*error = STRMATCH_GLOB_NOMEM;
+		return NULL;
+	}
+
+	// - the NFA: state i has matched i characters; elemset[b] has bit i set if byte b may be character i
+	while (*p) {
+		if (*p == '*') {
+			while (*p == '*')
+				p++;
+			g->star |= (uint64_t) 1 << (n < 64 ? n : 63);
+			if (! n)
+				lead = 1;
+			else if (! *p)
+				trail = 1;
+			else
+				literal = 0;
+			continue;
+		}
+		if (*p == '?') {
+			memset(set, 1, 256);
+			p++;
+			literal = 0;
+		} else if (*p == '[' && (bracket = strmatch_glob_bracket(&p, set))) {
+			if (bracket < 0) {
+				strmatch_glob_free(g);
+				if (error)
+					*error = STRMATCH_GLOB_CLASS;
+				return NULL;
+			}
+			literal = 0;
+		} else if (*p == '\\' && ! p[1]) {
+			// - a trailing \ escapes nothing, and like fnmatch(3) the pattern then matches no name
+			memset(set, 0, 256);
+			p++;
+			literal = 0;
+		} else {
+			if (*p == '\\' && p[1])
+				p++;
+			memset(set, 0, 256);
+			set[(unsigned char) *p] = 1;
+			*lit++ = *p++;
+		}
+		if (n < STRMATCH_GLOB_ELEMS)
+			for (c = 0; c < 256; c++)
+				if (set[c])
+					elemset[c] |= (uint64_t) 1 << n;
+		n++;
+	}
+	*lit = '\0';
+	g->litlen = lit - g->lit;
+	if (literal) {
+		g->kind = lead ? (trail ? STRMATCH_GLOB_INFIX : STRMATCH_GLOB_SUFFIX) : (trail ? STRMATCH_GLOB_PREFIX : STRMATCH_GLOB_EXACT);
+		return g;
+	}
+	if (n > STRMATCH_GLOB_ELEMS) {
+		strmatch_glob_free(g);
+		if (error)
+			*error = STRMATCH_GLOB_TOOLONG;
+		return NULL;
+	}
+	g->final = (uint64_t) 1 << n;
+
+	// - bytes no character tells apart share a class
+	for (c = 0; c < 256; c++) {
+		for (i = 0; i < g->classes && g->accept[i] != elemset[c]; i++)
+			;
+		if (i == g->classes)
+			g->accept[g->classes++] = elemset[c];
+		g->class[c] = i;
+	}
+
+	// - the DFA, from the sets of NFA states reachable from the start
+	cap = 16;
+	sets = malloc(cap * sizeof(uint64_t));
+	g->next = malloc(cap * g->classes * sizeof(uint16_t));
+	if (! sets || ! g->next)
+		goto nomem;
+	sets[0] = 0;
+	sets[1] = 1;
+	g->states = 2;
+	for (head = 0; head < g->states; head++)
+		for (c = 0; c < g->classes; c++) {
+			uint64_t to = ((sets[head] & g->accept[c]) << 1) | (sets[head] & g->star);
+			for (i = 0; i < g->states && sets[i] != to; i++)
+				;
+			if (i == g->states) {
+				if (g->states == STRMATCH_GLOB_STATES) {
+					free(sets);
+					free(g->next);
+					g->next = NULL;
+					g->kind = STRMATCH_GLOB_NFA;
+					return g;
+				}
+				if (g->states == cap) {
+					uint64_t *s2 = realloc(sets, cap * 2 * sizeof(uint64_t));
+					uint16_t *n2 = s2 ? realloc(g->next, cap * 2 * g->classes * sizeof(uint16_t)) : NULL;
+					if (s2)
+						sets = s2;
+					if (! n2)
+						goto nomem;
+					g->next = n2;
+					cap *= 2;
+				}
+				sets[g->states++] = to;
+			}
+			g->next[head * g->classes + c] = i;
+		}
+	if (! (g->accepting = malloc(g->states)))
+		goto nomem;
+	for (i = 0; i < g->states; i++)
+		g->accepting[i] = (sets[i] & g->final) != 0;
+	free(sets);
+	g->kind = STRMATCH_GLOB_DFA;
+	return g;
+
+nomem:
+	free(sets);
+	strmatch_glob_free(g);
+	if (error)
+		*error = STRMATCH_GLOB_NOMEM;
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns nonzero if the whole of name matches the pattern g was compiled from.
+static int strmatch_glob_match(
+	const strmatch_glob_t *g,
+	const char *name)
+{
+	size_t len;
+
+	switch (g->kind) {
+		case STRMATCH_GLOB_EXACT:
+			return strcmp(name, g->lit) == 0;
+		case STRMATCH_GLOB_PREFIX:
+			return strncmp(name, g->lit, g->litlen) == 0;
+		case STRMATCH_GLOB_SUFFIX:
+			len = strlen(name);
+			return len >= g->litlen && memcmp(name + len - g->litlen, g->lit, g->litlen) == 0;
+		case STRMATCH_GLOB_INFIX:
+			return strstr(name, g->lit) != NULL;
+		case STRMATCH_GLOB_DFA: {
+			unsigned s = 1;
+			for (; *name; name++)
+				if (! (s = g->next[s * g->classes + g->class[(unsigned char) *name]]))
+					return 0;
+			return g->accepting[s];
+		}
+		default: {
+			uint64_t s = 1;
+			for (; *name; name++)
+				if (! (s = ((s & g->accept[g->class[(unsigned char) *name]]) << 1) | (s & g->star)))
+					return 0;
+			return (s & g->final) != 0;
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static strmatch_fn_t strmatch_select(const char **);
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void strmatch_re_free(
+	strmatch_re_t *pre)
+{
+	unsigned i;
+
+	if (! pre)
+		return;
+	for (i = 0; i < pre->count; i++) {
+		if (pre->alts)
+			free(pre->alts[i].lit);
+		if (pre->lits)
+			free(pre->lits[i]);
+	}
+	free(pre->alts);
+	free(pre->lits);
+	if (pre->ac)
+		strmatch_ac_free(pre->ac);
+	free(pre);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns the end of the bracket expression, parenthesized group or {m,n} interval at p, or NULL if unterminated.
+static const char *strmatch_re_skip(
+	const char *p,
+	const char *end)
+{
+	int depth = 0;
+
+	if (*p == '{') {
+		while (p < end && *p != '}')
+			p++;
+		return p < end ? p + 1 : NULL;
+	}
+	do {
+		if (*p == '\\')
+			p++;
+		else if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+		else if (*p == '[') {
+			p++;
+			if (p < end && *p == '^')
+				p++;
+			if (p < end && *p == ']')
+				p++;
+			while (p < end && *p != ']') {
+				if (*p == '[' && p + 1 < end && strchr(":.=", p[1])) {
+					char close = p[1];
+					for (p += 2; p + 1 < end && ! (p[0] == close && p[1] == ']'); p++)
+						;
+					p++;
+				}
+				p++;
+			}
+		}
+		p++;
+	} while (p < end && depth > 0);
+	return p <= end && depth == 0 ? p : NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Look into the alternative from p to end: set *kind and *lit if it is an anchored or unanchored literal only, and
+// the longest literal it requires in *req, or leave them NULL.  Returns 0 if the expression could not be followed.
+static int strmatch_re_alt(
+	const char *p,
+	const char *end,
+	int icase,
+	int *kind,
+	char **lit,
+	char **req)
+{
+	char *all = malloc(end - p + 1), *run = malloc(end - p + 1);
+	size_t alllen = 0, runlen = 0, reqlen = 0;
+	int pure = 1, start = 0, stop = 0;
+
+	*lit = *req = NULL;
+	if (! all || ! run) {
+		free(all);
+		free(run);
+		return 0;
+	}
+	if (p < end && *p == '^') {
+		start = 1;
+		p++;
+	}
+	while (p <= end) {
+		unsigned char c = 0;
+		int literal = 0, required = 0;
+
+		if (p < end && *p == '\\' && p + 1 < end && strchr(".[]()*+?{}|^$\\/", p[1])) {
+			c = p[1];
+			literal = 1;
+			p += 2;
+		} else if (p < end && *p == '\\') { // - a back reference or a GNU extension like \w or \<
+			pure = 0;
+			p += 2;
+		} else if (p < end && *p == '$' && p + 1 == end) {
+			stop = 1;
+			p++;
+		} else if (p < end && (*p == '[' || *p == '(')) {
+			pure = 0;
+			if (! (p = strmatch_re_skip(p, end)))
+				goto fail;
+		} else if (p < end && strchr("*+?{", *p)) { // - a repeated group or bracket expression
+			pure = 0;
+			if (*p != '{')
+				p++;
+			else if (! (p = strmatch_re_skip(p, end)))
+				goto fail;
+		} else if (p < end && (*p == '.' || *p == '^' || *p == '$')) {
+			pure = 0;
+			p++;
+		} else if (p < end && *p == ')')
+			goto fail;
+		else if (p < end) {
+			c = *p++;
+			literal = 1;
+		} else
+			p++; // - past the end, to close the last run
+
+		if (literal) {
+			const char *q = p;
+			int optional = 0;
+
+			// - the quantifiers are skipped next round; a + stacked with others, as in a+?, may still make c optional
+			while (q && q < end && strchr("*+?{", *q)) {
+				optional |= *q != '+';
+				q = *q == '{' ? strmatch_re_skip(q, end) : q + 1;
+			}
+			if (optional)
+				pure = 0;
+			else if (c < 0x80) { // - other bytes may be part of a multibyte character
+				all[alllen++] = icase ? strmatch_fold(c) : c;
+				run[runlen++] = strmatch_fold(c);
+				required = 1;
+				if (q != p) { // - c may be repeated, so the run can not go on past it
+					pure = 0;
+					required = 0;
+				}
+			} else
+				pure = 0;
+		}
+		if (! required && runlen) {
+			if (runlen > reqlen) {
+				free(*req);
+				if (! (*req = malloc(runlen + 1)))
+					goto fail;
+				memcpy(*req, run, runlen);
+				(*req)[runlen] = '\0';
+				reqlen = runlen;
+			}
+			runlen = 0;
+		}
+	}
+	if (pure) {
+		all[alllen] = '\0';
+		*lit = all;
+		*kind = start ? (stop ? STRMATCH_GLOB_EXACT : STRMATCH_GLOB_PREFIX) : (stop ? STRMATCH_GLOB_SUFFIX : STRMATCH_GLOB_INFIX);
+	} else
+		free(all);
+	free(run);
+	return 1;
+
+fail:
+	free(all);
+	free(run);
+	free(*req);
+	*req = NULL;
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns NULL if the expression gets no prefilter, or if out of memory.
+static strmatch_re_t *strmatch_re_compile(
+	const char *re,
+	int icase)
+{
+	strmatch_re_t *pre = calloc(1, sizeof(strmatch_re_t));
+	const char *p = re, *alt = re, *end = re + strlen(re);
+	unsigned n = 1, i = 0, lits = 0;
+	const char *impl;
+
+	if (! pre)
+		return NULL;
+	for (; *p; p++) // - count the alternatives at the top level
+		if (*p == '|')
+			n++;
+		else if (*p == '\\' && p[1])
+			p++;
+		else if (*p == '[' || *p == '(') {
+			const char *q = strmatch_re_skip(p, end);
+			if (! q)
+				goto none;
+			p = q - 1;
+		}
+	pre->alts = calloc(n, sizeof(strmatch_re_alt_t));
+	pre->lits = calloc(n, sizeof(char *));
+	if (! pre->alts || ! pre->lits)
+		goto none;
+	pre->icase = icase;
+	pre->exact = 1;
+	for (p = re; ; p++) {
+		if (*p == '\\' && p[1])
+			p++;
+		else if (*p == '[' || *p == '(')
+			p = strmatch_re_skip(p, end) - 1;
+		else if (*p == '|' || ! *p) {
+			if (! strmatch_re_alt(alt, p, icase, &pre->alts[i].kind, &pre->alts[i].lit, &pre->lits[i]))
+				goto none;
+			if (pre->alts[i].lit)
+				pre->alts[i].len = strlen(pre->alts[i].lit);
+			else
+				pre->exact = 0;
+			lits += pre->lits[i] && pre->lits[i][1]; // - a single byte is in too many names to be worth the search
+			pre->count = ++i;
+			if (! *p)
+				break;
+			alt = p + 1;
+		}
+	}
+	pre->find = strmatch_select(&impl);
+	if (pre->exact)
+		return pre;
+	if (lits < n) // - an alternative that requires no useful literal, so most names might match
+		goto none;
+	if (n > 1 && ! (pre->ac = strmatch_ac_compile(pre->lits, n)))
+		goto none;
+	return pre;
+
+none:
+	strmatch_re_free(pre);
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns STRMATCH_RE_NO, STRMATCH_RE_YES, or STRMATCH_RE_MAYBE if regexec() must be called.  With icase, names
+// with non-ASCII bytes are left to regexec(), which in a UTF-8 locale also folds e.g. U+017F, a long s, to s.
+static int strmatch_re_check(
+	const strmatch_re_t *pre,
+	const char *name)
+{
+	size_t len;
+	unsigned i;
+
+	if (pre->icase) {
+		for (len = 0; name[len]; len++)
+			if ((unsigned char) name[len] >= 0x80)
+				return STRMATCH_RE_MAYBE;
+	} else
+		len = strlen(name);
+	if (! pre->exact) {
+		if (pre->ac)
+			return strmatch_ac_find(pre->ac, name) < 0 ? STRMATCH_RE_NO : STRMATCH_RE_MAYBE;
+		return pre->find(name, len, pre->lits[0], strlen(pre->lits[0])) ? STRMATCH_RE_MAYBE : STRMATCH_RE_NO;
+	}
+	for (i = 0; i < pre->count; i++) {
+		const strmatch_re_alt_t *a = &pre->alts[i];
+		const char *at;
+
+		if (a->len > len)
+			continue;
+		switch (a->kind) {
+			case STRMATCH_GLOB_EXACT:
+				if (a->len != len)
+					continue;
+				// - fall through
+			case STRMATCH_GLOB_PREFIX:
+				at = name;
+				break;
+			case STRMATCH_GLOB_SUFFIX:
+				at = name + len - a->len;
+				break;
+			default:
+				if (pre->icase ? pre->find(name, len, a->lit, a->len) != NULL : strstr(name, a->lit) != NULL)
+					return STRMATCH_RE_YES;
+				continue;
+		}
+		if (pre->icase ? strmatch_equal(at, a->lit, a->len) : memcmp(at, a->lit, a->len) == 0)
+			return STRMATCH_RE_YES;
+	}
+	return STRMATCH_RE_NO;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Returns the fastest matcher the CPU supports, and sets *impl to its name.
+static strmatch_fn_t strmatch_select(
+	const char **impl)
+{
+#     if defined(STRMATCH_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		*impl = "avx2";
+		return strmatch_avx2;
+	}
+	*impl = "sse2";
+	return strmatch_sse2;
+#     else
+	*impl = "scalar";
+	return strmatch_scalar;
+#     endif
+}
+
+#endif